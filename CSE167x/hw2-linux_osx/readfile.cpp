@@ -11,9 +11,8 @@
 // Their use is optional in your program.  
 
 
-// The functions readvals and readfile do basic parsing.  You can of course 
-// rewrite the parser as you wish, but we think this basic form might be 
-// useful to you.  It is a very simple parser.
+// The function readfile does basic parsing, splitting lines and finding 
+// commands with the shared scene tokenizer (common/scene_tokenizer.h).
 
 // Please fill in parts that say YOUR CODE FOR HW 2 HERE. 
 // Read the other parts to get a context of what is going on. 
@@ -21,11 +20,8 @@
 /*****************************************************************************/
 
 // Basic includes to get this file to work.  
-#include <glm/gtx/string_cast.hpp>
 #include <iostream>
 #include <string>
-#include <fstream>
-#include <sstream>
 #include <deque>
 #include <stack>
 #ifdef __APPLE__
@@ -37,6 +33,7 @@
 #include <GL/glut.h>
 #endif
 #include "Transform.h" 
+#include "scene_tokenizer.h" // shared with the CSE168 ray tracer, in ../../common
 
 using namespace std;
 using namespace glm;
@@ -62,51 +59,52 @@ void rightmultiply(const mat4 & M, stack<mat4> &transfstack)
   T = T * M; 
 }
 
-// Function to read the input data values
-// Use is optional, but should be very helpful in parsing.  
-bool readvals(stringstream &s, const int numvals, GLfloat* values) 
-{
-  for (int i = 0; i < numvals; i++) {
-    s >> values[i]; 
-    if (s.fail()) {
-      cout << "Failed reading value " << i << " will skip\n"; 
-      return false;
-    }
-  }
-  return true; 
-}
+// The commands readfile() knows
+enum command { 
+  cmd_light, cmd_ambient, cmd_diffuse, cmd_specular, cmd_emission, cmd_shininess, 
+  cmd_size, cmd_camera, cmd_sphere, cmd_cube, cmd_teapot, 
+  cmd_translate, cmd_scale, cmd_rotate, cmd_pushTransform, cmd_popTransform 
+}; 
+
+// Looked up with one hash per line instead of comparing against every name in turn
+static const scene_file::command_table commands { 
+  {"light", cmd_light}, {"ambient", cmd_ambient}, {"diffuse", cmd_diffuse}, 
+  {"specular", cmd_specular}, {"emission", cmd_emission}, {"shininess", cmd_shininess}, 
+  {"size", cmd_size}, {"camera", cmd_camera}, 
+  {"sphere", cmd_sphere}, {"cube", cmd_cube}, {"teapot", cmd_teapot}, 
+  {"translate", cmd_translate}, {"scale", cmd_scale}, {"rotate", cmd_rotate}, 
+  {"pushTransform", cmd_pushTransform}, {"popTransform", cmd_popTransform} 
+}; 
 
 void readfile(const char* filename) 
 {
-  string str, cmd; 
-  ifstream in;
-  in.open(filename); 
-  if (in.is_open()) {
+  // The whole file is read at once; lines and tokens are pointers into it 
+  // and values are converted straight from the text, nothing is copied. 
+  string text; 
+  if (scene_file::read_text_file(filename, text)) {
 
     // I need to implement a matrix stack to store transforms.  
     // This is done using standard STL Templates 
     stack <mat4> transfstack; 
     transfstack.push(mat4(1.0));  // identity
 
-    getline (in, str); 
-    while (in) {
-      if ((str.find_first_not_of(" \t\r\n") != string::npos) && (str[0] != '#')) {
-        // Ruled out comment and blank lines 
-
-        stringstream s(str);
-        s >> cmd; 
+    // Ruled out comment and blank lines, the rest come here 
+    scene_file::parse_commands(text, commands, [&](int cmd, const scene_file::token& name, 
+        scene_file::line_tokenizer& s, const scene_file::token& line) {
         int i; 
         GLfloat values[10]; // Position and color for light, colors for others
         // Up to 10 params for cameras.  
         bool validinput; // Validity of input 
 
+        switch (cmd) {
+
         // Process the light, add it to database.
         // Lighting Command
-        if (cmd == "light") {
+        case cmd_light:
           if (numused == numLights) { // No more Lights 
             cerr << "Reached Maximum Number of Lights " << numused << " Will ignore further lights\n";
           } else {
-            validinput = readvals(s, 8, values); // Position/color for lts.
+            validinput = s.read_floats(8, values); // Position/color for lts.
             if (validinput) {
 
               // YOUR CODE FOR HW 2 HERE. 
@@ -124,7 +122,7 @@ void readfile(const char* filename)
               ++numused; 
             }
           }
-        }
+          break;
 
         // Material Commands 
         // Ambient, diffuse, specular, shininess properties for each object.
@@ -132,46 +130,52 @@ void readfile(const char* filename)
         // the skeleton, also as a hint of how to do the more complex ones.
         // Note that no transforms/stacks are applied to the colors. 
 
-        else if (cmd == "ambient") {
-          validinput = readvals(s, 4, values); // colors 
+        case cmd_ambient:
+          validinput = s.read_floats(4, values); // colors 
           if (validinput) {
             for (i = 0; i < 4; i++) {
               ambient[i] = values[i]; 
             }
           }
-        } else if (cmd == "diffuse") {
-          validinput = readvals(s, 4, values); 
+          break;
+        case cmd_diffuse:
+          validinput = s.read_floats(4, values); 
           if (validinput) {
             for (i = 0; i < 4; i++) {
               diffuse[i] = values[i]; 
             }
           }
-        } else if (cmd == "specular") {
-          validinput = readvals(s, 4, values); 
+          break;
+        case cmd_specular:
+          validinput = s.read_floats(4, values); 
           if (validinput) {
             for (i = 0; i < 4; i++) {
               specular[i] = values[i]; 
             }
           }
-        } else if (cmd == "emission") {
-          validinput = readvals(s, 4, values); 
+          break;
+        case cmd_emission:
+          validinput = s.read_floats(4, values); 
           if (validinput) {
             for (i = 0; i < 4; i++) {
               emission[i] = values[i]; 
             }
           }
-        } else if (cmd == "shininess") {
-          validinput = readvals(s, 1, values); 
+          break;
+        case cmd_shininess:
+          validinput = s.read_floats(1, values); 
           if (validinput) {
             shininess = values[0]; 
           }
-        } else if (cmd == "size") {
-          validinput = readvals(s,2,values); 
+          break;
+        case cmd_size:
+          validinput = s.read_floats(2, values); 
           if (validinput) { 
             w = (int) values[0]; h = (int) values[1]; 
           } 
-        } else if (cmd == "camera") {
-          validinput = readvals(s,10,values); // 10 values eye cen up fov
+          break;
+        case cmd_camera:
+          validinput = s.read_floats(10, values); // 10 values eye cen up fov
           if (validinput) {
 
             // YOUR CODE FOR HW 2 HERE
@@ -179,9 +183,6 @@ void readfile(const char* filename)
             // You may need to use the upvector fn in Transform.cpp
             // to set up correctly. 
             // Set eyeinit upinit center fovy in variables.h 
-						
-						//for(i=0; i<10; i++) { std::cout << values[i] << std::endl; }
-						//std::cout << to_string(eyeinit) << to_string(center) << to_string(upinit) << std::endl;
 
 						vec3 lookFrom = vec3(values[0], values[1], values[2]);
 						eyeinit = lookFrom;
@@ -192,20 +193,18 @@ void readfile(const char* filename)
 						vec3 up = normalize(vec3(values[6], values[7], values[8]));
 						upinit = Transform::upvector(up, lookAt-lookFrom);
 
-						//std::cout << to_string(lookFrom) << to_string(lookAt) << to_string(upinit) << std::endl;
-
 						fovy = values[9];
           }
-        }
+          break;
 
         // I've left the code for loading objects in the skeleton, so 
         // you can get a sense of how this works.  
         // Also look at demo.txt to get a sense of why things are done this way.
-        else if (cmd == "sphere" || cmd == "cube" || cmd == "teapot") {
+        case cmd_sphere: case cmd_cube: case cmd_teapot:
           if (numobjects == maxobjects) { // No more objects 
             cerr << "Reached Maximum Number of Objects " << numobjects << " Will ignore further objects\n";
           } else {
-            validinput = readvals(s, 1, values); 
+            validinput = s.read_floats(1, values); 
             if (validinput) {
               object * obj = &(objects[numobjects]); 
               obj->size = values[0]; 
@@ -220,25 +219,23 @@ void readfile(const char* filename)
               obj->shininess = shininess; 
 
               // Set the object's transform
-							cout << "readfile.cpp [transfstack.top()] " << endl << to_string(transfstack.top()) << endl << endl;
               obj->transform = transfstack.top(); 
-							cout << "readfile.cpp [obj->transform] " << endl << to_string(obj->transform) << endl << endl;
 
               // Set the object's type
-              if (cmd == "sphere") {
+              if (cmd == cmd_sphere) {
                 obj->type = sphere; 
-              } else if (cmd == "cube") {
+              } else if (cmd == cmd_cube) {
                 obj->type = cube; 
-              } else if (cmd == "teapot") {
+              } else if (cmd == cmd_teapot) {
                 obj->type = teapot; 
               }
             }
             ++numobjects; 
           }
-        }
+          break;
 
-        else if (cmd == "translate") {
-          validinput = readvals(s,3,values); 
+        case cmd_translate:
+          validinput = s.read_floats(3, values); 
           if (validinput) {
 
             // YOUR CODE FOR HW 2 HERE.  
@@ -248,19 +245,11 @@ void readfile(const char* filename)
 
 						mat4 translateMat = Transform::translate(values[0], values[1], values[2]);
 						//multiply the stack here
-						cout << "values[0]: " << values[0] << " values[1]: " << values[1] << " values[2]: " << values[2] << endl << endl;
-						cout << "readfile.cpp: [translateMat] " << endl << to_string(translateMat) << endl << endl;
-
-						
-						//rightmultiply(translateMat, transfstack);
-						*(&transfstack.top()) = transfstack.top() * translateMat;				
-	
-						cout << "readfile.cpp: [translate] " << endl << to_string(transfstack.top()) << endl << endl;
-					
+						rightmultiply(translateMat, transfstack);
           }
-        }
-        else if (cmd == "scale") {
-          validinput = readvals(s,3,values); 
+          break;
+        case cmd_scale:
+          validinput = s.read_floats(3, values); 
           if (validinput) {
 
             // YOUR CODE FOR HW 2 HERE.  
@@ -269,16 +258,11 @@ void readfile(const char* filename)
             // Also keep in mind what order your matrix is!
 						mat4 scaleMat = Transform::scale(values[0], values[1], values[2]);
 						//multiply stack
-						//rightmultiply(scaleMat, transfstack);
-						*(&transfstack.top()) = transfstack.top() * scaleMat;				
-
-
-						cout << "readfile.cpp: [scale] " << endl << to_string(transfstack.top()) << endl << endl;
-
+						rightmultiply(scaleMat, transfstack);
           }
-        }
-        else if (cmd == "rotate") {
-          validinput = readvals(s,4,values); 
+          break;
+        case cmd_rotate:
+          validinput = s.read_floats(4, values); 
           if (validinput) {
 
             // YOUR CODE FOR HW 2 HERE. 
@@ -289,38 +273,31 @@ void readfile(const char* filename)
             // Also keep in mind what order your matrix is!
 
 						mat3 rotateMat3 = Transform::rotate(values[3], vec3(values[0], values[1], values[2]));
-//std::cout << to_string(rotateMat3) << std::endl;
 
 						//somehow transfer mat3 to mat4
 						mat4 rotateMat4 = mat4(rotateMat3); 
-//std::cout << glm::to_string(rotateMat4) << std::endl;
 						
 						//multiply the matrix stack
-						//rightmultiply(rotateMat4, transfstack);
-						*(&transfstack.top()) = transfstack.top() * rotateMat4;				
-
-						cout << "readfile.cpp: [rotate] " << endl << to_string(transfstack.top()) << endl << endl;;
-
+						rightmultiply(rotateMat4, transfstack);
           }
-        }
+          break;
 
         // I include the basic push/pop code for matrix stacks
-        else if (cmd == "pushTransform") {
+        case cmd_pushTransform:
           transfstack.push(transfstack.top()); 
-        } else if (cmd == "popTransform") {
+          break;
+        case cmd_popTransform:
           if (transfstack.size() <= 1) {
             cerr << "Stack has no elements.  Cannot Pop\n"; 
           } else {
             transfstack.pop(); 
           }
-        }
+          break;
 
-        else {
-          cerr << "Unknown Command: " << cmd << " Skipping \n"; 
+        default:
+          cerr << "Unknown Command: " << name << " Skipping \n"; 
         }
-      }
-      getline (in, str); 
-    }
+    });
 
     // Set up initial position for eye, up and amount
     // As well as booleans 
@@ -4,18 +4,40 @@
 #include "rtweekend.h"
 #include "color.h"
 #include "sphere.h"
+#include "triangle.h"
 #include "hittable_list.h"
+#include "bvh.h"
+#include "compressed_bvh.h"
+#include "transform.h"
+#include "scene.h"
+#include "parallel.h"
+#include "wavefront.h"
+#include "shadow_cache.h"
+#include "light_arrays.h"
+#include "antialias.h"
+#include "progressive.h"
+#include "sampler.h"
+#include "png_writer.h"
+#include "image_reader.h"
+#include "gbuffer.h"
+#include "render_server.h"
+#include "batch.h"
+#include "distributed.h"
+#include "trace.h"
+#include "scene_loader.h"
+#include "memory_accounting.h"
 
 #include <sstream>
 #include <fstream>
 #include <string>
+#include <stack>
+#include <chrono>
+#include <mutex>
+#include <random>
 
 
 using namespace std;
 
-void Rasterize(double aspectRatio, int imageWidth, int bitsPerPixel);
-void Rasterize(int, int);
-
 double hit_sphere(const point3& center, double radius, const ray& r)
 {
 	// ray from center of sphere to eye
@@ -42,245 +64,1475 @@ double hit_sphere(const point3& center, double radius, const ray& r)
 	}
 }
 
-color ray_color(const ray& r, const hittable& world) {
+// what a worker thread carries from pixel to pixel; none of it is shared between threads
+struct shading_context {
+	shading_context(const light_arrays* l, bool cacheShadows)
+		: lights(l), shadows(l->size(), cacheShadows) {}
+
+	const light_arrays* lights;
+	shadow_cache shadows;
+	light_terms terms;
+	// with light culling: the lights that matter at the current shading point, and how many that
+	// came to over all the points shaded
+	std::vector<int> nearbyLights;
+	long long shadingPoints = 0;
+	long long lightsShaded = 0;
+	// per-row scratch, reset at the start of every row
+	memory_arena scratch;
+};
+
+color ray_color(const ray& r, const hittable& world, const scene& sc, int depth, shading_context& ctx);
+
+// rays that hit nothing are black, as in the homework's reference images
+color background(const ray&) {
+	return color(0, 0, 0);
+}
+
+// shading for a ray that hit something: ambient + emission, Blinn-Phong for every light that
+// isn't blocked, and a mirror reflection weighted by specular until maxdepth
+color shade(const ray& r, const hit_record& rec, const hittable& world, const scene& sc, int depth, shading_context& ctx) {
+	const material& m = sc.materials[rec.mat_id];
+	color result = m.ambient + m.emission;
+
+	vec3 to_eye = -unit_vector(r.direction());
+	point3 origin = rec.p + ray_epsilon * rec.normal;
+
+	if (ctx.lights->culling()) {
+		// only the lights the light bvh can't rule out, one at a time; sample_light and blinn_phong
+		// give the same bits as the all-lights kernel below, so a cutoff nothing falls under changes nothing
+		ctx.lights->influential(rec.p, m, ctx.nearbyLights);
+		ctx.shadingPoints++;
+		ctx.lightsShaded += ctx.nearbyLights.size();
+		for (int i : ctx.nearbyLights) {
+			light_sample s = sample_light(sc.lights[i], rec.p, sc.attenuation);
+			color c = blinn_phong(m, rec.normal, s.to_light, to_eye, s.radiance);
+			if (!(c.x() > 0 || c.y() > 0 || c.z() > 0)) continue;
+			if (!ctx.shadows.occluded(world, i, ray(origin, s.to_light), s.distance))
+				result += c;
+		}
+	}
+	else {
+		// every light's term at once, then the shadow rays for the ones that add anything
+		blinn_phong_all(*ctx.lights, m, rec.p, rec.normal, to_eye, sc.attenuation, ctx.terms);
+		const light_terms& t = ctx.terms;
+		for (int i = 0; i < static_cast<int>(sc.lights.size()); i++) {
+			int s = ctx.lights->slot[i];
+			if (!t.contributes(s)) continue;
+
+			// shadow ray, anything between the point and the light blocks it
+			if (!ctx.shadows.occluded(world, i, ray(origin, vec3(t.dx[s], t.dy[s], t.dz[s])), t.distance[s]))
+				result += color(t.r[s], t.g[s], t.b[s]);
+		}
+	}
+
+	// the reflection reuses ctx.terms, which is fine since this point is done with them
+	if (depth < sc.maxdepth && m.reflective()) {
+		ray reflected(origin, reflect(unit_vector(r.direction()), rec.normal));
+		result += m.specular * ray_color(reflected, world, sc, depth + 1, ctx);
+	}
+
+	return result;
+}
+
+// depth is 1 for camera rays
+color ray_color(const ray& r, const hittable& world, const scene& sc, int depth, shading_context& ctx) {
 	hit_record rec;
 
 	if (world.hit(r, 0, infinity, rec)) {
-		return 0.5 * (rec.normal + color(1, 1, 1));
+		return shade(r, rec, world, sc, depth, ctx);
 	}
 
-	// else return the gradient background sky
-	vec3 unit_direction = unit_vector(r.direction());
-	auto t = 0.5 * (unit_direction.y() + 1.0);
-	return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
+	return background(r);
 }
 
-void PrintProgress(int i, int j, int imageWidth, int imageHeight, int progressArray[]) {
-	float progress = static_cast<float>((i * (imageHeight)+((j - imageHeight + 1.0) * -1)));
-	float total = static_cast<float> ((imageHeight) * (imageWidth));
-	int percent = static_cast<float>(progress / total * 100);
-	if (progressArray[percent] != 1) {
+void PrintProgress(int rowsDone, int imageHeight, int progressArray[]) {
+	int percent = static_cast<int>(100.0 * rowsDone / imageHeight);
+	if (percent < 100 && progressArray[percent] != 1) {
 		std::cout << "Rendering: " << percent << "%" << std::endl;
 		progressArray[percent] = 1;
 	}
 }
 
-void Rasterize(int imageWidth, int imageHeight) {
-	double aspectRatio = imageWidth / imageHeight;
-	int bpp = 24;
-	Rasterize(aspectRatio, imageWidth, bpp);
+// "png" is the multithreaded encoder in png_writer.h, "ppm" the uncompressed debug path and
+// "freeimage" the original single threaded FreeImage_Save
+struct image_output {
+	string format = "png";
+	// 0 (stored) to 9 (smallest)
+	int pngLevel = 6;
+	// cropped renders: save the whole image, with the crop pasted over the last render saved to the
+	// same file, instead of just the cropped pixels
+	bool composite = false;
+};
+
+struct render_options {
+	int threads = default_thread_count();
+	// trace each row's primary rays together through hittable::hit_batch
+	bool interleave = false;
+	// breadth-first renderer with a separate pass per stage, see wavefront.h
+	bool wavefront = false;
+	// wavefront only: bin secondary rays by origin cell and direction before tracing them
+	bool sortRays = false;
+	// try each light's last occluder before tracing a shadow ray through the whole scene
+	bool shadowCache = true;
+	// leave out lights that can't add this much to any channel at a shading point, 0 shades every
+	// light; see light_arrays::influential
+	double lightCutoff = 0;
+	// adaptive supersampling, off unless --aa is given
+	aa_options aa;
+	// one-sample renders: keep camera ray first hits in <output>.gbuf and shade from them when the
+	// geometry and camera haven't changed, see gbuffer.h
+	bool useGBuffer = false;
+	// keep adding samples until a time budget or noise target, see progressive.h
+	bool progressive = false;
+	progressive_options progressiveOptions;
+	// render this many rows at a time and stream each band to the PNG, 0 for the whole image at once
+	int bandRows = 0;
+	image_output output;
+};
+
+void PrintShadowCacheStats(long long tests, long long blocked, long long hits) {
+	std::cout << "Shadow cache: " << tests << " shadow rays, " << blocked << " blocked, " << hits << " of those by the last occluder ("
+		<< (blocked ? 100.0 * hits / blocked : 0) << "%)\n";
 }
 
-void Rasterize(double aspectRatio, int imageWidth, int bitsPerPixel) {
+void PrintLightCullingStats(const std::vector<shading_context>& contexts, int lights) {
+	long long points = 0, shaded = 0;
+	for (const auto& c : contexts) {
+		points += c.shadingPoints;
+		shaded += c.lightsShaded;
+	}
+	std::cout << "Light culling: " << (points ? static_cast<double>(shaded) / points : 0) << " of " << lights
+		<< " lights shaded per point on average\n";
+}
 
-	// Image
+// Second pass of adaptive antialiasing: every edge pixel in region is replaced by the average of
+// grid x grid stratified samples. The edges are all found before any pixel changes, so the pixels
+// next to region have to have been rendered too for its border to come out the same as in a full render.
+aa_stats Antialias(const scene& sc, const hittable& world, const camera& cam, const render_options& opts, const pixel_rect& region,
+	const std::vector<const hittable*>& ids, std::vector<color>& pixels, std::vector<shading_context>& contexts) {
+	const int imageWidth = sc.width;
+	const int imageHeight = sc.height;
+	const int grid = opts.aa.grid;
+
+	std::vector<char> edge = opts.aa.uniform ? std::vector<char>(pixels.size(), 1)
+		: find_edges(pixels, ids, imageWidth, imageHeight, opts.aa.threshold);
+
+	aa_stats stats;
+	stats.grid = grid;
+	stats.pixels = static_cast<long long>(region.width()) * region.height();
+	for (int j = region.y0; j < region.y1; j++)
+		stats.refined += std::count(edge.begin() + size_t(j) * imageWidth + region.x0, edge.begin() + size_t(j) * imageWidth + region.x1, 1);
+	stats.samples = stats.pixels + stats.refined * grid * grid;
+
+	parallel_for(region.height(), opts.threads, [&](int worker, int row) {
+		const int j = region.y0 + row;
+		trace_span span("antialias row", "render", worker + 1);
+		if (active_trace()) span.args = trace_arg("row", j);
+		for (int i = region.x0; i < region.x1; i++) {
+			size_t p = size_t(j) * imageWidth + i;
+			if (!edge[p]) continue;
+
+			color sum(0, 0, 0);
+			for (int s = 0; s < grid * grid; s++) {
+				double du, dv;
+				stratum_offset(s, grid, du, dv);
+				ray r = cam.get_ray((i + du) / (imageWidth-1), (j + dv) / (imageHeight-1));
+				sum += ray_color(r, world, sc, 1, contexts[worker]);
+			}
+			pixels[p] = sum / (grid * grid);
+		}
+	});
 
-	const int imageHeight = static_cast<int>(imageWidth / aspectRatio);
+	return stats;
+}
 
-	// FreeImage setup
+// One sample per pixel for columns [i0, i1) of image row j (0 is the bottom) into row, which holds
+// the whole row. If ids isn't null it gets the primitive each pixel's camera ray hit, for
+// antialiasing to find object edges. With a G-buffer, pixels it has a first hit for are shaded
+// from that without tracing the camera ray, and the rest are recorded in it.
+void RenderRow(const scene& sc, const hittable& world, const camera& cam, const render_options& opts, int j, int i0, int i1,
+	color* row, const hittable** ids, gbuffer* firstHits, shading_context& ctx) {
+	const int imageWidth = sc.width;
+	const size_t rowStart = size_t(j) * imageWidth;
+	auto v = double(j) / (sc.height-1);
+
+	// same as ray_color, but keeps the hit primitive around for antialiasing
+	auto finish = [&](int i, const ray& r, bool hit, const hit_record& rec) {
+		row[i] = hit ? shade(r, rec, world, sc, 1, ctx) : background(r);
+		if (ids) ids[i] = hit ? rec.object : nullptr;
+	};
+
+	ctx.scratch.reset();
+	arena_vector<int> untraced{ arena_allocator<int>(&ctx.scratch) };
+	untraced.reserve(i1 - i0);
+	if (firstHits) {
+		for (int i = i0; i < i1; i++) {
+			hit_record rec;
+			bool hit;
+			if (firstHits->lookup(rowStart + i, hit, rec)) finish(i, cam.get_ray(double(i) / (imageWidth-1), v), hit, rec);
+			else untraced.push_back(i);
+		}
+	}
+	else {
+		for (int i = i0; i < i1; i++) untraced.push_back(i);
+	}
 
-	FreeImage_Initialise();
+	if (opts.interleave) {
+		const int n = static_cast<int>(untraced.size());
+		ray* rays = ctx.scratch.allocate_array<ray>(n);
+		hit_record* recs = ctx.scratch.allocate_array<hit_record>(n);
+		bool* hits = ctx.scratch.allocate_array<bool>(n);
+		for (int k = 0; k < n; k++)
+			rays[k] = cam.get_ray(double(untraced[k]) / (imageWidth-1), v);
+		world.hit_batch(rays, n, 0, infinity, recs, hits);
+		for (int k = 0; k < n; k++) {
+			if (firstHits) firstHits->record(rowStart + untraced[k], hits[k], recs[k]);
+			finish(untraced[k], rays[k], hits[k], recs[k]);
+		}
+	}
+	else {
+		for (int i : untraced) {
+			// uv mappings of pixels
+			auto u = double(i) / (imageWidth-1);
+			ray r = cam.get_ray(u, v);
+			hit_record rec;
+			bool hit = world.hit(r, 0, infinity, rec);
+			if (firstHits) firstHits->record(rowStart + i, hit, rec);
+			finish(i, r, hit, rec);
+		}
+	}
+}
+
+// count pixels as 8-bit RGB, the same bytes write_color gives FreeImage
+void ColorsToBytes(const color* pixels, size_t count, unsigned char* rgb) {
+	RGBQUAD quad;
+	for (size_t p = 0; p < count; p++) {
+		write_color(std::cout, pixels[p], &quad);
+		rgb[p * 3] = quad.rgbRed;
+		rgb[p * 3 + 1] = quad.rgbGreen;
+		rgb[p * 3 + 2] = quad.rgbBlue;
+	}
+}
+
+// the scene's output name, with the extension swapped for .ppm when writing PPM
+string OutputPath(const string& output, const render_options& opts) {
+	if (opts.output.format != "ppm") return output;
+	size_t dot = output.find_last_of('.');
+	size_t slash = output.find_last_of("/\\");
+	if (dot == string::npos || (slash != string::npos && dot < slash)) return output + ".ppm";
+	return output.substr(0, dot) + ".ppm";
+}
+
+// png_writer for "png" (and "freeimage", which can't write a band at a time), else ppm_writer
+std::unique_ptr<image_writer> MakeImageWriter(const render_options& opts) {
+	if (opts.output.format == "ppm") return std::unique_ptr<image_writer>(new ppm_writer());
+	return std::unique_ptr<image_writer>(new png_writer(opts.output.pngLevel, opts.threads));
+}
+
+// Writes pixels (row 0 at the bottom) to filename in the format opts asks for
+bool SaveImage(const std::vector<color>& pixels, int imageWidth, int imageHeight, const string& filename, const render_options& opts) {
+	memory_scope framebufferMemory(memory_tag::framebuffer);
+	if (opts.output.format != "freeimage") {
+		// image files go top down
+		std::vector<unsigned char> rgb(pixels.size() * 3);
+		trace_span toneMapping("tone map", "save");
+		parallel_for(imageHeight, opts.threads, [&](int, int r) {
+			size_t j = size_t(imageHeight - 1 - r);
+			ColorsToBytes(&pixels[j * imageWidth], imageWidth, &rgb[size_t(r) * imageWidth * 3]);
+		});
+		toneMapping.end();
+		trace_span saving(opts.output.format == "ppm" ? "write ppm" : "encode png", "save");
+		saving.args = trace_arg("file", OutputPath(filename, opts));
+		std::unique_ptr<image_writer> writer = MakeImageWriter(opts);
+		return writer->open(OutputPath(filename, opts), imageWidth, imageHeight)
+			&& writer->write_rows(rgb.data(), imageHeight) && writer->close();
+	}
+
+	const int bitsPerPixel = 24;
 	FIBITMAP* bitmap = FreeImage_Allocate(imageWidth, imageHeight, bitsPerPixel);
-	RGBQUAD *freeimage_color = new RGBQUAD();
 	if (!bitmap)
-		exit(1);
+		return false;
 
-	// World
+	trace_span toneMapping("tone map", "save");
+	RGBQUAD freeimage_color;
+	for (int j = 0; j < imageHeight; j++) {
+		for (int i = 0; i < imageWidth; i++) {
+			// converts our color object to RGBQUAD for FreeImage
+			write_color(std::cout, pixels[size_t(j) * imageWidth + i], &freeimage_color);
 
-	hittable_list world;
-	world.add(make_shared<sphere>(point3(1, 0, -1), .5));
-	world.add(make_shared<sphere>(point3(0, 0, -1), 0.5));
-	world.add(make_shared<sphere>(point3(0, -100.5, -1), 100));
+			// a pointer needs to be passed to the color struct
+			FreeImage_SetPixelColor(bitmap, i, j, &freeimage_color);
+		}
+	}
 
+	toneMapping.end();
+	trace_span saving("FreeImage_Save", "save");
+	saving.args = trace_arg("file", filename);
+	bool saved = FreeImage_Save(FIF_PNG, bitmap, filename.c_str(), 0) != 0;
+	FreeImage_Unload(bitmap);
+	return saved;
+}
+
+// The last render saved to filename as colors (row 0 at the bottom), for a cropped render to be
+// composited over. Black, with a warning, if there isn't one of the right size.
+std::vector<color> LoadPreviousRender(const string& filename, int imageWidth, int imageHeight) {
+	std::vector<color> pixels(size_t(imageWidth) * imageHeight, color(0, 0, 0));
+	int width = 0, height = 0;
+	std::vector<unsigned char> rgb;
+	if (!read_image(filename, width, height, rgb)) {
+		cerr << "No previous render in " << filename << " to composite over, using black\n";
+		return pixels;
+	}
+	if (width != imageWidth || height != imageHeight) {
+		cerr << filename << " is " << width << "x" << height << ", not " << imageWidth << "x" << imageHeight << ", compositing over black\n";
+		return pixels;
+	}
+
+	// byte / 255 comes back out of write_color as the same byte, so the pixels outside the crop
+	// are saved exactly as they were
+	for (int j = 0; j < imageHeight; j++) {
+		for (int i = 0; i < imageWidth; i++) {
+			const unsigned char* c = &rgb[(size_t(imageHeight - 1 - j) * imageWidth + i) * 3];
+			pixels[size_t(j) * imageWidth + i] = color(c[0] / 255.0, c[1] / 255.0, c[2] / 255.0);
+		}
+	}
+	return pixels;
+}
+
+// Saves a render of sc.render_region() from pixels (the whole image): just the region, or with
+// previous given, the whole image with the region pasted over it. Uncropped renders go out as they are.
+bool SaveRender(const scene& sc, const std::vector<color>& pixels, const std::vector<color>& previous, const render_options& opts) {
+	if (!sc.cropped())
+		return SaveImage(pixels, sc.width, sc.height, sc.output, opts);
+
+	const pixel_rect region = sc.render_region();
+	std::vector<color> image;
+	if (!previous.empty()) {
+		image = previous;
+		for (int j = region.y0; j < region.y1; j++) {
+			size_t row = size_t(j) * sc.width;
+			std::copy(pixels.begin() + row + region.x0, pixels.begin() + row + region.x1, image.begin() + row + region.x0);
+		}
+		return SaveImage(image, sc.width, sc.height, sc.output, opts);
+	}
+
+	image.reserve(size_t(region.width()) * region.height());
+	for (int j = region.y0; j < region.y1; j++) {
+		size_t row = size_t(j) * sc.width;
+		image.insert(image.end(), pixels.begin() + row + region.x0, pixels.begin() + row + region.x1);
+	}
+	return SaveImage(image, region.width(), region.height(), sc.output, opts);
+}
+
+// false if the image couldn't be saved
+bool Rasterize(const scene& sc, const hittable& world, const render_options& opts) {
+
+	// Image
+
+	const int imageWidth = sc.width;
+	const int imageHeight = sc.height;
 
 	// Camera
 
-	// the viewport AKA near clipping plane
-	auto viewportHeight = 2.0;
-	auto viewportWidth = aspectRatio * viewportHeight;
-	// focal point - the distance from near clipping plane to eye AKA projection point--not to be confused with focus distance
-	auto focalLength = 1.0;
-	auto origin = point3(0, 0, 0);
-	auto horizontal = vec3(viewportWidth, 0, 0);
-	auto vertical = vec3(0, viewportHeight, 0);
-	// we subtract the focalLength bc we are looking into the -z axis, to respect the RH-coordinate system
-	auto lowerLeftCorner = origin - horizontal / 2 - vertical / 2 - vec3(0, 0, focalLength);
+	camera cam = sc.make_camera();
 
 	// Progress tracker setup
 
 	// for progress tracking
 	std::cout << "imageWidth: " << imageWidth << " imageHeight: " << imageHeight << "\n" << std::endl;
 	int printProgress[100] = {};
+	int rowsDone = 0;
+	std::mutex progressMutex;
+
+	// Crop
+
+	// only the region gets camera rays; antialiasing also needs the ring of pixels around it to
+	// find the same edges a full render would
+	const pixel_rect region = sc.render_region();
+	pixel_rect traced = region;
+	if (opts.aa.grid > 1 && !opts.progressive) {
+		traced.x0 = std::max(0, region.x0 - 1);
+		traced.y0 = std::max(0, region.y0 - 1);
+		traced.x1 = std::min(imageWidth, region.x1 + 1);
+		traced.y1 = std::min(imageHeight, region.y1 + 1);
+	}
+	if (sc.cropped()) {
+		std::cout << "Crop: " << region.width() << "x" << region.height() << " pixels at " << region.x0 << ", " << imageHeight - region.y1
+			<< (opts.output.composite ? ", composited over the previous render" : "") << "\n" << std::endl;
+	}
+	memory_scope framebufferMemory(memory_tag::framebuffer);
+	// read before anything is rendered, since snapshots overwrite it
+	std::vector<color> previous;
+	if (sc.cropped() && opts.output.composite)
+		previous = LoadPreviousRender(OutputPath(sc.output, opts), imageWidth, imageHeight);
 
 	// Render loop
-	for (int i = 0; i < imageWidth; i++) {
-		for (int j = imageHeight-1; j > 0; j--) {
+	// rows are handed out to the worker threads; each row is written to its own part of pixels
+	std::vector<color> pixels(size_t(imageWidth) * imageHeight);
+	// what each pixel's camera ray hit, for antialiasing to find object edges
+	std::vector<const hittable*> ids(opts.aa.grid > 1 && !opts.wavefront ? pixels.size() : 0);
+	// everything from here on, including what the workers allocate while tracing, is render scratch
+	memory_scope renderMemory(memory_tag::render);
+	// one per worker thread, they're not shared
+	light_arrays lights(sc.lights, sc.attenuation, opts.lightCutoff);
+	std::vector<shading_context> contexts(std::max(1, opts.threads), shading_context(&lights, opts.shadowCache));
+	if (opts.progressive) {
+		// snapshots overwrite the output file, so it always holds the best image so far
+		progressive_renderer renderer(sc, opts.threads, opts.progressiveOptions);
+		progressive_stats stats = renderer.render(
+			[&](const ray& r, int worker) { return ray_color(r, world, sc, 1, contexts[worker]); },
+			[&](const std::vector<color>& image) { SaveRender(sc, image, previous, opts); },
+			pixels);
+		stats.print(std::cout);
+	}
+	else if (opts.wavefront) {
+		wavefront_renderer renderer(sc, world, opts.threads, opts.interleave);
+		renderer.sort_rays = opts.sortRays;
+		renderer.shadow_caching = opts.shadowCache;
+		renderer.light_cutoff = opts.lightCutoff;
+		renderer.region = traced;
+		wavefront_stats stats = renderer.render(pixels);
+		stats.print(std::cout);
+	}
+	else {
+		// G-buffer
+
+		std::unique_ptr<gbuffer> firstHits;
+		string gbufferPath = sc.output + ".gbuf";
+		long long reused = 0;
+		if (opts.useGBuffer) {
+			memory_scope cacheMemory(memory_tag::cache);
+			firstHits.reset(new gbuffer(sc.objects.objects, sc.gbuffer_key(), imageWidth, imageHeight));
+			if (!firstHits->load(gbufferPath)) std::cout << "No G-buffer for this geometry and camera in " << gbufferPath << ", tracing every camera ray\n";
+			for (int j = traced.y0; j < traced.y1; j++)
+				for (int i = traced.x0; i < traced.x1; i++)
+					reused += firstHits->known(size_t(j) * imageWidth + i);
+		}
+
+		parallel_for(traced.height(), opts.threads, [&](int worker, int row) {
+			const int j = traced.y0 + row;
+			trace_span span("row", "render", worker + 1);
+			if (active_trace()) span.args = trace_arg("row", j);
+			RenderRow(sc, world, cam, opts, j, traced.x0, traced.x1, &pixels[size_t(j) * imageWidth],
+				ids.empty() ? nullptr : &ids[size_t(j) * imageWidth], firstHits.get(), contexts[worker]);
 
 			// print progress
-			PrintProgress(i, j, imageWidth, imageHeight, printProgress);
+			std::lock_guard<std::mutex> lock(progressMutex);
+			PrintProgress(++rowsDone, traced.height(), printProgress);
+		});
+
+		if (firstHits) {
+			std::cout << "G-buffer: " << reused << " of " << static_cast<long long>(traced.width()) * traced.height()
+				<< " camera rays reused from " << gbufferPath << "\n";
+			firstHits->save(gbufferPath);
+		}
+	}
+	if (opts.aa.grid > 1 && !opts.progressive) {
+		aa_stats stats = Antialias(sc, world, cam, opts, region, ids, pixels, contexts);
+		stats.print(std::cout);
+	}
+	std::cout << "\nDone.\n";
+	if (!opts.wavefront) {
+		long long tests = 0, blocked = 0, hits = 0;
+		for (const auto& c : contexts) {
+			tests += c.shadows.tests;
+			blocked += c.shadows.blocked;
+			hits += c.shadows.hits;
+		}
+		PrintShadowCacheStats(tests, blocked, hits);
+		if (opts.lightCutoff > 0) PrintLightCullingStats(contexts, static_cast<int>(sc.lights.size()));
+	}
 
-			// uv mappings of pixels
-			auto u = double(i) / (imageWidth-1);
-			auto v = double(j) / (imageHeight-1);
-			ray r(origin, lowerLeftCorner + u * horizontal + v * vertical - origin);
-			color pixel_color = ray_color(r, world);
+	auto saveStart = std::chrono::steady_clock::now();
+	if (!SaveRender(sc, pixels, previous, opts)) return false;
+	std::cout << "Image successfully saved! (" << opts.output.format << ", "
+		<< std::chrono::duration<double>(std::chrono::steady_clock::now() - saveStart).count() * 1000 << " ms)" << std::endl;
+	return true;
+}
 
-			// converts our color object to RGBQUAD for FreeImage
-			write_color(std::cout, pixel_color, freeimage_color);
+// Renders from the top down in bands of opts.bandRows rows and writes each finished band straight
+// to the image file, so memory holds one band instead of the whole image (and there's no FreeImage
+// bitmap). Only the one-sample row renderer works this way. A crop is written on its own, never
+// composited, since that would need the previous image in memory.
+bool RasterizeBands(const scene& sc, const hittable& world, const render_options& opts) {
+	const int imageWidth = sc.width;
+	const int imageHeight = sc.height;
+	const pixel_rect region = sc.render_region();
+	const int bandRows = std::min(opts.bandRows, region.height());
+	const int bands = (region.height() + bandRows - 1) / bandRows;
+	std::cout << "imageWidth: " << imageWidth << " imageHeight: " << imageHeight << ", " << bands << " bands of " << bandRows << " rows\n" << std::endl;
+	if (sc.cropped())
+		std::cout << "Crop: " << region.width() << "x" << region.height() << " pixels at " << region.x0 << ", " << imageHeight - region.y1 << "\n" << std::endl;
+
+	camera cam = sc.make_camera();
+	light_arrays lights(sc.lights, sc.attenuation, opts.lightCutoff);
+	std::vector<shading_context> contexts(std::max(1, opts.threads), shading_context(&lights, opts.shadowCache));
+
+	memory_scope framebufferMemory(memory_tag::framebuffer);
+	string path = OutputPath(sc.output, opts);
+	std::unique_ptr<image_writer> writer = MakeImageWriter(opts);
+	if (!writer->open(path, region.width(), region.height())) {
+		cerr << "Unable to open " << path << " for writing\n";
+		return false;
+	}
 
-			// a pointer needs to be passed to the color struct
-			FreeImage_SetPixelColor(bitmap, i, j, freeimage_color);
-		}
+	// band rows are whole image rows, only the region's columns are rendered and written
+	std::vector<color> band(size_t(imageWidth) * bandRows);
+	std::vector<unsigned char> bytes(size_t(region.width()) * bandRows * 3);
+	int printProgress[100] = {};
+	for (int b = 0; b < bands; b++) {
+		const int top = b * bandRows;
+		const int rows = std::min(bandRows, region.height() - top);
+		// band row r is image row region.y1 - 1 - (top + r), since row 0 is the bottom
+		parallel_for(rows, opts.threads, [&](int worker, int r) {
+			memory_scope renderMemory(memory_tag::render);
+			trace_span span("row", "render", worker + 1);
+			if (active_trace()) span.args = trace_arg("row", region.y1 - 1 - (top + r));
+			RenderRow(sc, world, cam, opts, region.y1 - 1 - (top + r), region.x0, region.x1, &band[size_t(r) * imageWidth], nullptr, nullptr, contexts[worker]);
+		});
+
+		trace_span toneMapping("tone map", "save");
+		for (int r = 0; r < rows; r++)
+			ColorsToBytes(&band[size_t(r) * imageWidth + region.x0], region.width(), &bytes[size_t(r) * region.width() * 3]);
+		toneMapping.end();
+		trace_span writing(opts.output.format == "ppm" ? "write ppm" : "encode png", "save");
+		if (!writer->write_rows(bytes.data(), rows)) break;
+		writing.end();
+		PrintProgress(top + rows, region.height(), printProgress);
 	}
 	std::cout << "\nDone.\n";
 
-	if (FreeImage_Save(FIF_PNG, bitmap, "test.png", 0)) std::cout << "Image successfully saved!" << std::endl;
+	long long tests = 0, blocked = 0, hits = 0;
+	for (const auto& c : contexts) {
+		tests += c.shadows.tests;
+		blocked += c.shadows.blocked;
+		hits += c.shadows.hits;
+	}
+	PrintShadowCacheStats(tests, blocked, hits);
+	if (opts.lightCutoff > 0) PrintLightCullingStats(contexts, static_cast<int>(sc.lights.size()));
 
-	std::cout << "FreeImage_" << FreeImage_GetVersion() << "\n";
-	std::cout << FreeImage_GetCopyrightMessage() << "\n\n";
-	FreeImage_DeInitialise();
+	if (!writer->close()) {
+		cerr << "Unable to write " << path << "\n";
+		return false;
+	}
+	std::cout << "Image successfully saved!" << std::endl;
+	return true;
 }
 
-// Taken from CS167X hw2
-// Function to read the input data values
-// Use is optional, but should be very helpful in parsing.  
-bool readvals(stringstream& s, const int numvals, float* values)
-{
-    for (int i = 0; i < numvals; i++) {
-        s >> values[i];
-        if (s.fail()) {
-            std::cout << "Failed reading value " << i << " will skip\n";
-            return false;
-        }
-    }
-    return true;
+// Traces one primary ray per pixel and returns rays per second, no shading or image output.
+// incoherent shuffles the rays first so neighbouring rays no longer walk the same nodes,
+// which is roughly what secondary rays look like to the bvh
+double MeasureRaysPerSecond(const scene& sc, const hittable& world, bool interleaved, bool incoherent) {
+	camera cam = sc.make_camera();
+	std::vector<ray> rays;
+	rays.reserve(size_t(sc.width) * sc.height);
+	for (int j = 0; j < sc.height; j++)
+		for (int i = 0; i < sc.width; i++)
+			rays.push_back(cam.get_ray(double(i) / (sc.width - 1), double(j) / (sc.height - 1)));
+	if (incoherent)
+		std::shuffle(rays.begin(), rays.end(), std::mt19937(167));
+
+	const int batch = 256;
+	std::vector<hit_record> recs(batch);
+	std::unique_ptr<bool[]> hits(new bool[batch]);
+	int count = static_cast<int>(rays.size());
+
+	auto start = std::chrono::steady_clock::now();
+	for (int first = 0; first < count; first += batch) {
+		int n = std::min(batch, count - first);
+		if (interleaved) {
+			world.hit_batch(&rays[first], n, 0, infinity, recs.data(), hits.get());
+		}
+		else {
+			for (int k = 0; k < n; k++)
+				hits[k] = world.hit(rays[first + k], 0, infinity, recs[k]);
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	return count / seconds;
 }
 
-void ReadFile(const char* filename) {
-    string str, cmd;
-    ifstream in;
-    in.open(filename);
+void PrintRaysPerSecond(const scene& sc, const hittable& world) {
+	std::cout << "  rays/sec:       " << MeasureRaysPerSecond(sc, world, false, false) << " coherent, "
+		<< MeasureRaysPerSecond(sc, world, false, true) << " shuffled\n";
+	std::cout << "  interleaved:    " << MeasureRaysPerSecond(sc, world, true, false) << " coherent, "
+		<< MeasureRaysPerSecond(sc, world, true, true) << " shuffled\n\n";
+}
 
+// Heap allocations made by shading every row of the image once with the one-sample row renderer,
+// on one thread. Rows only use their context's scratch arena, so after the first row sets it up
+// this should stay at zero however big the image is.
+long long CountRenderAllocations(const scene& sc, const hittable& world) {
+	camera cam = sc.make_camera();
+	render_options opts;
+	light_arrays lights(sc.lights, sc.attenuation, opts.lightCutoff);
+	shading_context ctx(&lights, opts.shadowCache);
+	std::vector<color> row(sc.width);
+	long long before = allocation_count();
+	for (int j = 0; j < sc.height; j++)
+		RenderRow(sc, world, cam, opts, j, 0, sc.width, row.data(), nullptr, nullptr, ctx);
+	return allocation_count() - before;
+}
 
-    if (in.is_open()) {
+void PrintAllocations(const scene& sc, const hittable& world, long long buildAllocations) {
+	std::cout << "  allocations:    " << buildAllocations << " to build, " << CountRenderAllocations(sc, world)
+		<< " to shade " << sc.height << " rows\n";
+}
 
-        // I need to implement a matrix stack to store transforms.  
-        // This is done using standard STL Templates 
-        //stack <mat4> transfstack;
-        //transfstack.push(mat4(1.0));  // identity
+// Builds the plain SAH bvh and the SBVH for the same scene and compares them. parseAllocations is
+// how many heap allocations ReadFile made.
+void BenchAccelerators(const scene& sc, long long parseAllocations) {
+	std::cout << "Parsing made " << parseAllocations << " heap allocations for " << sc.objects.objects.size() << " primitives ("
+		<< sc.storage->capacity() / 1024 << " KB of arena)\n\n";
+
+	bvh_build_options sah_options;
+	long long before = allocation_count();
+	bvh sah(sc.objects, sah_options);
+	long long buildAllocations = allocation_count() - before;
+	std::cout << "SAH bvh\n";
+	sah.stats.print(std::cout);
+	PrintAllocations(sc, sah, buildAllocations);
+	PrintRaysPerSecond(sc, sah);
+
+	if (sah.stats.sphere_packets > 0) {
+		// same tree, but every sphere tested on its own through sphere::hit
+		bvh_build_options scalar_options;
+		scalar_options.sphere_packets = false;
+		bvh scalar(sc.objects, scalar_options);
+		std::cout << "SAH bvh, one sphere::hit per sphere\n";
+		PrintRaysPerSecond(sc, scalar);
+	}
 
-		std::cout << "Reading file " << filename << std::endl;
+	compressed_bvh compressed(sah);
+	std::cout << "SAH bvh, quantized nodes\n";
+	std::cout << "  memory:         " << compressed.memory_bytes() / 1024 << " KB ("
+		<< double(sah.stats.memory_bytes) / compressed.memory_bytes() << "x smaller)\n";
+	PrintRaysPerSecond(sc, compressed);
+
+	bvh_build_options sbvh_options;
+	sbvh_options.spatial_splits = true;
+	before = allocation_count();
+	bvh sbvh(sc.objects, sbvh_options);
+	buildAllocations = allocation_count() - before;
+	std::cout << "SBVH (budget " << sbvh_options.duplication_budget * 100 << "% duplicates)\n";
+	sbvh.stats.print(std::cout);
+	PrintAllocations(sc, sbvh, buildAllocations);
+	PrintRaysPerSecond(sc, sbvh);
+}
 
-        
-        while (getline(in, str)) {
+// Draws spp 2D samples for every pixel of a width x height image and returns samples per second.
+// Each pixel's samples are summed in order into sums; reversed hands the rows out back to front.
+double MeasureSamplesPerSecond(const sampler& smp, int width, int height, int threads, bool reversed, std::vector<double>& sums) {
+	const int spp = 64;
+	sums.assign(size_t(width) * height, 0);
+
+	auto start = std::chrono::steady_clock::now();
+	parallel_for(height, threads, [&](int, int row) {
+		int j = reversed ? height - 1 - row : row;
+		for (int i = 0; i < width; i++) {
+			size_t p = size_t(j) * width + i;
+			double sum = 0;
+			for (int k = 0; k < spp; k++) {
+				double u, v;
+				smp.get_2d(static_cast<uint32_t>(p), k, 0, u, v);
+				sum += u + v;
+			}
+			sums[p] = sum;
+		}
+	});
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-            if ((str.find_first_not_of(" \t\r\n") != string::npos) && (str[0] != '#')) {
-                // Ruled out comment and blank lines 
+	return double(width) * height * spp / seconds;
+}
 
-                stringstream s(str);
-                s >> cmd;
+// Samples/sec for each sampler on one thread and on all of them, and whether the two runs gave
+// bit-identical samples (the second one also goes through the rows in the opposite order)
+void BenchSamplers(int width, int height, int threads) {
+	std::cout << "Sampler benchmark: " << width << "x" << height << " pixels, 64 2D samples each\n";
+	const char* names[] = { "sobol", "random" };
+	const sampler_kind kinds[] = { sampler_kind::sobol, sampler_kind::random };
+	for (int s = 0; s < 2; s++) {
+		sampler smp(kinds[s]);
+		std::vector<double> serial, threaded;
+		double one = MeasureSamplesPerSecond(smp, width, height, 1, false, serial);
+		double all = MeasureSamplesPerSecond(smp, width, height, threads, true, threaded);
+		std::cout << "  " << names[s] << ":" << (s == 0 ? "  " : " ") << one << " samples/sec on 1 thread, " << all << " on " << threads
+			<< ", identical: " << (serial == threaded ? "yes" : "NO") << "\n";
+	}
+}
 
-				std::cout << str << std::endl;
+// "list" tests every object, "bvh" is the binned SAH build, "sbvh" adds spatial splits; compress
+// stores the bvh with 8-bit quantized child boxes
+shared_ptr<hittable> BuildWorld(const scene& sc, const string& accel, bool compress) {
+	if (accel == "list")
+		return make_shared<hittable_list>(sc.objects);
+
+	memory_scope accelerationMemory(memory_tag::acceleration);
+	bvh_build_options options;
+	options.spatial_splits = accel == "sbvh";
+	trace_span building("bvh build", "load");
+	building.args = trace_arg("accel", accel);
+	auto tree = make_shared<bvh>(sc.objects, options);
+	building.end();
+	std::cout << "Built " << accel << "\n";
+	tree->stats.print(std::cout);
+	if (!compress)
+		return tree;
+	trace_span compressing("bvh compress", "load");
+	auto small = make_shared<compressed_bvh>(*tree);
+	std::cout << "Compressed to " << small->memory_bytes() / 1024 << " KB\n";
+	return small;
+}
 
+// What rendering sc will add to the heap on top of what's in use now, estimated before the bvh is
+// built, for --memory-budget to decide between the bvh and the compressed one. Deliberately high:
+// two nodes per reference, sbvh's spatial splits doubling the references, every primitive a sphere
+// packet lane, and the build's reference lists at their most, three times the references (see
+// bvh::build). Those lists come out of a scratch arena that keeps its chunks when it's rewound and
+// can skip past a chunk's unused tail, so the arena is counted at twice the lists plus its first
+// chunk. The bvh reserves its node and reference arrays at their most, so they never hold two
+// copies while growing.
+struct memory_plan {
+	// the build's peak, tree and scratch
+	long long build;
+	long long bvh;
+	long long compressed;
+	// everything per pixel: the image, the bytes for the file, and the renderer's per-pixel state
+	long long framebuffers;
+};
+
+memory_plan PlanMemory(const scene& sc, const string& accel, const render_options& opts) {
+	memory_plan plan = {};
+	const long long n = static_cast<long long>(sc.objects.objects.size());
+	if (accel != "list") {
+		const long long refs = (accel == "sbvh" ? 2 : 1) * n;
+		const long long shared = refs * sizeof(int) + n * (sizeof(shared_ptr<hittable>) + sizeof(sphere_packet) / sphere_packet::width);
+		plan.bvh = 2 * refs * sizeof(bvh_node) + shared;
+		plan.compressed = refs * sizeof(compressed_bvh_node) + shared;
+		const long long scratch = 2 * 3 * refs * (sizeof(aabb) + 2 * sizeof(int)) + (1 << 20);
+		plan.build = plan.bvh + scratch;
+	}
 
-                int i;
-                float v[10]; // Position and color for light, colors for others
-                // Up to 10 params for cameras.  
-                bool validinput; // Validity of input 
+	const long long pixels = static_cast<long long>(sc.width) * (opts.bandRows > 0 ? std::min(opts.bandRows, sc.height) : sc.height);
+	// colors, then bytes for the file and about as much again for the encoder's output
+	plan.framebuffers = pixels * (sizeof(color) + 6);
+	if (opts.bandRows > 0) return plan;
+	// sums, luminance moments, the displayed image and a snapshot's copy of it
+	if (opts.progressive) plan.framebuffers += pixels * (3 * sizeof(color) + 2 * sizeof(double));
+	// the ray, hit and path queues, a little under 100 bytes a pixel, and a wave's shadow rays if
+	// every light reaches every point: about 90 bytes each, queued per block and then gathered
+	else if (opts.wavefront) {
+		const long long lights = static_cast<long long>(sc.lights.size());
+		plan.framebuffers += pixels * 96 + 2 * 90 * std::min(pixels, static_cast<long long>(wavefront_renderer::wave_pixels(static_cast<int>(lights)))) * lights;
+	}
+	else if (opts.aa.grid > 1) plan.framebuffers += pixels * sizeof(const hittable*);
+	if (opts.useGBuffer && !opts.progressive && !opts.wavefront) plan.framebuffers += pixels * sizeof(gbuffer::texel);
+	// the previous render and the composited copy
+	if (sc.cropped() && opts.output.composite) plan.framebuffers += 2 * pixels * sizeof(color);
+	return plan;
+}
 
-				// Image size
-				if (cmd == "size") {
-					// width, height
-				}
-				// Image file output
-				else if (cmd == "output") {
-					// "name.png"
+// Fits the render into budget bytes: keeps the bvh if it fits, switches to the compressed one if
+// only that does, and otherwise says why not and returns false, before anything big is allocated.
+// The compressed bvh is made from the full one, so it only helps once the build's scratch is gone.
+bool FitMemoryBudget(const scene& sc, const string& accel, bool& compress, const render_options& opts, long long budget) {
+	const long long used = memory_in_use();
+	const memory_plan plan = PlanMemory(sc, accel, opts);
+	const long long full = used + std::max(plan.build, plan.bvh + plan.framebuffers);
+	const long long small = used + std::max(std::max(plan.build, plan.bvh + plan.compressed), plan.compressed + plan.framebuffers);
+	auto mb = [](long long bytes) { return to_string((bytes + (1 << 20) - 1) >> 20) + " MB"; };
+	if (compress ? small <= budget : full <= budget) return true;
+	if (!compress && accel != "list" && small <= budget) {
+		std::cout << "Memory budget: about " << mb(full) << " with the bvh, " << mb(small) << " compressed, switching to --compress\n";
+		compress = true;
+		return true;
+	}
+	cerr << "Memory budget of " << mb(budget) << " is too small for this render, it needs about " << mb(accel == "list" ? full : small)
+		<< ": " << mb(used) << " of scene, " << mb(plan.build) << " to build the " << accel << ", " << mb(plan.compressed) << " to keep it compressed and "
+		<< mb(plan.framebuffers) << " of framebuffers" << (opts.bandRows > 0 ? "" : " (try --band)") << "\n";
+	return false;
+}
 
-				}
-				// Camera
-				else if (cmd == "camera") {
-					// lookFrom x, y, z; lookAt x, y, z; R, G, B, A
-					if (readvals(s, 10, v)) {
-						vec3 lookFrom = vec3(v[0], v[1], v[2]);
-						vec3 lookAt = vec3(v[3], v[4], v[5]); // center of image
-						vec3 up = unit_vector(vec3(v[6], v[7], v[8]));
-
-						int fovy = v[9];
-					}
-				}
-				// Lights
-				else if (cmd == "light") {
+// Renders sc to its output file with whichever renderer opts picks; false if it wasn't saved
+bool RenderScene(const scene& sc, const hittable& world, const render_options& opts) {
+	if (!sc.crop.empty() && !sc.cropped())
+		cerr << "Crop " << sc.crop.x0 << " " << sc.crop.y0 << " " << sc.crop.x1 << " " << sc.crop.y1 << " leaves nothing of the "
+			<< sc.width << "x" << sc.height << " image to crop, rendering all of it\n";
+
+	if (opts.bandRows > 0) {
+		if (opts.progressive || opts.wavefront || opts.aa.grid > 1)
+			cerr << "--band only streams the one-sample row renderer, ignoring --progressive, --wavefront and --aa\n";
+		if (opts.output.composite && sc.cropped())
+			cerr << "--band writes the crop on its own, ignoring --composite\n";
+		if (opts.useGBuffer)
+			cerr << "--band doesn't keep a G-buffer, ignoring --gbuffer\n";
+		return RasterizeBands(sc, world, opts);
+	}
+	if (opts.useGBuffer && (opts.progressive || opts.wavefront))
+		cerr << "--gbuffer only works with the one-sample row renderer, ignoring it\n";
+	return Rasterize(sc, world, opts);
+}
 
-				}
-				else if (cmd == "point") {
+// Renders a set of scenes on one pool of opts.threads workers. Every scene is cut into bands of
+// about the same number of pixels and all the bands go into one queue, biggest scenes first, so a
+// big scene is spread over every core and small ones fill in around it instead of each scene
+// waiting for the slowest row of the one before. Whichever worker finishes a scene's last band
+// saves it. Only the one-sample row renderer is used. False unless every scene loaded and was saved.
+bool RenderBatch(const std::vector<string>& files, const string& accel, bool compress, const render_options& opts) {
+	auto start = std::chrono::steady_clock::now();
+	auto msSince = [](std::chrono::steady_clock::time_point t) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count() * 1000;
+	};
+	const int threads = std::max(1, opts.threads);
+
+	struct batch_scene {
+		scene sc;
+		shared_ptr<hittable> world;
+		std::unique_ptr<light_arrays> lights;
+		std::vector<shading_context> contexts;
+		std::vector<color> pixels;
+		std::atomic<int> bandsLeft;
+		std::mutex timing;
+		bool started = false;
+		std::chrono::steady_clock::time_point firstBand;
+	};
+	std::vector<std::unique_ptr<batch_scene>> scenes(files.size());
+	std::vector<batch_scene_stats> stats(files.size());
+
+	// loading is spread over the workers too, biggest files first so the longest bvh build doesn't
+	// start last. ReadFile's echo of every line would be an unreadable interleaving, so stdout is
+	// muted meanwhile.
+	std::vector<int> loadOrder(files.size());
+	std::vector<long long> fileSizes(files.size());
+	for (size_t k = 0; k < files.size(); k++) {
+		loadOrder[k] = static_cast<int>(k);
+		ifstream in(files[k], std::ios::binary | std::ios::ate);
+		fileSizes[k] = in ? static_cast<long long>(in.tellg()) : 0;
+	}
+	std::stable_sort(loadOrder.begin(), loadOrder.end(), [&](int a, int b) { return fileSizes[a] > fileSizes[b]; });
+	std::cout << "Loading " << files.size() << " scenes\n";
+	std::streambuf* console = std::cout.rdbuf(nullptr);
+	parallel_for(static_cast<int>(files.size()), threads, [&](int worker, int n) {
+		const int k = loadOrder[n];
+		trace_lane_scope lane(worker + 1);
+		auto loadStart = std::chrono::steady_clock::now();
+		stats[k].file = files[k];
+		std::unique_ptr<batch_scene> b(new batch_scene());
+		if (!ReadFile(files[k].c_str(), b->sc)) return;
+		b->world = BuildWorld(b->sc, accel, compress);
+		memory_scope renderMemory(memory_tag::render);
+		b->lights.reset(new light_arrays(b->sc.lights, b->sc.attenuation, opts.lightCutoff));
+		b->contexts.assign(threads, shading_context(b->lights.get(), opts.shadowCache));
+		stats[k].loaded = true;
+		stats[k].width = b->sc.width;
+		stats[k].height = b->sc.height;
+		stats[k].primitives = static_cast<int>(b->sc.objects.objects.size());
+		stats[k].output = OutputPath(b->sc.output, opts);
+		stats[k].load_ms = msSince(loadStart);
+		scenes[k] = std::move(b);
+	});
+	std::cout.rdbuf(console);
+	std::cout.clear();
+
+	// bands of about 16K pixels: enough work to be worth handing out, small enough that the last
+	// scene's bands still spread over every worker
+	struct band { int scene, j0, j1; };
+	std::vector<int> order;
+	for (int k = 0; k < static_cast<int>(scenes.size()); k++)
+		if (scenes[k]) order.push_back(k);
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+		return static_cast<long long>(scenes[a]->sc.width) * scenes[a]->sc.height > static_cast<long long>(scenes[b]->sc.width) * scenes[b]->sc.height;
+	});
+	std::vector<band> bands;
+	memory_scope framebufferMemory(memory_tag::framebuffer);
+	for (int k : order) {
+		batch_scene& b = *scenes[k];
+		const pixel_rect region = b.sc.render_region();
+		const int rows = std::max(1, 16384 / std::max(1, region.width()));
+		int count = 0;
+		for (int j = region.y0; j < region.y1; j += rows, count++)
+			bands.push_back({ k, j, std::min(region.y1, j + rows) });
+		b.bandsLeft = count;
+		b.pixels.assign(size_t(b.sc.width) * b.sc.height, color(0, 0, 0));
+	}
 
-				}
-				// Materials
-				else if (cmd == "ambient") {
+	// a scene is saved from a worker, which shouldn't start a pool of its own for the PNG
+	render_options saveOptions = opts;
+	saveOptions.threads = 1;
+	memory_scope renderMemory(memory_tag::render);
+	std::mutex busyMutex, printMutex;
+	parallel_for(static_cast<int>(bands.size()), threads, [&](int worker, int n) {
+		const band& item = bands[n];
+		batch_scene& b = *scenes[item.scene];
+		// saving the scene happens on this worker's lane too
+		trace_lane_scope lane(worker + 1);
+		trace_span span("band", "render");
+		if (active_trace()) span.args = trace_arg("scene", b.sc.output) + ", " + trace_arg("row", item.j0);
+		auto bandStart = std::chrono::steady_clock::now();
+		{
+			std::lock_guard<std::mutex> lock(b.timing);
+			if (!b.started) {
+				b.started = true;
+				b.firstBand = bandStart;
+			}
+		}
 
-				}
-				else if (cmd == "emission") {
+		const pixel_rect region = b.sc.render_region();
+		camera cam = b.sc.make_camera();
+		for (int j = item.j0; j < item.j1; j++)
+			RenderRow(b.sc, *b.world, cam, opts, j, region.x0, region.x1, &b.pixels[size_t(j) * b.sc.width], nullptr, nullptr, b.contexts[worker]);
+
+		bool last = --b.bandsLeft == 0;
+		batch_scene_stats& s = stats[item.scene];
+		if (last) s.saved = SaveRender(b.sc, b.pixels, std::vector<color>(), saveOptions);
+		double ms = msSince(bandStart);
+		std::lock_guard<std::mutex> lock(busyMutex);
+		s.busy_ms += ms;
+		if (last) {
+			s.render_ms = msSince(b.firstBand);
+			std::vector<color>().swap(b.pixels);
+			std::lock_guard<std::mutex> print(printMutex);
+			std::cout << (s.saved ? "Saved " : "Unable to save ") << s.output << "\n";
+		}
+	});
 
-				}
-				else if (cmd == "diffuse") {
+	print_batch_summary(std::cout, stats, msSince(start), threads);
+	for (const batch_scene_stats& s : stats)
+		if (!s.loaded || !s.saved) return false;
+	return true;
+}
 
-				}
-				else if (cmd == "shininess") {
+// One render server job: a scene file path, then any of
+//   size W H, camera (10 values, as in scene files), crop X0 Y0 X1 Y1, maxdepth N, output PATH,
+//   spp N (a progressive render with exactly N samples per pixel), inline
+// which override the scene file for this job only. The reply is "ok <ms> <path>", or with inline
+// "image <bytes> <ms> <path>" followed by the file, or "error <why>". "shutdown" stops the server.
+string RunJob(const string& line, scene_cache& scenes, const render_options& defaults, bool& stop) {
+	stringstream job(line);
+	string path;
+	job >> path;
+	if (path == "shutdown") {
+		stop = true;
+		return "ok 0 shutdown\n";
+	}
 
-				}
-				else if (cmd == "specular") {
+	auto start = std::chrono::steady_clock::now();
+	bool cached;
+	std::shared_ptr<const loaded_scene> loaded = scenes.get(path, cached);
+	if (!loaded) return "error unable to load " + path + "\n";
+	std::cout << (cached ? "Reusing " : "Loaded ") << path << " (" << scenes.size() << " scenes cached, "
+		<< scenes.hits << " hits, " << scenes.misses << " misses)\n";
+
+	// the cached scene is shared, overrides go on a copy of the settings
+	scene sc(loaded->sc);
+	render_options opts = defaults;
+	bool sendImage = false;
+	string key;
+	float v[10];
+	while (job >> key) {
+		bool ok = true;
+		if (key == "size" && (ok = readvals(job, 2, v))) {
+			sc.width = static_cast<int>(v[0]);
+			sc.height = static_cast<int>(v[1]);
+			ok = sc.width > 1 && sc.height > 1;
+		}
+		else if (key == "camera" && (ok = readvals(job, 10, v))) {
+			sc.lookfrom = vec3(v[0], v[1], v[2]);
+			sc.lookat = vec3(v[3], v[4], v[5]);
+			sc.up = unit_vector(vec3(v[6], v[7], v[8]));
+			sc.fovy = v[9];
+		}
+		else if (key == "crop" && (ok = readvals(job, 4, v))) {
+			sc.crop.x0 = static_cast<int>(v[0]);
+			sc.crop.y0 = static_cast<int>(v[1]);
+			sc.crop.x1 = static_cast<int>(v[2]);
+			sc.crop.y1 = static_cast<int>(v[3]);
+		}
+		else if (key == "maxdepth" && (ok = readvals(job, 1, v))) sc.maxdepth = static_cast<int>(v[0]);
+		else if (key == "output") ok = static_cast<bool>(job >> sc.output);
+		else if (key == "spp" && (ok = readvals(job, 1, v))) {
+			// no budget and no noise target, so every tile gets exactly max_samples
+			opts.progressive = true;
+			opts.progressiveOptions.time_budget = 0;
+			opts.progressiveOptions.target_noise = 0;
+			opts.progressiveOptions.snapshot_interval = 0;
+			opts.progressiveOptions.max_samples = max(1, static_cast<int>(v[0]));
+			opts.progressiveOptions.min_samples = min(opts.progressiveOptions.min_samples, opts.progressiveOptions.max_samples);
+		}
+		else if (key == "inline") sendImage = true;
+		else ok = false;
+		if (!ok) return "error bad override " + key + "\n";
+	}
 
-				}
-				// Matrix access
-				else if (cmd == "pushTransform") {
+	if (!RenderScene(sc, *loaded->world, opts)) return "error unable to save " + sc.output + "\n";
+	double ms = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000;
+	string output = OutputPath(sc.output, opts);
+	if (!sendImage) return "ok " + to_string(ms) + " " + output + "\n";
 
-				}
-				else if (cmd == "popTransform") {
+	ifstream in(output, std::ios::binary);
+	string bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	if (!in && !in.eof()) return "error unable to read " + output + "\n";
+	return "image " + to_string(bytes.size()) + " " + to_string(ms) + " " + output + "\n" + bytes;
+}
 
-				}
-				// Transformation matrices
-				else if (cmd == "translate") {
+// hash_file's hash, 0 if the file can't be read; tells checkpoints of different scenes apart
+uint64_t HashFile(const char* filename) {
+	uint64_t hash;
+	return hash_file(filename, hash) ? hash : 0;
+}
 
-				}
-				else if (cmd == "scale") {
+#ifndef _WIN32
+
+// Starts count copies of this program as workers for a coordinator on address: the same arguments
+// (so the same scene file and render flags) without --distribute and --listen, with threads each.
+// Their stdout, which would be every scene line echoed count times, goes to /dev/null.
+std::vector<pid_t> SpawnWorkers(int argc, char* argv[], const string& address, int count, int threads) {
+	std::vector<string> args;
+	for (int i = 0; i < argc; i++) {
+		string arg = argv[i];
+		if ((arg == "--distribute" || arg == "--listen") && i + 1 < argc) i++;
+		else args.push_back(arg);
+	}
+	args.insert(args.end(), { "--worker", address, "--threads", to_string(threads) });
+	std::vector<char*> execArgs;
+	for (string& a : args) execArgs.push_back(&a[0]);
+	execArgs.push_back(nullptr);
+
+	std::vector<pid_t> pids;
+	for (int n = 0; n < count; n++) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			int devnull = open("/dev/null", O_WRONLY);
+			if (devnull >= 0) dup2(devnull, STDOUT_FILENO);
+			execvp(execArgs[0], execArgs.data());
+			cerr << "Unable to start worker " << execArgs[0] << "\n";
+			_exit(127);
+		}
+		if (pid < 0) cerr << "Unable to start worker " << n << "\n";
+		else pids.push_back(pid);
+	}
+	return pids;
+}
 
-				}
-				else if (cmd == "rotate") {
+// A worker for Distribute: connects to address, says which scene it has, then renders each tile
+// it's sent and sends the colors back as doubles, so the coordinator saves exactly the image a
+// single process would. Returns when the coordinator says it's done or goes away.
+bool RunWorker(const scene& sc, const hittable& world, const string& filename, const render_options& opts, const string& address) {
+	// the coordinator may still be starting up
+	int fd = -1;
+	for (int attempt = 0; attempt < 100 && (fd = connect_to(address)) < 0; attempt++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	if (fd < 0) {
+		cerr << "No coordinator on " << address << "\n";
+		return false;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	message_channel coordinator(fd);
+	if (!coordinator.send("hello " + to_string(HashFile(filename.c_str())) + " " + to_string(sc.width) + " " + to_string(sc.height)))
+		return false;
+
+	camera cam = sc.make_camera();
+	light_arrays lights(sc.lights, sc.attenuation, opts.lightCutoff);
+	std::vector<shading_context> contexts(std::max(1, opts.threads), shading_context(&lights, opts.shadowCache));
+	std::vector<color> rows;
+	std::vector<double> tile;
+	string header, payload;
+	while (coordinator.receive(header, payload)) {
+		stringstream message(header);
+		string verb;
+		int id;
+		pixel_rect t;
+		message >> verb;
+		if (verb == "done") return true;
+		if (verb == "reject") {
+			cerr << "Coordinator on " << address << " is rendering a different scene\n";
+			return false;
+		}
+		if (verb != "tile" || !(message >> id >> t.x0 >> t.y0 >> t.x1 >> t.y1)) continue;
+
+		rows.resize(size_t(t.height()) * sc.width);
+		tile.resize(size_t(t.width()) * t.height() * 3);
+		parallel_for(t.height(), opts.threads, [&](int worker, int row) {
+			color* line = &rows[size_t(row) * sc.width];
+			RenderRow(sc, world, cam, opts, t.y0 + row, t.x0, t.x1, line, nullptr, nullptr, contexts[worker]);
+			double* out = &tile[size_t(row) * t.width() * 3];
+			for (int i = t.x0; i < t.x1; i++, out += 3) {
+				out[0] = line[i].x();
+				out[1] = line[i].y();
+				out[2] = line[i].z();
+			}
+		});
+		if (!coordinator.send("result " + to_string(id), tile.data(), tile.size() * sizeof(double))) return false;
+	}
+	return true;
+}
 
-				}
-				// Geometry
-				else if (cmd == "sphere") {
-				
-				}
-				else if (cmd == "tri") {
+// Renders sc's region with worker processes: spawned ones (count of them, sharing opts.threads)
+// and any started by hand with --worker address. The region is cut into tileSize tiles that go
+// out one per worker; the tile of a worker that dies goes to the next free one, and a tile that
+// runs well over the usual time is rendered again by an idle worker (see tile_scheduler). Only the
+// one-sample row renderer is used. False if the image couldn't be rendered or saved.
+bool Distribute(const scene& sc, const string& filename, const render_options& opts, const string& address, int count, int tileSize,
+	int argc, char* argv[]) {
+	int listener = listen_on(address);
+	if (listener < 0) return false;
+	signal(SIGPIPE, SIG_IGN);
+
+	const pixel_rect region = sc.render_region();
+	tile_scheduler tiles(region, tileSize);
+	std::vector<color> previous;
+	if (sc.cropped() && opts.output.composite)
+		previous = LoadPreviousRender(OutputPath(sc.output, opts), sc.width, sc.height);
+	std::vector<color> pixels(size_t(sc.width) * sc.height);
+	const uint64_t hash = HashFile(filename.c_str());
+
+	std::vector<pid_t> children = SpawnWorkers(argc, argv, address, count, std::max(1, opts.threads / std::max(1, count)));
+	std::cout << "Coordinating " << tiles.tiles.size() << " tiles of " << region.width() << "x" << region.height() << " pixels on "
+		<< address << " with " << children.size() << " workers\n" << std::endl;
+
+	// connections in the order they came, null once closed; the index is the worker number
+	std::vector<std::unique_ptr<message_channel>> workers;
+	std::vector<int> tilesDone;
+	std::vector<char> greeted;
+	int printProgress[100] = {};
+	int finished = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	// spawned workers still running
+	std::vector<pid_t> running = children;
+	auto reap = [&]() {
+		for (size_t k = 0; k < running.size();) {
+			if (waitpid(running[k], nullptr, WNOHANG) == running[k]) running.erase(running.begin() + k);
+			else k++;
+		}
+	};
+
+	auto drop = [&](int w) {
+		workers[w].reset();
+		tiles.lose(w);
+	};
+	auto handOut = [&](int w) {
+		int t = tiles.assign(w, tile_scheduler::clock::now());
+		if (t < 0) return;
+		const pixel_rect& r = tiles.tiles[t];
+		stringstream message;
+		message << "tile " << t << " " << r.x0 << " " << r.y0 << " " << r.x1 << " " << r.y1;
+		if (!workers[w]->send(message.str())) drop(w);
+	};
+
+	while (!tiles.done()) {
+		std::vector<pollfd> fds(1, pollfd{ listener, POLLIN, 0 });
+		std::vector<int> owners(1, -1);
+		for (int w = 0; w < static_cast<int>(workers.size()); w++) {
+			if (!workers[w]) continue;
+			fds.push_back(pollfd{ workers[w]->fd, POLLIN, 0 });
+			owners.push_back(w);
+		}
+		// every spawned worker gone and none started by hand: nobody is left to finish the render
+		reap();
+		if (fds.size() == 1 && !children.empty() && running.empty()) {
+			cerr << "Every worker exited with " << tiles.tiles.size() - finished << " tiles left\n";
+			break;
+		}
 
+		// wake up now and then to back up tiles that are running long
+		poll(fds.data(), fds.size(), 100);
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(listener, nullptr, nullptr);
+			if (fd >= 0) {
+				workers.emplace_back(new message_channel(fd));
+				tilesDone.push_back(0);
+				greeted.push_back(0);
+			}
+		}
+		for (size_t k = 1; k < fds.size(); k++) {
+			const int w = owners[k];
+			if (!(fds[k].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+			if (!workers[w]->fill()) {
+				if (greeted[w]) cerr << "Lost worker " << w << ", its tile goes back in the queue\n";
+				drop(w);
+				continue;
+			}
+			string header, payload;
+			while (workers[w] && workers[w]->next(header, payload)) {
+				stringstream message(header);
+				string verb;
+				message >> verb;
+				if (verb == "hello") {
+					uint64_t workerHash = 0;
+					int width = 0, height = 0;
+					message >> workerHash >> width >> height;
+					if (workerHash != hash || width != sc.width || height != sc.height) {
+						cerr << "Worker " << w << " has a different scene, turning it away\n";
+						workers[w]->send("reject");
+						drop(w);
+						break;
+					}
+					greeted[w] = 1;
 				}
-				else if (cmd == "maxverts") {
-
+				else if (verb == "result") {
+					int t = -1;
+					message >> t;
+					bool valid = greeted[w] && t >= 0 && t < static_cast<int>(tiles.tiles.size());
+					const pixel_rect r = valid ? tiles.tiles[t] : pixel_rect();
+					if (!valid || payload.size() != size_t(r.width()) * r.height() * 3 * sizeof(double)) {
+						cerr << "Bad result from worker " << w << ", dropping it\n";
+						drop(w);
+						break;
+					}
+					if (tiles.complete(w, t, tile_scheduler::clock::now())) {
+						const double* in = reinterpret_cast<const double*>(payload.data());
+						for (int j = r.y0; j < r.y1; j++)
+							for (int i = r.x0; i < r.x1; i++, in += 3)
+								pixels[size_t(j) * sc.width + i] = color(in[0], in[1], in[2]);
+						tilesDone[w]++;
+						PrintProgress(++finished, static_cast<int>(tiles.tiles.size()), printProgress);
+					}
 				}
-				else if (cmd == "vertex") {
+			}
+		}
+		for (int w = 0; w < static_cast<int>(workers.size()); w++)
+			if (workers[w] && greeted[w]) handOut(w);
+	}
 
-				}
+	// the workers exit on "done"; one that's hung (or stopped) is killed after a second
+	for (auto& w : workers)
+		if (w) w->send("done");
+	workers.clear();
+	close(listener);
+	string host;
+	int port;
+	if (!is_tcp_address(address, host, port)) unlink(address.c_str());
+	for (int wait = 0; wait < 10 && (reap(), !running.empty()); wait++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	for (pid_t pid : running) {
+		kill(pid, SIGKILL);
+		waitpid(pid, nullptr, 0);
+	}
 
-				else {
-					cerr << "Unknown Command: " << cmd << "Skipping" << std::endl;
-				}
-            }
-        }
-		in.close();
-    }
-    else {
-        cerr << "Unable to Open Input Data File " << filename << "\n";
-    }
+	if (!tiles.done()) return false;
+	std::cout << "\nDone in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000 << " ms. "
+		<< tiles.requeued << " tiles requeued from lost workers, " << tiles.duplicated << " backed up after running long\n";
+	for (int w = 0; w < static_cast<int>(tilesDone.size()); w++)
+		if (tilesDone[w] > 0) std::cout << "  worker " << w << ": " << tilesDone[w] << " tiles\n";
+	if (!SaveRender(sc, pixels, previous, opts)) return false;
+	std::cout << "Image successfully saved!" << std::endl;
+	return true;
 }
 
+#endif
 
-int main() {
+int main(int argc, char* argv[]) {
 
-	const double aspectRatio = 16.0 / 9.0;
-	const int imageWidth = 500;
-	const int bitsPerPixel = 24;
-	//Rasterize(aspectRatio, imageWidth, bitsPerPixel);
 	string filename = "C:/dev/vivz753/ComputerGraphics/CSE168/hw1/RayTracer/src/homework1-submissionscenes/scene4-diffuse.test";
-	ReadFile(filename.c_str());
+	// "list" tests every object, "bvh" is the binned SAH build, "sbvh" adds spatial splits
+	string accel = "bvh";
+	bool bench = false;
+	bool benchSampler = false;
+	// progressive renders only: keep the render state in <output>.ckpt
+	bool checkpoint = false;
+	// store the bvh with 8-bit quantized child boxes
+	bool compress = false;
+	render_options opts;
+	// overrides the scene's crop command when given
+	pixel_rect crop;
+	bool cropGiven = false;
+	// render server socket to listen on, or to send submitJob to
+	string serveSocket, submitSocket, submitJob;
+	// a directory of .test files or a manifest listing them
+	string batch;
+	int cachedScenes = 4;
+	// coordinator: worker processes to start and where they connect; worker: the coordinator's address
+	int distribute = -1;
+	string listenAddress, workerAddress;
+	int tileSize = 32;
+	// Chrome trace event JSON of the load, render and save phases, see trace.h
+	string tracePath;
+	// heap limit in bytes, 0 for none, see memory_accounting.h
+	long long memoryBudget = 0;
+
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--accel" && i + 1 < argc) accel = argv[++i];
+		else if (arg == "--bench") bench = true;
+		else if (arg == "--bench-sampler") benchSampler = true;
+		else if (arg == "--compress") compress = true;
+		else if (arg == "--threads" && i + 1 < argc) opts.threads = atoi(argv[++i]);
+		else if (arg == "--interleave") opts.interleave = true;
+		else if (arg == "--wavefront") opts.wavefront = true;
+		else if (arg == "--sort-rays") opts.sortRays = true;
+		else if (arg == "--no-shadow-cache") opts.shadowCache = false;
+		else if (arg == "--light-cutoff" && i + 1 < argc) opts.lightCutoff = max(0.0, atof(argv[++i]));
+		else if (arg == "--aa" && i + 1 < argc) opts.aa.grid = max(1, atoi(argv[++i]));
+		else if (arg == "--aa-threshold" && i + 1 < argc) opts.aa.threshold = atof(argv[++i]);
+		else if (arg == "--aa-uniform") opts.aa.uniform = true;
+		else if (arg == "--progressive" && i + 1 < argc) {
+			opts.progressive = true;
+			opts.progressiveOptions.time_budget = atof(argv[++i]);
+		}
+		else if (arg == "--noise" && i + 1 < argc) opts.progressiveOptions.target_noise = atof(argv[++i]);
+		else if (arg == "--snapshot" && i + 1 < argc) opts.progressiveOptions.snapshot_interval = atof(argv[++i]);
+		else if (arg == "--sampler" && i + 1 < argc) {
+			string kind = argv[++i];
+			opts.progressiveOptions.sampling = kind == "random" ? sampler_kind::random : sampler_kind::sobol;
+		}
+		else if (arg == "--seed" && i + 1 < argc) opts.progressiveOptions.seed = static_cast<uint32_t>(atoi(argv[++i]));
+		else if (arg == "--checkpoint" && i + 1 < argc) {
+			checkpoint = true;
+			opts.progressiveOptions.checkpoint_interval = atof(argv[++i]);
+		}
+		else if (arg == "--resume") opts.progressiveOptions.resume = checkpoint = true;
+		else if (arg == "--band" && i + 1 < argc) opts.bandRows = max(0, atoi(argv[++i]));
+		else if (arg == "--format" && i + 1 < argc) opts.output.format = argv[++i];
+		else if (arg == "--png-level" && i + 1 < argc) opts.output.pngLevel = atoi(argv[++i]);
+		else if (arg == "--crop" && i + 4 < argc) {
+			crop.x0 = atoi(argv[++i]);
+			crop.y0 = atoi(argv[++i]);
+			crop.x1 = atoi(argv[++i]);
+			crop.y1 = atoi(argv[++i]);
+			cropGiven = true;
+		}
+		else if (arg == "--composite") opts.output.composite = true;
+		else if (arg == "--gbuffer") opts.useGBuffer = true;
+		else if (arg == "--serve" && i + 1 < argc) serveSocket = argv[++i];
+		else if (arg == "--batch" && i + 1 < argc) batch = argv[++i];
+		else if (arg == "--cache" && i + 1 < argc) cachedScenes = max(1, atoi(argv[++i]));
+		else if (arg == "--distribute" && i + 1 < argc) distribute = max(0, atoi(argv[++i]));
+		else if (arg == "--listen" && i + 1 < argc) listenAddress = argv[++i];
+		else if (arg == "--worker" && i + 1 < argc) workerAddress = argv[++i];
+		else if (arg == "--tile" && i + 1 < argc) tileSize = max(1, atoi(argv[++i]));
+		else if (arg == "--trace" && i + 1 < argc) tracePath = argv[++i];
+		else if (arg == "--memory-budget" && i + 1 < argc) memoryBudget = static_cast<long long>(atof(argv[++i]) * (1 << 20));
+		else if (arg == "--submit" && i + 2 < argc) {
+			submitSocket = argv[++i];
+			submitJob = argv[++i];
+		}
+		else filename = arg;
+	}
+
+	if (opts.output.format != "png" && opts.output.format != "ppm" && opts.output.format != "freeimage") {
+		cerr << "Unknown --format " << opts.output.format << ", writing png\n";
+		opts.output.format = "png";
+	}
+
+	// a hard limit from here on, parsing included; a render planned to fit never reaches it
+	if (memoryBudget > 0) memory_usage.budget = memoryBudget;
+
+	// render servers and distributed renders run on without a single end to save a trace at
+	if (!serveSocket.empty() || !submitSocket.empty() || distribute >= 0 || !workerAddress.empty()) tracePath.clear();
+	trace_log trace;
+	if (!tracePath.empty()) active_trace() = &trace;
+	auto saveTrace = [&]() {
+		if (tracePath.empty()) return;
+		active_trace() = nullptr;
+		if (trace.save(tracePath)) std::cout << "Trace: " << trace.size() << " spans written to " << tracePath << "\n";
+	};
+
+	if (!batch.empty()) {
+		std::vector<string> files = list_scene_files(batch);
+		if (files.empty()) {
+			cerr << "No scene files in " << batch << "\n";
+			return 1;
+		}
+		if (opts.progressive || opts.wavefront || opts.aa.grid > 1 || opts.bandRows > 0 || opts.useGBuffer)
+			cerr << "--batch only uses the one-sample row renderer, ignoring --progressive, --wavefront, --aa, --band and --gbuffer\n";
+		FreeImage_Initialise();
+		bool saved = RenderBatch(files, accel, compress, opts);
+		FreeImage_DeInitialise();
+		saveTrace();
+		std::cout << "\n";
+		print_memory_usage(stdout);
+		return saved ? 0 : 1;
+	}
+
+	if (!submitSocket.empty() || !serveSocket.empty()) {
+#ifdef _WIN32
+		cerr << "--serve and --submit need Unix domain sockets, which this build doesn't have\n";
+		return 1;
+#else
+		if (!submitSocket.empty()) {
+			// the reply header goes to stderr so an inline image can be piped from stdout
+			ostringstream reply;
+			if (!submit_unix_socket(submitSocket, submitJob, reply, cout)) {
+				cerr << "No reply from a render server on " << submitSocket << "\n";
+				return 1;
+			}
+			cerr << reply.str();
+			// the server answered, but an "error <why>" reply is still a failed job
+			string header = reply.str();
+			return header.compare(0, 3, "ok ") == 0 || header.compare(0, 6, "image ") == 0 ? 0 : 1;
+		}
+
+		// parsing and the bvh build happen once per scene file, not once per job
+		scene_cache scenes(cachedScenes, [&](const string& path) {
+			memory_scope cacheMemory(memory_tag::cache);
+			auto loaded = make_shared<loaded_scene>();
+			if (!ReadFile(path.c_str(), loaded->sc)) return shared_ptr<loaded_scene>();
+			loaded->world = BuildWorld(loaded->sc, accel, compress);
+			return loaded;
+		});
+		FreeImage_Initialise();
+		bool served = serve_unix_socket(serveSocket, [&](const string& line, bool& stop) {
+			return RunJob(line, scenes, opts, stop);
+		});
+		FreeImage_DeInitialise();
+		return served ? 0 : 1;
+#endif
+	}
+
+	long long allocationsBeforeParse = allocation_count();
+	scene sc;
+	if (!ReadFile(filename.c_str(), sc)) return 1;
+	if (cropGiven) sc.crop = crop;
+
+	if (bench) {
+		BenchAccelerators(sc, allocation_count() - allocationsBeforeParse);
+		return 0;
+	}
+	if (benchSampler) {
+		BenchSamplers(sc.width, sc.height, opts.threads);
+		return 0;
+	}
+	if (checkpoint) {
+		if (!opts.progressive) cerr << "--checkpoint and --resume only work with --progressive, ignoring them\n";
+		opts.progressiveOptions.checkpoint_file = sc.output + ".ckpt";
+		opts.progressiveOptions.scene_hash = HashFile(filename.c_str());
+	}
+
+	if (distribute >= 0 || !workerAddress.empty()) {
+#ifdef _WIN32
+		cerr << "--distribute and --worker need POSIX processes and sockets, which this build doesn't have\n";
+		return 1;
+#else
+		if (opts.progressive || opts.wavefront || opts.aa.grid > 1 || opts.bandRows > 0 || opts.useGBuffer)
+			cerr << "Distributed renders only use the one-sample row renderer, ignoring --progressive, --wavefront, --aa, --band and --gbuffer\n";
+		if (!workerAddress.empty()) {
+			shared_ptr<hittable> world = BuildWorld(sc, accel, compress);
+			return RunWorker(sc, *world, filename, opts, workerAddress) ? 0 : 1;
+		}
+		// the coordinator only cuts up and assembles the image, it never builds the bvh
+		if (listenAddress.empty()) listenAddress = "/tmp/raytracer-" + to_string(getpid()) + ".sock";
+		FreeImage_Initialise();
+		bool rendered = Distribute(sc, filename, opts, listenAddress, distribute, tileSize, argc, argv);
+		FreeImage_DeInitialise();
+		return rendered ? 0 : 1;
+#endif
+	}
+
+	if (memoryBudget > 0 && !FitMemoryBudget(sc, accel, compress, opts, memoryBudget)) return 1;
+	shared_ptr<hittable> world = BuildWorld(sc, accel, compress);
+	FreeImage_Initialise();
+	bool saved;
+	{
+		trace_span rendering("render", "render");
+		saved = RenderScene(sc, *world, opts);
+	}
+	saveTrace();
+	std::cout << "\n";
+	print_memory_usage(stdout);
+	std::cout << "FreeImage_" << FreeImage_GetVersion() << "\n";
+	std::cout << FreeImage_GetCopyrightMessage() << "\n\n";
+	FreeImage_DeInitialise();
+	return saved ? 0 : 1;
 }
\ No newline at end of file
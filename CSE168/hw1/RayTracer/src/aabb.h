@@ -0,0 +1,91 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+
+// axis-aligned bounding box, used by the acceleration structures
+// a default constructed box is "empty" (min > max) so expanding it by anything gives that thing back
+class aabb {
+public:
+    aabb() : minimum(infinity, infinity, infinity), maximum(-infinity, -infinity, -infinity) {}
+    aabb(const point3& a, const point3& b) : minimum(a), maximum(b) {}
+
+    point3 min() const { return minimum; }
+    point3 max() const { return maximum; }
+
+    bool empty() const {
+        return minimum.x() > maximum.x() || minimum.y() > maximum.y() || minimum.z() > maximum.z();
+    }
+
+    point3 centroid() const { return 0.5 * (minimum + maximum); }
+    vec3 extent() const { return maximum - minimum; }
+
+    void expand(const point3& p) {
+        for (int a = 0; a < 3; a++) {
+            minimum[a] = std::min(minimum[a], p[a]);
+            maximum[a] = std::max(maximum[a], p[a]);
+        }
+    }
+
+    void expand(const aabb& box) {
+        for (int a = 0; a < 3; a++) {
+            minimum[a] = std::min(minimum[a], box.minimum[a]);
+            maximum[a] = std::max(maximum[a], box.maximum[a]);
+        }
+    }
+
+    double surface_area() const {
+        if (empty()) return 0;
+        vec3 d = extent();
+        return 2.0 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+
+    int longest_axis() const {
+        vec3 d = extent();
+        if (d.x() > d.y() && d.x() > d.z()) return 0;
+        return d.y() > d.z() ? 1 : 2;
+    }
+
+    // slab test; inv_dir is 1/direction precomputed once per ray by the caller
+    bool hit(const point3& origin, const vec3& inv_dir, double t_min, double t_max) const {
+        for (int a = 0; a < 3; a++) {
+            auto t0 = (minimum[a] - origin[a]) * inv_dir[a];
+            auto t1 = (maximum[a] - origin[a]) * inv_dir[a];
+            if (inv_dir[a] < 0.0) std::swap(t0, t1);
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_max < t_min)
+                return false;
+        }
+        return true;
+    }
+
+    bool hit(const ray& r, double t_min, double t_max) const {
+        vec3 d = r.direction();
+        return hit(r.origin(), vec3(1.0 / d.x(), 1.0 / d.y(), 1.0 / d.z()), t_min, t_max);
+    }
+
+public:
+    point3 minimum;
+    point3 maximum;
+};
+
+inline aabb surrounding_box(const aabb& box0, const aabb& box1) {
+    aabb box = box0;
+    box.expand(box1);
+    return box;
+}
+
+// overlap of two boxes, empty if they don't touch
+inline aabb intersection(const aabb& box0, const aabb& box1) {
+    aabb box;
+    for (int a = 0; a < 3; a++) {
+        box.minimum[a] = std::max(box0.minimum[a], box1.minimum[a]);
+        box.maximum[a] = std::min(box0.maximum[a], box1.maximum[a]);
+    }
+    return box;
+}
+
+#endif
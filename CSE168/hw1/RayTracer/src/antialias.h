@@ -0,0 +1,78 @@
+#ifndef ANTIALIAS_H
+#define ANTIALIAS_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+// Adaptive supersampling: the image is first rendered with one sample per pixel, then only pixels
+// on an edge get grid x grid extra samples. A pixel is on an edge if its 3x3 neighbourhood spans
+// more than threshold in any (clamped) color channel, or if a 4-neighbour's camera ray hit a
+// different primitive (catches edges between objects of similar color).
+struct aa_options {
+    // samples per side for refined pixels, 1 turns antialiasing off
+    int grid = 1;
+    double threshold = 0.1;
+    // refine every pixel, for comparing against the adaptive result
+    bool uniform = false;
+};
+
+struct aa_stats {
+    long long pixels = 0;
+    long long refined = 0;
+    long long samples = 0;
+    int grid = 1;
+
+    void print(std::ostream& out) const {
+        long long uniform = pixels * grid * grid;
+        out << "Antialiasing:    " << refined << " of " << pixels << " pixels refined ("
+            << (pixels ? 100.0 * refined / pixels : 0) << "%) with " << grid << "x" << grid << " samples\n"
+            << "  samples:       " << samples << " (" << (pixels ? double(samples) / pixels : 0) << " per pixel), uniform "
+            << grid << "x" << grid << " would take " << uniform << " (" << (samples ? double(uniform) / samples : 0) << "x more)\n";
+    }
+};
+
+// Marks the pixels that need more samples. ids holds the primitive each pixel's camera ray hit
+// (nullptr for the background); if it's empty only contrast is used.
+inline std::vector<char> find_edges(const std::vector<color>& pixels, const std::vector<const hittable*>& ids,
+    int width, int height, double threshold) {
+    std::vector<char> edge(pixels.size(), 0);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            size_t p = size_t(j) * width + i;
+            color lo(1, 1, 1), hi(0, 0, 0);
+            for (int y = std::max(0, j - 1); y <= std::min(height - 1, j + 1); y++) {
+                for (int x = std::max(0, i - 1); x <= std::min(width - 1, i + 1); x++) {
+                    const color& c = pixels[size_t(y) * width + x];
+                    for (int a = 0; a < 3; a++) {
+                        double v = clamp(c[a], 0.0, 1.0);
+                        lo[a] = std::min(lo[a], v);
+                        hi[a] = std::max(hi[a], v);
+                    }
+                }
+            }
+            bool contrast = hi[0] - lo[0] > threshold || hi[1] - lo[1] > threshold || hi[2] - lo[2] > threshold;
+
+            bool id_change = false;
+            if (!ids.empty()) {
+                const hittable* id = ids[p];
+                id_change = (i > 0 && ids[p - 1] != id) || (i + 1 < width && ids[p + 1] != id)
+                    || (j > 0 && ids[p - width] != id) || (j + 1 < height && ids[p + width] != id);
+            }
+            edge[p] = contrast || id_change;
+        }
+    }
+    return edge;
+}
+
+// offset of stratum s of a grid x grid pattern from the pixel's sample position, in pixels;
+// the strata tile [-0.5, 0.5)^2 and each sample sits in the middle of its stratum
+inline void stratum_offset(int s, int grid, double& du, double& dv) {
+    du = ((s % grid) + 0.5) / grid - 0.5;
+    dv = ((s / grid) + 0.5) / grid - 0.5;
+}
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// A bump allocator: memory comes out of big chunks taken from the heap, nothing is freed on its
+// own, and everything goes back at once. Two uses: the scene's primitives, which are made one at a
+// time while parsing and all die together, and per-thread scratch (a row's ray lists, the bvh
+// build's reference lists) that is thrown away with reset() or rewind() and reused, so steady
+// state work makes no heap allocations at all. Not thread safe: one per thread or per scene.
+class memory_arena {
+public:
+    explicit memory_arena(size_t first_chunk = 64 * 1024) : first_chunk_size(first_chunk) {}
+    ~memory_arena() { release(); }
+
+    // a copy starts out empty, so structs carrying a scratch arena (shading_context) can be copied
+    // to give every worker its own
+    memory_arena(const memory_arena& other) : first_chunk_size(other.first_chunk_size) {}
+    memory_arena& operator=(const memory_arena& other) {
+        if (this != &other) {
+            release();
+            first_chunk_size = other.first_chunk_size;
+        }
+        return *this;
+    }
+
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+    // size default constructed Ts; only for types with nothing to destroy, since nothing is
+    template <class T>
+    T* allocate_array(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destroyed");
+        T* p = static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+        for (size_t i = 0; i < count; i++) new (p + i) T();
+        return p;
+    }
+
+    // where the next allocation goes; rewinding to it frees everything allocated since in one go
+    struct marker {
+        size_t chunk;
+        size_t used;
+    };
+    marker mark() const { return marker{ current, used }; }
+    void rewind(const marker& m) {
+        current = m.chunk;
+        used = m.used;
+    }
+    // frees everything but keeps the chunks, so the next round of allocations takes nothing from the heap
+    void reset() { rewind(marker{ 0, 0 }); }
+    // gives the chunks back to the heap
+    void release();
+
+    // bytes taken from the heap
+    size_t capacity() const {
+        size_t total = 0;
+        for (const chunk& c : chunks) total += c.size;
+        return total;
+    }
+
+private:
+    struct chunk {
+        char* data;
+        size_t size;
+    };
+
+    std::vector<chunk> chunks;
+    // the chunk being allocated from and how much of it is used
+    size_t current = 0;
+    size_t used = 0;
+    size_t first_chunk_size;
+};
+
+void* memory_arena::allocate(size_t size, size_t align) {
+    // the current chunk, then any kept from before a reset, then a new one twice the last one's size
+    for (; current < chunks.size(); current++, used = 0) {
+        const chunk& c = chunks[current];
+        uintptr_t start = reinterpret_cast<uintptr_t>(c.data) + used;
+        size_t padding = (align - start % align) % align;
+        if (used + padding + size <= c.size) {
+            used += padding + size;
+            return c.data + used - size;
+        }
+    }
+    // chunks top out at 4 MB, bigger requests get a chunk of their own size
+    size_t grown = chunks.empty() ? first_chunk_size : std::min<size_t>(chunks.back().size * 2, 4 << 20);
+    chunk c{ nullptr, std::max(grown, size + align) };
+    c.data = static_cast<char*>(::operator new(c.size));
+    chunks.push_back(c);
+    current = chunks.size() - 1;
+    uintptr_t start = reinterpret_cast<uintptr_t>(c.data);
+    used = (align - start % align) % align + size;
+    return c.data + used - size;
+}
+
+void memory_arena::release() {
+    for (const chunk& c : chunks) ::operator delete(c.data);
+    chunks.clear();
+    chunks.shrink_to_fit();
+    current = used = 0;
+}
+
+// A standard allocator on top of an arena, for containers and allocate_shared. deallocate does
+// nothing: the memory comes back when the arena is reset, rewound or destroyed. Made from a
+// shared_ptr, every container or object allocated with it (and every copy of it) keeps the arena
+// alive, which is how the scene's primitives can outlive the scene they were parsed into.
+template <class T>
+class arena_allocator {
+public:
+    typedef T value_type;
+
+    explicit arena_allocator(memory_arena* a) : arena(a) {}
+    explicit arena_allocator(const std::shared_ptr<memory_arena>& a) : arena(a.get()), owner(a) {}
+    template <class U>
+    arena_allocator(const arena_allocator<U>& other) : arena(other.arena), owner(other.owner) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) {}
+
+    memory_arena* arena;
+    std::shared_ptr<memory_arena> owner;
+};
+
+template <class T, class U>
+bool operator==(const arena_allocator<T>& a, const arena_allocator<U>& b) { return a.arena == b.arena; }
+template <class T, class U>
+bool operator!=(const arena_allocator<T>& a, const arena_allocator<U>& b) { return a.arena != b.arena; }
+
+template <class T>
+using arena_vector = std::vector<T, arena_allocator<T>>;
+
+// rewinds an arena to where it was when this was made, once it goes out of scope; declare it
+// before the containers it should free, so they're gone first
+class arena_rewind {
+public:
+    explicit arena_rewind(memory_arena& a) : arena(a), start(a.mark()) {}
+    arena_rewind(const arena_rewind&) = delete;
+    arena_rewind& operator=(const arena_rewind&) = delete;
+    ~arena_rewind() { arena.rewind(start); }
+
+private:
+    memory_arena& arena;
+    memory_arena::marker start;
+};
+
+#endif
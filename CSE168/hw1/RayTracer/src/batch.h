@@ -0,0 +1,113 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+// The scene files a batch renders: every .test file in a directory (sorted by name), or the lines of
+// a manifest file. Manifest lines are paths relative to the manifest's directory; blank lines and
+// lines starting with # are skipped.
+inline std::vector<std::string> list_scene_files(const std::string& path) {
+    std::vector<std::string> files;
+    auto ends_with = [](const std::string& s, const std::string& suffix) {
+        return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+    std::string dir = path;
+    if (!dir.empty() && dir.back() != '/' && dir.back() != '\\') dir += '/';
+
+#ifdef _WIN32
+    _finddata_t found;
+    intptr_t handle = _findfirst((dir + "*.test").c_str(), &found);
+    bool is_dir = handle != -1;
+    if (is_dir) {
+        do files.push_back(dir + found.name); while (_findnext(handle, &found) == 0);
+        _findclose(handle);
+    }
+#else
+    struct stat info;
+    bool is_dir = stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+    if (is_dir) {
+        if (DIR* d = opendir(path.c_str())) {
+            while (dirent* entry = readdir(d)) {
+                std::string name = entry->d_name;
+                if (ends_with(name, ".test")) files.push_back(dir + name);
+            }
+            closedir(d);
+        }
+    }
+#endif
+    if (is_dir) {
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    std::ifstream manifest(path);
+    size_t slash = path.find_last_of("/\\");
+    std::string base = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+    std::string line;
+    while (std::getline(manifest, line)) {
+        line.erase(0, line.find_first_not_of(" \t"));
+        line.erase(line.find_last_not_of(" \t\r\n") + 1);
+        if (line.empty() || line[0] == '#') continue;
+        bool absolute = line[0] == '/' || line[0] == '\\' || (line.size() > 1 && line[1] == ':');
+        files.push_back(absolute ? line : base + line);
+    }
+    return files;
+}
+
+// one row of the batch summary
+struct batch_scene_stats {
+    std::string file;
+    std::string output;
+    int width = 0, height = 0;
+    int primitives = 0;
+    bool loaded = false, saved = false;
+    // parse and acceleration structure build
+    double load_ms = 0;
+    // from its first tile starting to its image being saved, while sharing the workers with the
+    // other scenes
+    double render_ms = 0;
+    // time workers spent on its tiles, summed over workers
+    double busy_ms = 0;
+};
+
+inline void print_batch_summary(std::ostream& out, const std::vector<batch_scene_stats>& scenes, double wall_ms, int threads) {
+    char line[256];
+    snprintf(line, sizeof(line), "%-28s %11s %8s %9s %10s %10s  %s\n", "scene", "size", "prims", "load ms", "render ms", "cpu ms", "output");
+    out << "\nBatch summary\n" << line;
+    long long pixels = 0;
+    double busy = 0;
+    int saved = 0;
+    for (const batch_scene_stats& s : scenes) {
+        size_t slash = s.file.find_last_of("/\\");
+        std::string name = slash == std::string::npos ? s.file : s.file.substr(slash + 1);
+        if (!s.loaded) {
+            snprintf(line, sizeof(line), "%-28s %11s %8s %9s %10s %10s  %s\n", name.c_str(), "-", "-", "-", "-", "-", "not loaded");
+            out << line;
+            continue;
+        }
+        std::string size = std::to_string(s.width) + "x" + std::to_string(s.height);
+        snprintf(line, sizeof(line), "%-28s %11s %8d %9.1f %10.1f %10.1f  %s\n", name.c_str(), size.c_str(), s.primitives,
+            s.load_ms, s.render_ms, s.busy_ms, s.saved ? s.output.c_str() : "NOT SAVED");
+        out << line;
+        pixels += static_cast<long long>(s.width) * s.height;
+        busy += s.load_ms + s.busy_ms;
+        saved += s.saved;
+    }
+    out << saved << " of " << scenes.size() << " scenes saved, " << pixels << " pixels in " << wall_ms << " ms: "
+        << (wall_ms > 0 ? pixels / wall_ms * 1000 : 0) << " pixels/s, workers busy "
+        << (wall_ms > 0 ? 100 * busy / (wall_ms * threads) : 0) << "% of " << threads << " threads\n";
+}
+
+#endif
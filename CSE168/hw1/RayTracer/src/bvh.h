@@ -0,0 +1,684 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "sphere.h"
+#include "sphere_packet.h"
+#include "arena.h"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+struct bvh_build_options {
+    // SBVH (Stich et al. 2009): also try splitting space itself, clipping primitives that straddle the plane
+    // into both children, instead of only partitioning the primitive list
+    bool spatial_splits = false;
+    // only look for spatial splits when the best object split's children overlap by more than this
+    // fraction of the root's surface area; keeps duplication to the places it actually helps
+    double split_alpha = 1e-5;
+    // how many extra references spatial splits may create, as a fraction of the primitive count
+    double duplication_budget = 0.5;
+
+    // store leaves made only of spheres as SoA packets and test them 4 at a time; the SAH then prices
+    // such a leaf per packet rather than per sphere, so sphere leaves fill up instead of splitting
+    bool sphere_packets = true;
+
+    int max_leaf_size = 4;
+    int bins = 32;
+    // SAH constants, relative cost of a box test vs a primitive test
+    double traversal_cost = 1.0;
+    double intersection_cost = 1.0;
+};
+
+// flattened node: a node's first child always directly follows it in the array
+struct bvh_node {
+    aabb box;
+    // leaf: first entry in prim_refs. interior: index of the second child
+    int offset;
+    // number of primitives in a leaf, 0 for interior nodes
+    int count;
+    // split axis, lets traversal visit the nearer child first
+    int axis;
+    // leaf made only of spheres: its first entry in bvh::packets, otherwise -1
+    int packet;
+};
+
+struct bvh_stats {
+    int primitives = 0;
+    int references = 0;
+    int nodes = 0;
+    int leaves = 0;
+    int max_depth = 0;
+    int spatial_splits = 0;
+    int sphere_packets = 0;
+    size_t memory_bytes = 0;
+    double sah_cost = 0;
+    double build_ms = 0;
+
+    void print(std::ostream& out) const {
+        out << "  primitives:     " << primitives << "\n"
+            << "  references:     " << references << " (" << (primitives ? 100.0 * (references - primitives) / primitives : 0) << "% duplicated)\n"
+            << "  nodes:          " << nodes << " (" << leaves << " leaves, " << spatial_splits << " spatial splits)\n"
+            << "  max depth:      " << max_depth << "\n"
+            << "  sphere packets: " << sphere_packets << "\n"
+            << "  memory:         " << memory_bytes / 1024 << " KB\n"
+            << "  SAH cost:       " << sah_cost << "\n"
+            << "  build time:     " << build_ms << " ms\n";
+    }
+};
+
+class bvh : public hittable {
+public:
+    bvh() {}
+    bvh(const hittable_list& list, const bvh_build_options& opts = bvh_build_options());
+
+    virtual bool hit(
+        const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
+    virtual void hit_batch(const ray* rays, int count, double t_min, double t_max, hit_record* recs, bool* hits) const override;
+
+    // rays in flight per hit_batch group; enough to cover a DRAM miss with the other rays' work
+    static const int interleave_width = 8;
+
+public:
+    std::vector<shared_ptr<hittable>> objects;
+    std::vector<int> prim_refs;
+    std::vector<bvh_node> nodes;
+    std::vector<sphere_packet> packets;
+    bvh_build_options options;
+    bvh_stats stats;
+
+private:
+    // a primitive's bounds as seen by one node; spatial splits make several refs per primitive
+    struct reference {
+        aabb box;
+        int prim;
+    };
+
+    struct split {
+        double cost = infinity;
+        int axis = -1;
+        int bin = -1;
+        aabb left_box, right_box;
+        int left_count = 0, right_count = 0;
+        bool spatial = false;
+    };
+
+    typedef arena_vector<reference> reference_list;
+
+    int build(reference_list& refs, const aabb& node_box, int depth);
+    split find_object_split(const reference_list& refs) const;
+    split find_spatial_split(const reference_list& refs, const aabb& node_box) const;
+    void do_spatial_split(const split& s, const aabb& node_box, reference_list& refs,
+        reference_list& left, reference_list& right);
+    void build_sphere_packets();
+    void compute_stats();
+    bool hit_leaf(const bvh_node& node, const ray& r, double t_min, double& closest_so_far, hit_record& rec) const;
+
+    double root_area = 0;
+    int max_references = 0;
+    // per primitive, whether it can go in a sphere packet
+    std::vector<bool> packable;
+    // the build's reference lists and bins, only set while building. Each node's are rewound when
+    // its subtree is done, so the build takes a few chunks from the heap instead of several
+    // allocations per node.
+    memory_arena* scratch = nullptr;
+};
+
+bvh::bvh(const hittable_list& list, const bvh_build_options& opts) : objects(list.objects), options(opts) {
+    auto start = std::chrono::steady_clock::now();
+
+    memory_arena build_arena(1 << 20);
+    scratch = &build_arena;
+    reference_list refs{ arena_allocator<reference>(scratch) };
+    refs.reserve(objects.size());
+    packable.reserve(objects.size());
+    aabb root_box;
+    for (int i = 0; i < static_cast<int>(objects.size()); i++) {
+        aabb box;
+        if (!objects[i]->bounding_box(box))
+            std::cerr << "No bounding box in bvh constructor.\n";
+        refs.push_back({ box, i });
+        root_box.expand(box);
+        packable.push_back(options.sphere_packets && dynamic_cast<const sphere*>(objects[i].get()) != nullptr);
+    }
+
+    if (!refs.empty()) {
+        root_area = root_box.surface_area();
+        max_references = static_cast<int>(refs.size() * (1.0 + (options.spatial_splits ? options.duplication_budget : 0.0)));
+        stats.references = static_cast<int>(refs.size());
+        // reserved at their most so they never grow, which would hold the old and new copies at once:
+        // a leaf per reference at most, and a node per leaf and one less again
+        nodes.reserve(2 * static_cast<size_t>(max_references));
+        prim_refs.reserve(max_references);
+        build(refs, root_box, 0);
+        if (options.sphere_packets) build_sphere_packets();
+    }
+    scratch = nullptr;
+
+    stats.build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    compute_stats();
+}
+
+int bvh::build(reference_list& refs, const aabb& node_box, int depth) {
+    // frees this node's bins and child lists, after they're gone, once its subtree is built
+    arena_rewind scratch_used(*scratch);
+    int index = static_cast<int>(nodes.size());
+    nodes.push_back({ node_box, 0, 0, 0, -1 });
+    stats.max_depth = std::max(stats.max_depth, depth);
+
+    int n = static_cast<int>(refs.size());
+    double leaf_cost = options.intersection_cost * n;
+    if (n <= options.max_leaf_size) {
+        bool all_packable = true;
+        for (const auto& r : refs) all_packable = all_packable && packable[r.prim];
+        if (all_packable)
+            leaf_cost = options.intersection_cost * ((n + sphere_packet::width - 1) / sphere_packet::width);
+    }
+
+    split best;
+    if (n > 1 && depth < 60) {
+        best = find_object_split(refs);
+
+        // spatial splits only pay off where object split children overlap
+        if (options.spatial_splits && stats.references < max_references && best.axis >= 0) {
+            double overlap = intersection(best.left_box, best.right_box).surface_area();
+            if (overlap / root_area > options.split_alpha) {
+                split spatial = find_spatial_split(refs, node_box);
+                int duplicates = spatial.left_count + spatial.right_count - n;
+                if (spatial.cost < best.cost && stats.references + duplicates <= max_references)
+                    best = spatial;
+            }
+        }
+        else if (options.spatial_splits && best.axis < 0 && stats.references < max_references) {
+            // every centroid in the same spot; only a spatial split can separate them
+            best = find_spatial_split(refs, node_box);
+        }
+    }
+
+    double node_area = std::max(node_box.surface_area(), 1e-300);
+    double split_cost = options.traversal_cost + options.intersection_cost * best.cost / node_area;
+    bool make_leaf = best.axis < 0 || (n <= options.max_leaf_size && leaf_cost <= split_cost);
+
+    reference_list left{ arena_allocator<reference>(scratch) }, right{ arena_allocator<reference>(scratch) };
+    // the smaller child's list goes on the arena first, so the larger one is on top and can be freed
+    // once it's been moved into refs, see below
+    const bool left_smaller = best.left_count <= best.right_count;
+    reference_list& smaller = left_smaller ? left : right;
+    reference_list& larger = left_smaller ? right : left;
+    memory_arena::marker larger_start = scratch->mark();
+    if (!make_leaf) {
+        // exact for object splits, an upper bound for spatial ones
+        smaller.reserve(left_smaller ? best.left_count : best.right_count);
+        larger_start = scratch->mark();
+        larger.reserve(left_smaller ? best.right_count : best.left_count);
+        if (best.spatial) {
+            do_spatial_split(best, node_box, refs, left, right);
+            stats.spatial_splits++;
+        }
+        else {
+            // object split: partition on the centroid bin
+            aabb centroids;
+            for (const auto& r : refs) centroids.expand(r.box.centroid());
+            double lo = centroids.minimum[best.axis];
+            double scale = options.bins / (centroids.maximum[best.axis] - lo);
+            for (const auto& r : refs) {
+                int b = std::min(options.bins - 1, static_cast<int>((r.box.centroid()[best.axis] - lo) * scale));
+                (b <= best.bin ? left : right).push_back(r);
+            }
+        }
+        make_leaf = left.empty() || right.empty();
+        if (make_leaf) {
+            // the split didn't separate anything after all, undo any duplication it counted
+            stats.references -= static_cast<int>(left.size() + right.size()) - n;
+        }
+    }
+
+    if (make_leaf) {
+        nodes[index].offset = static_cast<int>(prim_refs.size());
+        nodes[index].count = n;
+        for (const auto& r : refs) prim_refs.push_back(r.prim);
+        return index;
+    }
+
+    // This node is done with refs, so the larger child takes over its storage and the arena only
+    // keeps the smaller child's list on the way down. The smaller children along any path are
+    // disjoint sets of references, so with the lists being split the scratch never holds more
+    // than three times the references (see PlanMemory). If a spatial split made the larger list
+    // too big for refs, or the smaller one outgrew its reserve and moved above it, both stay.
+    reference_list* left_refs = &left;
+    reference_list* right_refs = &right;
+    const size_t smaller_reserved = left_smaller ? best.left_count : best.right_count;
+    if (larger.size() <= refs.capacity() && smaller.capacity() == smaller_reserved) {
+        refs.assign(larger.begin(), larger.end());
+        reference_list(arena_allocator<reference>(scratch)).swap(larger);
+        scratch->rewind(larger_start);
+        (left_smaller ? right_refs : left_refs) = &refs;
+    }
+    else {
+        refs.clear();
+    }
+
+    aabb left_box, right_box;
+    for (const auto& r : *left_refs) left_box.expand(r.box);
+    for (const auto& r : *right_refs) right_box.expand(r.box);
+
+    nodes[index].axis = best.axis;
+    build(*left_refs, left_box, depth + 1);
+    nodes[index].offset = static_cast<int>(nodes.size());
+    build(*right_refs, right_box, depth + 1);
+
+    return index;
+}
+
+// binned SAH over primitive centroids; returns the SAH numerator (area * count summed over children)
+bvh::split bvh::find_object_split(const reference_list& refs) const {
+    split best;
+
+    aabb centroids;
+    for (const auto& r : refs) centroids.expand(r.box.centroid());
+
+    arena_allocator<int> alloc(scratch);
+    arena_vector<aabb> bin_boxes(options.bins, aabb(), alloc);
+    arena_vector<int> bin_counts(options.bins, 0, alloc);
+    arena_vector<aabb> right_boxes(options.bins, aabb(), alloc);
+
+    for (int axis = 0; axis < 3; axis++) {
+        double lo = centroids.minimum[axis];
+        double extent = centroids.maximum[axis] - lo;
+        if (extent <= 0) continue;
+        double scale = options.bins / extent;
+
+        std::fill(bin_boxes.begin(), bin_boxes.end(), aabb());
+        std::fill(bin_counts.begin(), bin_counts.end(), 0);
+        for (const auto& r : refs) {
+            int b = std::min(options.bins - 1, static_cast<int>((r.box.centroid()[axis] - lo) * scale));
+            bin_boxes[b].expand(r.box);
+            bin_counts[b]++;
+        }
+
+        // sweep from the right to get the right child's bounds for every plane
+        aabb acc;
+        for (int b = options.bins - 1; b > 0; b--) {
+            acc.expand(bin_boxes[b]);
+            right_boxes[b] = acc;
+        }
+
+        aabb left_box;
+        int left_count = 0;
+        int total = static_cast<int>(refs.size());
+        for (int b = 0; b < options.bins - 1; b++) {
+            left_box.expand(bin_boxes[b]);
+            left_count += bin_counts[b];
+            int right_count = total - left_count;
+            if (left_count == 0 || right_count == 0) continue;
+
+            double cost = left_box.surface_area() * left_count + right_boxes[b + 1].surface_area() * right_count;
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.bin = b;
+                best.left_box = left_box;
+                best.right_box = right_boxes[b + 1];
+                best.left_count = left_count;
+                best.right_count = right_count;
+            }
+        }
+    }
+
+    return best;
+}
+
+// bins over the node's extent (not the centroids); each reference is clipped into every bin it overlaps,
+// entering in its first bin and exiting in its last
+bvh::split bvh::find_spatial_split(const reference_list& refs, const aabb& node_box) const {
+    split best;
+
+    arena_allocator<int> alloc(scratch);
+    arena_vector<aabb> bin_boxes(options.bins, aabb(), alloc);
+    arena_vector<int> entries(options.bins, 0, alloc), exits(options.bins, 0, alloc);
+    arena_vector<aabb> right_boxes(options.bins, aabb(), alloc);
+    arena_vector<int> right_counts(options.bins, 0, alloc);
+
+    for (int axis = 0; axis < 3; axis++) {
+        double lo = node_box.minimum[axis];
+        double extent = node_box.maximum[axis] - lo;
+        if (extent <= 0) continue;
+        double bin_width = extent / options.bins;
+
+        std::fill(bin_boxes.begin(), bin_boxes.end(), aabb());
+        std::fill(entries.begin(), entries.end(), 0);
+        std::fill(exits.begin(), exits.end(), 0);
+
+        for (const auto& r : refs) {
+            int first = std::max(0, std::min(options.bins - 1, static_cast<int>((r.box.minimum[axis] - lo) / bin_width)));
+            int last = std::max(first, std::min(options.bins - 1, static_cast<int>((r.box.maximum[axis] - lo) / bin_width)));
+            entries[first]++;
+            exits[last]++;
+
+            if (first == last) {
+                bin_boxes[first].expand(r.box);
+                continue;
+            }
+            for (int b = first; b <= last; b++) {
+                aabb slab = r.box;
+                slab.minimum[axis] = std::max(slab.minimum[axis], lo + b * bin_width);
+                slab.maximum[axis] = std::min(slab.maximum[axis], b == options.bins - 1 ? node_box.maximum[axis] : lo + (b + 1) * bin_width);
+                bin_boxes[b].expand(objects[r.prim]->clipped_box(slab));
+            }
+        }
+
+        aabb acc;
+        int count = 0;
+        for (int b = options.bins - 1; b > 0; b--) {
+            acc.expand(bin_boxes[b]);
+            count += exits[b];
+            right_boxes[b] = acc;
+            right_counts[b] = count;
+        }
+
+        aabb left_box;
+        int left_count = 0;
+        for (int b = 0; b < options.bins - 1; b++) {
+            left_box.expand(bin_boxes[b]);
+            left_count += entries[b];
+            int right_count = right_counts[b + 1];
+            if (left_count == 0 || right_count == 0) continue;
+
+            double cost = left_box.surface_area() * left_count + right_boxes[b + 1].surface_area() * right_count;
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.bin = b;
+                best.left_box = left_box;
+                best.right_box = right_boxes[b + 1];
+                best.left_count = left_count;
+                best.right_count = right_count;
+                best.spatial = true;
+            }
+        }
+    }
+
+    return best;
+}
+
+void bvh::do_spatial_split(const split& s, const aabb& node_box, reference_list& refs,
+    reference_list& left, reference_list& right) {
+    int axis = s.axis;
+    double plane = node_box.minimum[axis] + (node_box.maximum[axis] - node_box.minimum[axis]) * (s.bin + 1) / options.bins;
+
+    // the references fully on one side first, so straddlers can be judged against those boxes
+    aabb left_box, right_box;
+    reference_list straddling{ arena_allocator<reference>(scratch) };
+    for (const auto& r : refs) {
+        if (r.box.maximum[axis] <= plane) {
+            left.push_back(r);
+            left_box.expand(r.box);
+        }
+        else if (r.box.minimum[axis] >= plane) {
+            right.push_back(r);
+            right_box.expand(r.box);
+        }
+        else {
+            straddling.push_back(r);
+        }
+    }
+
+    int left_count = static_cast<int>(left.size()) + static_cast<int>(straddling.size());
+    int right_count = static_cast<int>(right.size()) + static_cast<int>(straddling.size());
+
+    for (const auto& r : straddling) {
+        aabb left_clip = r.box, right_clip = r.box;
+        left_clip.maximum[axis] = plane;
+        right_clip.minimum[axis] = plane;
+        aabb l = objects[r.prim]->clipped_box(left_clip);
+        aabb rt = objects[r.prim]->clipped_box(right_clip);
+
+        // reference unsplitting: sending the whole primitive to one side can be cheaper than duplicating it
+        double cost_split = surrounding_box(left_box, l).surface_area() * left_count
+            + surrounding_box(right_box, rt).surface_area() * right_count;
+        double cost_left = surrounding_box(left_box, r.box).surface_area() * left_count
+            + right_box.surface_area() * (right_count - 1);
+        double cost_right = left_box.surface_area() * (left_count - 1)
+            + surrounding_box(right_box, r.box).surface_area() * right_count;
+
+        if (l.empty() || (cost_right < cost_split && cost_right <= cost_left)) {
+            right.push_back(r);
+            right_box.expand(r.box);
+            left_count--;
+        }
+        else if (rt.empty() || cost_left < cost_split) {
+            left.push_back(r);
+            left_box.expand(r.box);
+            right_count--;
+        }
+        else {
+            left.push_back({ l, r.prim });
+            right.push_back({ rt, r.prim });
+            left_box.expand(l);
+            right_box.expand(rt);
+        }
+    }
+
+    stats.references += static_cast<int>(left.size() + right.size() - refs.size());
+}
+
+void bvh::build_sphere_packets() {
+    // counted first so packets is allocated once
+    size_t count = 0;
+    for (const auto& node : nodes) {
+        if (node.count == 0) continue;
+        bool all_spheres = true;
+        for (int i = node.offset; i < node.offset + node.count; i++)
+            all_spheres = all_spheres && packable[prim_refs[i]];
+        if (all_spheres) count += (node.count + sphere_packet::width - 1) / sphere_packet::width;
+    }
+    packets.reserve(count);
+
+    for (auto& node : nodes) {
+        if (node.count == 0) continue;
+
+        bool all_spheres = true;
+        for (int i = node.offset; i < node.offset + node.count; i++)
+            all_spheres = all_spheres && packable[prim_refs[i]];
+        if (!all_spheres) continue;
+
+        node.packet = static_cast<int>(packets.size());
+        for (int first = 0; first < node.count; first += sphere_packet::width) {
+            sphere_packet p;
+            for (int k = 0; k < sphere_packet::width; k++) {
+                int prim = prim_refs[node.offset + std::min(first + k, node.count - 1)];
+                auto s = static_cast<const sphere*>(objects[prim].get());
+                p.cx[k] = s->center.x();
+                p.cy[k] = s->center.y();
+                p.cz[k] = s->center.z();
+                p.r2[k] = s->radius * s->radius;
+                p.prim[k] = prim;
+            }
+            packets.push_back(p);
+        }
+    }
+}
+
+void bvh::compute_stats() {
+    stats.primitives = static_cast<int>(objects.size());
+    stats.nodes = static_cast<int>(nodes.size());
+    stats.leaves = 0;
+    stats.sah_cost = 0;
+    stats.references = static_cast<int>(prim_refs.size());
+    stats.sphere_packets = static_cast<int>(packets.size());
+    stats.memory_bytes = nodes.size() * sizeof(bvh_node) + prim_refs.size() * sizeof(int)
+        + packets.size() * sizeof(sphere_packet);
+    if (nodes.empty() || root_area <= 0) return;
+
+    for (const auto& n : nodes) {
+        double area = n.box.surface_area() / root_area;
+        if (n.count > 0) {
+            stats.leaves++;
+            int tests = n.packet >= 0 ? (n.count + sphere_packet::width - 1) / sphere_packet::width : n.count;
+            stats.sah_cost += area * tests * options.intersection_cost;
+        }
+        else {
+            stats.sah_cost += area * options.traversal_cost;
+        }
+    }
+}
+
+bool bvh::hit_leaf(const bvh_node& node, const ray& r, double t_min, double& closest_so_far, hit_record& rec) const {
+    bool hit_anything = false;
+
+    if (node.packet >= 0) {
+        int packet_count = (node.count + sphere_packet::width - 1) / sphere_packet::width;
+        for (int p = node.packet; p < node.packet + packet_count; p++) {
+            double t;
+            int lane = packets[p].hit(r, t_min, closest_so_far, t);
+            if (lane >= 0) {
+                static_cast<const sphere*>(objects[packets[p].prim[lane]].get())->set_hit_record(r, t, rec);
+                hit_anything = true;
+                closest_so_far = t;
+            }
+        }
+        return hit_anything;
+    }
+
+    hit_record temp_rec;
+    for (int i = node.offset; i < node.offset + node.count; i++) {
+        if (objects[prim_refs[i]]->hit(r, t_min, closest_so_far, temp_rec)) {
+            hit_anything = true;
+            closest_so_far = temp_rec.t;
+            rec = temp_rec;
+        }
+    }
+    return hit_anything;
+}
+
+bool bvh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    if (nodes.empty()) return false;
+
+    vec3 d = r.direction();
+    vec3 inv_dir(1.0 / d.x(), 1.0 / d.y(), 1.0 / d.z());
+    bool dir_neg[3] = { inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0 };
+
+    bool hit_anything = false;
+    auto closest_so_far = t_max;
+
+    int stack[64];
+    int stack_size = 0;
+    int current = 0;
+
+    while (true) {
+        const bvh_node& node = nodes[current];
+        if (node.box.hit(r.origin(), inv_dir, t_min, closest_so_far)) {
+            if (node.count > 0) {
+                if (hit_leaf(node, r, t_min, closest_so_far, rec))
+                    hit_anything = true;
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+            else {
+                // visit the child on the ray's side of the split first so closest_so_far shrinks sooner
+                if (dir_neg[node.axis]) {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                }
+                else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+            }
+        }
+        else {
+            if (stack_size == 0) break;
+            current = stack[--stack_size];
+        }
+    }
+
+    return hit_anything;
+}
+
+// Interleaved traversal: each ray in a group is a small state machine that visits one node per turn.
+// After a ray's turn the node it will visit next is prefetched, and by the time the round robin
+// comes back to it the node is (hopefully) in cache. Same node order per ray as bvh::hit.
+void bvh::hit_batch(const ray* rays, int count, double t_min, double t_max, hit_record* recs, bool* hits) const {
+    struct traversal_state {
+        vec3 inv_dir;
+        bool dir_neg[3];
+        double closest_so_far;
+        int current;
+        int stack_size;
+        int stack[64];
+    };
+
+    traversal_state states[interleave_width];
+    int active[interleave_width];
+
+    for (int group = 0; group < count; group += interleave_width) {
+        int group_size = std::min(interleave_width, count - group);
+        int active_count = 0;
+
+        for (int k = 0; k < group_size; k++) {
+            const ray& r = rays[group + k];
+            hits[group + k] = false;
+            if (nodes.empty()) continue;
+
+            traversal_state& st = states[k];
+            vec3 d = r.direction();
+            st.inv_dir = vec3(1.0 / d.x(), 1.0 / d.y(), 1.0 / d.z());
+            for (int a = 0; a < 3; a++) st.dir_neg[a] = st.inv_dir[a] < 0;
+            st.closest_so_far = t_max;
+            st.current = 0;
+            st.stack_size = 0;
+            active[active_count++] = k;
+        }
+
+        while (active_count > 0) {
+            for (int slot = 0; slot < active_count; ) {
+                int k = active[slot];
+                traversal_state& st = states[k];
+                const ray& r = rays[group + k];
+                const bvh_node& node = nodes[st.current];
+                int next = -1;
+
+                if (node.box.hit(r.origin(), st.inv_dir, t_min, st.closest_so_far)) {
+                    if (node.count > 0) {
+                        if (hit_leaf(node, r, t_min, st.closest_so_far, recs[group + k]))
+                            hits[group + k] = true;
+                        if (st.stack_size > 0) next = st.stack[--st.stack_size];
+                    }
+                    else if (st.dir_neg[node.axis]) {
+                        st.stack[st.stack_size++] = st.current + 1;
+                        next = node.offset;
+                    }
+                    else {
+                        st.stack[st.stack_size++] = node.offset;
+                        next = st.current + 1;
+                    }
+                }
+                else if (st.stack_size > 0) {
+                    next = st.stack[--st.stack_size];
+                }
+
+                if (next < 0) {
+                    // ray finished, swap the last active ray into this slot
+                    active[slot] = active[--active_count];
+                    continue;
+                }
+
+                st.current = next;
+                prefetch(&nodes[next]);
+                slot++;
+            }
+        }
+    }
+}
+
+bool bvh::bounding_box(aabb& output_box) const {
+    if (nodes.empty()) return false;
+    output_box = nodes[0].box;
+    return true;
+}
+
+#endif
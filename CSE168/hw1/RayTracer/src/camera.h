@@ -0,0 +1,41 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include "rtweekend.h"
+
+// pinhole camera built from the scene file's "camera lookFrom lookAt up fovy" command
+class camera {
+public:
+    camera() : camera(point3(0, 0, 0), point3(0, 0, -1), vec3(0, 1, 0), 90, 1.0) {}
+
+    camera(point3 lookfrom, point3 lookat, vec3 vup, double vfov, double aspect_ratio) {
+        // fovy is the full vertical angle, so the viewport half-height at distance 1 is tan(fovy/2)
+        auto theta = degrees_to_radians(vfov);
+        auto h = tan(theta / 2);
+        auto viewport_height = 2.0 * h;
+        auto viewport_width = aspect_ratio * viewport_height;
+
+        // orthonormal basis: w points back toward the eye, u to the right, v up
+        auto w = unit_vector(lookfrom - lookat);
+        auto u = unit_vector(cross(vup, w));
+        auto v = cross(w, u);
+
+        origin = lookfrom;
+        horizontal = viewport_width * u;
+        vertical = viewport_height * v;
+        lower_left_corner = origin - horizontal / 2 - vertical / 2 - w;
+    }
+
+    // s and t are in [0,1] across the viewport, (0,0) is the lower left corner
+    ray get_ray(double s, double t) const {
+        return ray(origin, lower_left_corner + s * horizontal + t * vertical - origin);
+    }
+
+public:
+    point3 origin;
+    point3 lower_left_corner;
+    vec3 horizontal;
+    vec3 vertical;
+};
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "rtweekend.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Everything a progressive render needs to carry on where it stopped. The sampler is counter based,
+// so a tile's sample count is also its position in the sample sequence and there is no other RNG
+// state to save. The settings that decide which samples get taken are stored too; a checkpoint is
+// only resumed under the same ones, which is what makes the result identical to an uninterrupted run.
+// The file is raw native-endian binary: an 8 byte magic, the settings, then the arrays each prefixed
+// by their length.
+struct render_checkpoint {
+    // settings, which have to match to resume
+    uint64_t scene_hash = 0;
+    int32_t width = 0, height = 0, tile_size = 0;
+    // the pixels being rendered (scene::render_region), which the tiles cover
+    int32_t region_x0 = 0, region_y0 = 0, region_x1 = 0, region_y1 = 0;
+    int32_t min_samples = 0, max_samples = 0;
+    double target_noise = 0;
+    int32_t sampling = 0;
+    uint32_t seed = 0;
+
+    // per tile, in row-major tile order
+    std::vector<int32_t> tile_samples;
+    std::vector<double> tile_error;
+    // per pixel running sums, five to a pixel: r, g, b, luminance, luminance squared
+    std::vector<double> sums;
+
+    bool same_settings(const render_checkpoint& o) const;
+    // writes path + ".tmp" and renames it over path, so a render killed mid write still leaves the
+    // previous checkpoint behind
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+};
+
+static const char checkpoint_magic[8] = { 'R', 'T', 'C', 'K', 'P', 'T', '0', '2' };
+
+template <class T>
+void write_pod(std::ostream& out, const T& v) {
+    out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template <class T>
+void read_pod(std::istream& in, T& v) {
+    in.read(reinterpret_cast<char*>(&v), sizeof(T));
+}
+
+template <class T>
+void write_array(std::ostream& out, const std::vector<T>& v) {
+    write_pod(out, static_cast<uint64_t>(v.size()));
+    out.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+}
+
+// fails (sets the stream's failbit) rather than allocating if the stored length is over max_size
+template <class T>
+void read_array(std::istream& in, std::vector<T>& v, size_t max_size) {
+    uint64_t n = 0;
+    read_pod(in, n);
+    if (!in || n > max_size) {
+        in.setstate(std::ios::failbit);
+        return;
+    }
+    v.resize(static_cast<size_t>(n));
+    in.read(reinterpret_cast<char*>(v.data()), v.size() * sizeof(T));
+}
+
+bool render_checkpoint::same_settings(const render_checkpoint& o) const {
+    return scene_hash == o.scene_hash && width == o.width && height == o.height && tile_size == o.tile_size
+        && region_x0 == o.region_x0 && region_y0 == o.region_y0 && region_x1 == o.region_x1 && region_y1 == o.region_y1
+        && min_samples == o.min_samples && max_samples == o.max_samples && target_noise == o.target_noise
+        && sampling == o.sampling && seed == o.seed;
+}
+
+bool render_checkpoint::save(const std::string& path) const {
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cerr << "Unable to write checkpoint " << tmp << "\n";
+            return false;
+        }
+        out.write(checkpoint_magic, sizeof(checkpoint_magic));
+        write_pod(out, scene_hash);
+        write_pod(out, width);
+        write_pod(out, height);
+        write_pod(out, tile_size);
+        write_pod(out, region_x0);
+        write_pod(out, region_y0);
+        write_pod(out, region_x1);
+        write_pod(out, region_y1);
+        write_pod(out, min_samples);
+        write_pod(out, max_samples);
+        write_pod(out, target_noise);
+        write_pod(out, sampling);
+        write_pod(out, seed);
+        write_array(out, tile_samples);
+        write_array(out, tile_error);
+        write_array(out, sums);
+        out.flush();
+        if (!out) {
+            std::cerr << "Unable to write checkpoint " << tmp << "\n";
+            return false;
+        }
+    }
+    // rename won't replace an existing file on Windows
+    std::remove(path.c_str());
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cerr << "Unable to move checkpoint to " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool render_checkpoint::load(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Unable to open checkpoint " << path << "\n";
+        return false;
+    }
+    char magic[sizeof(checkpoint_magic)] = {};
+    in.read(magic, sizeof(magic));
+    if (!in || memcmp(magic, checkpoint_magic, sizeof(magic)) != 0) {
+        std::cerr << path << " is not a checkpoint\n";
+        return false;
+    }
+    read_pod(in, scene_hash);
+    read_pod(in, width);
+    read_pod(in, height);
+    read_pod(in, tile_size);
+    read_pod(in, region_x0);
+    read_pod(in, region_y0);
+    read_pod(in, region_x1);
+    read_pod(in, region_y1);
+    read_pod(in, min_samples);
+    read_pod(in, max_samples);
+    read_pod(in, target_noise);
+    read_pod(in, sampling);
+    read_pod(in, seed);
+    if (!in || width <= 0 || height <= 0 || tile_size <= 0 || region_x0 < 0 || region_y0 < 0
+        || region_x1 > width || region_y1 > height || region_x1 <= region_x0 || region_y1 <= region_y0) {
+        std::cerr << "Checkpoint " << path << " is truncated or corrupt\n";
+        return false;
+    }
+
+    size_t pixels = size_t(width) * height;
+    int region_width = region_x1 - region_x0, region_height = region_y1 - region_y0;
+    size_t tiles = size_t((region_width + tile_size - 1) / tile_size) * ((region_height + tile_size - 1) / tile_size);
+    read_array(in, tile_samples, tiles);
+    read_array(in, tile_error, tiles);
+    read_array(in, sums, pixels * 5);
+    if (!in || tile_samples.size() != tiles || tile_error.size() != tiles || sums.size() != pixels * 5) {
+        std::cerr << "Checkpoint " << path << " is truncated or corrupt\n";
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -1,16 +1,18 @@
 #ifndef COLOR_H
 #define COLOR_H
 
-#include "Vec3.h"
+#include "vec3.h"
+#include "rtweekend.h"
 #include "FreeImage.h"
 
 #include <iostream>
 
 void write_color(std::ostream& out, color pixel_color, RGBQUAD *color) {
     // Write the translated [0,255] value of each color component.
-    color->rgbRed = pixel_color.x() *255.999;
-    color->rgbGreen = pixel_color.y() * 255.999;
-    color->rgbBlue = pixel_color.z() * 255.999;
+    // lights add up past 1, so clamp instead of letting the byte wrap around
+    color->rgbRed = static_cast<BYTE>(255.999 * clamp(pixel_color.x(), 0.0, 1.0));
+    color->rgbGreen = static_cast<BYTE>(255.999 * clamp(pixel_color.y(), 0.0, 1.0));
+    color->rgbBlue = static_cast<BYTE>(255.999 * clamp(pixel_color.z(), 0.0, 1.0));
 
     // prints out color value
     //out << static_cast<int>(255.999 * pixel_color.x()) << ' '
@@ -0,0 +1,257 @@
+#ifndef COMPRESSED_BVH_H
+#define COMPRESSED_BVH_H
+
+#include "rtweekend.h"
+#include "bvh.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// 36 byte node holding both children's boxes, quantized to 8 bits in the node's own frame
+// (vs two 64 byte bvh_nodes, each with a double precision box)
+struct compressed_bvh_node {
+    // frame: child coordinate = origin + q * 2^exponent, per axis
+    float origin[3];
+    int8_t exponent[3];
+    // bits 0-1: split axis, bits 2-3: child 0/1 present
+    uint8_t meta;
+    uint8_t lo[2][3];
+    uint8_t hi[2][3];
+    // (offset << 3) | count. count 0: offset is a node index. count 1-7: a leaf, offset is into prim_refs
+    uint32_t child[2];
+};
+
+// read-only, more compact copy of a built bvh
+// child boxes are rounded outward when quantized, so traversal visits a superset of the nodes the
+// full precision bvh would and finds exactly the same hits
+class compressed_bvh : public hittable {
+public:
+    compressed_bvh() {}
+    compressed_bvh(const bvh& source);
+
+    virtual bool hit(
+        const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
+
+    size_t memory_bytes() const {
+        return nodes.size() * sizeof(compressed_bvh_node) + prim_refs.size() * sizeof(uint32_t);
+    }
+
+    // 2^e straight from the exponent bits; ldexp is far too slow for the inner loop
+    static double pow2(int e) {
+        uint64_t bits = static_cast<uint64_t>(e + 1023) << 52;
+        double d;
+        std::memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+
+    static aabb child_box(const compressed_bvh_node& node, int c) {
+        aabb box;
+        for (int a = 0; a < 3; a++) {
+            double scale = pow2(node.exponent[a]);
+            box.minimum[a] = double(node.origin[a]) + node.lo[c][a] * scale;
+            box.maximum[a] = double(node.origin[a]) + node.hi[c][a] * scale;
+        }
+        return box;
+    }
+
+public:
+    std::vector<shared_ptr<hittable>> objects;
+    std::vector<uint32_t> prim_refs;
+    std::vector<compressed_bvh_node> nodes;
+    aabb root_box;
+    // deepest child below the root, counting the nodes split leaves add; traversal pushes at most
+    // one entry per level, so this is as deep as its stack gets
+    int max_depth = 0;
+
+private:
+    static const int max_leaf_count = 7;
+    // hit keeps its stack here unless max_depth needs more, then in a per-thread vector
+    static const int fixed_stack_size = 64;
+
+    uint32_t add_child(const bvh& source, int index, int depth);
+    uint32_t add_leaf(const bvh& source, const aabb& box, int first, int count, int depth);
+    int add_node(const aabb& frame, const aabb boxes[2], int axis);
+};
+
+compressed_bvh::compressed_bvh(const bvh& source) : objects(source.objects) {
+    if (source.nodes.empty()) return;
+
+    root_box = source.nodes[0].box;
+    nodes.reserve(source.nodes.size() / 2 + 1);
+    prim_refs.reserve(source.prim_refs.size());
+
+    // the root is always a compressed node; a single-leaf bvh becomes a node with one child
+    const bvh_node& root = source.nodes[0];
+    if (root.count > 0) {
+        aabb boxes[2] = { root.box, aabb() };
+        int index = add_node(root.box, boxes, 0);
+        nodes[index].meta &= ~(1 << 3);
+        nodes[index].child[0] = add_leaf(source, root.box, root.offset, root.count, 1);
+    }
+    else {
+        add_child(source, 0, 0);
+    }
+}
+
+// quantizes the two child boxes into frame, rounding outward
+int compressed_bvh::add_node(const aabb& frame, const aabb boxes[2], int axis) {
+    compressed_bvh_node node = {};
+    node.meta = static_cast<uint8_t>(axis | (1 << 2) | (1 << 3));
+
+    for (int a = 0; a < 3; a++) {
+        float origin = static_cast<float>(frame.minimum[a]);
+        if (origin > frame.minimum[a]) origin = nextafterf(origin, -INFINITY);
+        node.origin[a] = origin;
+
+        // smallest power of two step that covers the frame in 255 steps
+        double extent = frame.maximum[a] - double(origin);
+        int e = extent > 0 ? static_cast<int>(ceil(log2(extent / 255.0))) : -126;
+        e = std::max(-126, std::min(127, e));
+        while (e < 127 && double(origin) + 255 * pow2(e) < frame.maximum[a]) e++;
+        node.exponent[a] = static_cast<int8_t>(e);
+        double scale = pow2(e);
+
+        for (int c = 0; c < 2; c++) {
+            if (boxes[c].empty()) continue;
+            int lo = static_cast<int>(floor((boxes[c].minimum[a] - double(origin)) / scale));
+            int hi = static_cast<int>(ceil((boxes[c].maximum[a] - double(origin)) / scale));
+            lo = std::max(0, std::min(255, lo));
+            hi = std::max(0, std::min(255, hi));
+            // guard against round-off in the divide: the decoded box must contain the real one
+            while (lo > 0 && double(origin) + lo * scale > boxes[c].minimum[a]) lo--;
+            while (hi < 255 && double(origin) + hi * scale < boxes[c].maximum[a]) hi++;
+            node.lo[c][a] = static_cast<uint8_t>(lo);
+            node.hi[c][a] = static_cast<uint8_t>(hi);
+        }
+    }
+
+    nodes.push_back(node);
+    return static_cast<int>(nodes.size()) - 1;
+}
+
+uint32_t compressed_bvh::add_child(const bvh& source, int index, int depth) {
+    max_depth = std::max(max_depth, depth);
+    const bvh_node& n = source.nodes[index];
+    if (n.count > 0)
+        return add_leaf(source, n.box, n.offset, n.count, depth);
+
+    aabb boxes[2] = { source.nodes[index + 1].box, source.nodes[n.offset].box };
+    int node = add_node(n.box, boxes, n.axis);
+    // nodes can move while the children are added, so index rather than hold a reference
+    uint32_t first = add_child(source, index + 1, depth + 1);
+    nodes[node].child[0] = first;
+    uint32_t second = add_child(source, n.offset, depth + 1);
+    nodes[node].child[1] = second;
+    return static_cast<uint32_t>(node) << 3;
+}
+
+// leaves hold at most 7 primitives; bigger ones (degenerate input) get split in half under
+// extra nodes with the same box. bvh stops splitting at depth 60 whatever the leaf holds, so
+// these levels can take the tree past that
+uint32_t compressed_bvh::add_leaf(const bvh& source, const aabb& box, int first, int count, int depth) {
+    max_depth = std::max(max_depth, depth);
+    if (count <= max_leaf_count) {
+        uint32_t offset = static_cast<uint32_t>(prim_refs.size());
+        for (int i = first; i < first + count; i++)
+            prim_refs.push_back(static_cast<uint32_t>(source.prim_refs[i]));
+        return (offset << 3) | static_cast<uint32_t>(count);
+    }
+
+    aabb boxes[2] = { box, box };
+    int node = add_node(box, boxes, 0);
+    int half = count / 2;
+    uint32_t left = add_leaf(source, box, first, half, depth + 1);
+    nodes[node].child[0] = left;
+    uint32_t right = add_leaf(source, box, first + half, count - half, depth + 1);
+    nodes[node].child[1] = right;
+    return static_cast<uint32_t>(node) << 3;
+}
+
+bool compressed_bvh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    if (nodes.empty()) return false;
+
+    vec3 d = r.direction();
+    vec3 inv_dir(1.0 / d.x(), 1.0 / d.y(), 1.0 / d.z());
+    bool dir_neg[3] = { inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0 };
+    point3 ray_origin = r.origin();
+
+    if (!root_box.hit(ray_origin, inv_dir, t_min, t_max)) return false;
+
+    hit_record temp_rec;
+    bool hit_anything = false;
+    auto closest_so_far = t_max;
+
+    uint32_t fixed_stack[fixed_stack_size];
+    uint32_t* stack = fixed_stack;
+    if (max_depth > fixed_stack_size) {
+        // one per thread, grown to the deepest tree it has traced, so rays don't allocate
+        static thread_local std::vector<uint32_t> deep_stack;
+        if (static_cast<int>(deep_stack.size()) < max_depth) deep_stack.resize(max_depth);
+        stack = deep_stack.data();
+    }
+    int stack_size = 0;
+    uint32_t current = 0;
+
+    while (true) {
+        uint32_t count = current & 7;
+        if (count > 0) {
+            uint32_t offset = current >> 3;
+            for (uint32_t i = offset; i < offset + count; i++) {
+                if (objects[prim_refs[i]]->hit(r, t_min, closest_so_far, temp_rec)) {
+                    hit_anything = true;
+                    closest_so_far = temp_rec.t;
+                    rec = temp_rec;
+                }
+            }
+        }
+        else {
+            const compressed_bvh_node& node = nodes[current >> 3];
+
+            // slab test against both children at once, decoding each plane exactly as child_box does
+            double t_near[2] = { t_min, t_min };
+            double t_far[2] = { closest_so_far, closest_so_far };
+            for (int a = 0; a < 3; a++) {
+                double origin = node.origin[a];
+                double scale = pow2(node.exponent[a]);
+                for (int c = 0; c < 2; c++) {
+                    double t0 = (origin + node.lo[c][a] * scale - ray_origin[a]) * inv_dir[a];
+                    double t1 = (origin + node.hi[c][a] * scale - ray_origin[a]) * inv_dir[a];
+                    if (dir_neg[a]) std::swap(t0, t1);
+                    t_near[c] = t0 > t_near[c] ? t0 : t_near[c];
+                    t_far[c] = t1 < t_far[c] ? t1 : t_far[c];
+                }
+            }
+            bool hit_child[2] = {
+                (node.meta & (1 << 2)) && t_near[0] <= t_far[0],
+                (node.meta & (1 << 3)) && t_near[1] <= t_far[1] };
+
+            // same near-first order as bvh::hit
+            int near = dir_neg[node.meta & 3] ? 1 : 0;
+            int far = 1 - near;
+            if (hit_child[near] && hit_child[far]) {
+                stack[stack_size++] = node.child[far];
+                current = node.child[near];
+                continue;
+            }
+            if (hit_child[near] || hit_child[far]) {
+                current = node.child[hit_child[near] ? near : far];
+                continue;
+            }
+        }
+
+        if (stack_size == 0) break;
+        current = stack[--stack_size];
+    }
+
+    return hit_anything;
+}
+
+bool compressed_bvh::bounding_box(aabb& output_box) const {
+    if (nodes.empty()) return false;
+    output_box = root_box;
+    return true;
+}
+
+#endif
@@ -0,0 +1,442 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// A small raw deflate (RFC 1951) encoder for the PNG writer: LZ77 over hash chains, then one
+// dynamic Huffman block per run of tokens (or a stored block when that comes out smaller). Every
+// call to deflate_chunk ends byte aligned after an empty stored block, like zlib's Z_SYNC_FLUSH,
+// so chunks compressed on different threads can simply be concatenated into one stream; each chunk
+// can still match into the 32K before it, which keeps the cost of splitting small (as pigz does).
+
+inline uint32_t adler32_update(uint32_t adler, const unsigned char* data, size_t n) {
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+    while (n > 0) {
+        // 5552 is the most bytes before b can overflow 32 bits
+        size_t block = n < 5552 ? n : 5552;
+        n -= block;
+        while (block--) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+// Adler-32 of two byte strings one after the other, from their own sums and the second one's
+// length (zlib's adler32_combine)
+inline uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, size_t len2) {
+    const uint32_t base = 65521;
+    uint32_t rem = static_cast<uint32_t>(len2 % base);
+    uint32_t sum1 = adler1 & 0xffff;
+    uint32_t sum2 = (rem * sum1) % base;
+    sum1 += (adler2 & 0xffff) + base - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + base - rem;
+    if (sum1 >= base) sum1 -= base;
+    if (sum1 >= base) sum1 -= base;
+    if (sum2 >= (base << 1)) sum2 -= (base << 1);
+    if (sum2 >= base) sum2 -= base;
+    return sum1 | (sum2 << 16);
+}
+
+// deflate packs bits least significant first; Huffman codes go in most significant bit first,
+// so they're stored reversed
+class bit_writer {
+public:
+    bit_writer(std::vector<unsigned char>& o) : out(o) {}
+
+    void put(uint32_t v, int n) {
+        bits |= uint64_t(v) << count;
+        count += n;
+        while (count >= 8) {
+            out.push_back(static_cast<unsigned char>(bits));
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+
+    void align() {
+        if (count > 0) put(0, 8 - count);
+    }
+
+    // only on a byte boundary
+    void bytes(const unsigned char* data, size_t n) {
+        out.insert(out.end(), data, data + n);
+    }
+
+private:
+    std::vector<unsigned char>& out;
+    uint64_t bits = 0;
+    int count = 0;
+};
+
+struct deflate_tables {
+    static const int max_match = 258;
+    static const int window = 32768;
+
+    uint16_t length_base[29];
+    uint8_t length_extra[29];
+    uint16_t dist_base[30];
+    uint8_t dist_extra[30];
+    // length code (0-28, add 257 for the symbol) of every match length
+    uint8_t length_code[max_match + 1];
+
+    deflate_tables() {
+        static const uint8_t lx[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+        static const uint8_t dx[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+        int base = 3;
+        for (int c = 0; c < 29; c++) {
+            length_extra[c] = lx[c];
+            length_base[c] = static_cast<uint16_t>(base);
+            base += 1 << lx[c];
+        }
+        // 258 has a code of its own rather than being the end of code 27's range
+        length_base[28] = 258;
+        base = 1;
+        for (int c = 0; c < 30; c++) {
+            dist_extra[c] = dx[c];
+            dist_base[c] = static_cast<uint16_t>(base);
+            base += 1 << dx[c];
+        }
+        for (int c = 0; c < 28; c++)
+            for (int l = length_base[c]; l < length_base[c] + (1 << length_extra[c]); l++)
+                length_code[l] = static_cast<uint8_t>(c);
+        length_code[258] = 28;
+    }
+
+    int dist_code(int dist) const {
+        return static_cast<int>(std::upper_bound(dist_base, dist_base + 30, dist) - dist_base) - 1;
+    }
+
+    static const deflate_tables& get() {
+        static const deflate_tables tables;
+        return tables;
+    }
+};
+
+// Huffman code lengths for freq[0, n), none longer than max_bits; unused symbols get 0. Lengths
+// come from the usual tree, then any over the limit are pulled in and the shortest codes lengthened
+// until the Kraft sum fits again (the same fix-up miniz uses).
+inline void huffman_lengths(const uint32_t* freq, int n, int max_bits, uint8_t* lengths) {
+    std::fill(lengths, lengths + n, 0);
+    std::vector<int> syms;
+    for (int s = 0; s < n; s++)
+        if (freq[s]) syms.push_back(s);
+    const int m = static_cast<int>(syms.size());
+    if (m == 0) return;
+    if (m == 1) {
+        lengths[syms[0]] = 1;
+        return;
+    }
+    std::sort(syms.begin(), syms.end(), [&](int a, int b) { return freq[a] < freq[b] || (freq[a] == freq[b] && a < b); });
+
+    // two-queue construction: leaves are already sorted, and merged nodes come out in order
+    std::vector<uint64_t> weight(2 * m - 1);
+    std::vector<int> parent(2 * m - 1, 0), depth(2 * m - 1, 0);
+    for (int i = 0; i < m; i++) weight[i] = freq[syms[i]];
+    int leaf = 0, inner = m;
+    for (int next = m; next < 2 * m - 1; next++) {
+        int pick[2];
+        for (int k = 0; k < 2; k++) {
+            if (leaf < m && (inner >= next || weight[leaf] <= weight[inner])) pick[k] = leaf++;
+            else pick[k] = inner++;
+        }
+        weight[next] = weight[pick[0]] + weight[pick[1]];
+        parent[pick[0]] = parent[pick[1]] = next;
+    }
+    for (int k = 2 * m - 3; k >= 0; k--) depth[k] = depth[parent[k]] + 1;
+
+    int count[64] = {};
+    for (int i = 0; i < m; i++) count[std::min(depth[i], max_bits)]++;
+    uint32_t kraft = 0;
+    for (int l = max_bits; l > 0; l--) kraft += uint32_t(count[l]) << (max_bits - l);
+    while (kraft != (1u << max_bits)) {
+        count[max_bits]--;
+        for (int l = max_bits - 1; l > 0; l--) {
+            if (count[l]) {
+                count[l]--;
+                count[l + 1] += 2;
+                break;
+            }
+        }
+        kraft--;
+    }
+
+    // rarest symbols get the longest codes
+    int i = 0;
+    for (int l = max_bits; l > 0; l--)
+        for (int k = 0; k < count[l]; k++) lengths[syms[i++]] = static_cast<uint8_t>(l);
+}
+
+// canonical codes for the lengths, bit reversed ready for bit_writer
+inline void huffman_codes(const uint8_t* lengths, int n, uint16_t* codes) {
+    int count[16] = {}, next[16] = {};
+    for (int s = 0; s < n; s++) count[lengths[s]]++;
+    count[0] = 0;
+    for (int l = 1, code = 0; l < 16; l++) {
+        code = (code + count[l - 1]) << 1;
+        next[l] = code;
+    }
+    for (int s = 0; s < n; s++) {
+        int l = lengths[s];
+        if (!l) continue;
+        uint32_t code = next[l]++, reversed = 0;
+        for (int b = 0; b < l; b++) reversed |= ((code >> b) & 1) << (l - 1 - b);
+        codes[s] = static_cast<uint16_t>(reversed);
+    }
+}
+
+// a literal (dist 0, value in length) or a match
+struct deflate_token {
+    uint16_t length;
+    uint16_t dist;
+};
+
+inline void deflate_stored(const unsigned char* data, size_t size, bit_writer& bw) {
+    do {
+        size_t n = std::min<size_t>(size, 65535);
+        // not final, type 00, then LEN and its complement on a byte boundary
+        bw.put(0, 3);
+        bw.align();
+        bw.put(static_cast<uint32_t>(n), 16);
+        bw.put(static_cast<uint32_t>(~n & 0xffff), 16);
+        bw.bytes(data, n);
+        data += n;
+        size -= n;
+    } while (size > 0);
+}
+
+// an empty stored block, which leaves the stream byte aligned like zlib's Z_SYNC_FLUSH
+inline void deflate_sync_flush(bit_writer& bw) {
+    bw.put(0, 3);
+    bw.align();
+    bw.put(0, 16);
+    bw.put(0xffff, 16);
+}
+
+// one dynamic Huffman block for tokens, or stored blocks for the raw bytes they cover if that's
+// smaller
+inline void deflate_block(const std::vector<deflate_token>& tokens, const unsigned char* raw, size_t raw_size, bit_writer& bw) {
+    const deflate_tables& t = deflate_tables::get();
+    uint32_t lit_freq[286] = {}, dist_freq[30] = {};
+    for (const deflate_token& k : tokens) {
+        if (k.dist == 0) lit_freq[k.length]++;
+        else {
+            lit_freq[257 + t.length_code[k.length]]++;
+            dist_freq[t.dist_code(k.dist)]++;
+        }
+    }
+    lit_freq[256] = 1;
+    // some decoders want at least one distance code even with no matches
+    bool any_dist = false;
+    for (uint32_t f : dist_freq) any_dist = any_dist || f;
+    if (!any_dist) dist_freq[0] = 1;
+
+    uint8_t lit_len[286], dist_len[30];
+    uint16_t lit_code[286], dist_code[30];
+    huffman_lengths(lit_freq, 286, 15, lit_len);
+    huffman_lengths(dist_freq, 30, 15, dist_len);
+    huffman_codes(lit_len, 286, lit_code);
+    huffman_codes(dist_len, 30, dist_code);
+
+    int hlit = 286, hdist = 30;
+    while (hlit > 257 && !lit_len[hlit - 1]) hlit--;
+    while (hdist > 1 && !dist_len[hdist - 1]) hdist--;
+
+    // both length lists run together, then run-length coded with symbols 16-18
+    std::vector<uint8_t> all(lit_len, lit_len + hlit);
+    all.insert(all.end(), dist_len, dist_len + hdist);
+    std::vector<uint8_t> cl_sym, cl_extra;
+    uint32_t cl_freq[19] = {};
+    auto emit = [&](int sym, int extra) {
+        cl_sym.push_back(static_cast<uint8_t>(sym));
+        cl_extra.push_back(static_cast<uint8_t>(extra));
+        cl_freq[sym]++;
+    };
+    for (size_t i = 0; i < all.size();) {
+        int l = all[i];
+        size_t run = 1;
+        while (i + run < all.size() && all[i + run] == l) run++;
+        i += run;
+        if (l == 0) {
+            while (run >= 11) {
+                size_t r = std::min<size_t>(run, 138);
+                emit(18, static_cast<int>(r - 11));
+                run -= r;
+            }
+            if (run >= 3) {
+                emit(17, static_cast<int>(run - 3));
+                run = 0;
+            }
+        }
+        else {
+            emit(l, 0);
+            run--;
+            while (run >= 3) {
+                size_t r = std::min<size_t>(run, 6);
+                emit(16, static_cast<int>(r - 3));
+                run -= r;
+            }
+        }
+        while (run--) emit(l, 0);
+    }
+
+    static const uint8_t cl_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    static const uint8_t cl_extra_bits[19] = { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,2,3,7 };
+    uint8_t cl_len[19];
+    uint16_t cl_code[19];
+    huffman_lengths(cl_freq, 19, 7, cl_len);
+    huffman_codes(cl_len, 19, cl_code);
+    int hclen = 19;
+    while (hclen > 4 && !cl_len[cl_order[hclen - 1]]) hclen--;
+
+    uint64_t bits = 3 + 5 + 5 + 4 + 3 * hclen;
+    for (size_t i = 0; i < cl_sym.size(); i++) bits += cl_len[cl_sym[i]] + cl_extra_bits[cl_sym[i]];
+    for (const deflate_token& k : tokens) {
+        if (k.dist == 0) bits += lit_len[k.length];
+        else {
+            int lc = t.length_code[k.length], dc = t.dist_code(k.dist);
+            bits += lit_len[257 + lc] + t.length_extra[lc] + dist_len[dc] + t.dist_extra[dc];
+        }
+    }
+    bits += lit_len[256];
+    uint64_t stored_bits = (raw_size / 65535 + 1) * 40 + 8 * uint64_t(raw_size);
+    if (stored_bits < bits) {
+        deflate_stored(raw, raw_size, bw);
+        return;
+    }
+
+    // not final, type 10 (dynamic)
+    bw.put(0, 1);
+    bw.put(2, 2);
+    bw.put(hlit - 257, 5);
+    bw.put(hdist - 1, 5);
+    bw.put(hclen - 4, 4);
+    for (int i = 0; i < hclen; i++) bw.put(cl_len[cl_order[i]], 3);
+    for (size_t i = 0; i < cl_sym.size(); i++) {
+        bw.put(cl_code[cl_sym[i]], cl_len[cl_sym[i]]);
+        if (cl_extra_bits[cl_sym[i]]) bw.put(cl_extra[i], cl_extra_bits[cl_sym[i]]);
+    }
+    for (const deflate_token& k : tokens) {
+        if (k.dist == 0) bw.put(lit_code[k.length], lit_len[k.length]);
+        else {
+            int lc = t.length_code[k.length], dc = t.dist_code(k.dist);
+            bw.put(lit_code[257 + lc], lit_len[257 + lc]);
+            if (t.length_extra[lc]) bw.put(k.length - t.length_base[lc], t.length_extra[lc]);
+            bw.put(dist_code[dc], dist_len[dc]);
+            if (t.dist_extra[dc]) bw.put(k.dist - t.dist_base[dc], t.dist_extra[dc]);
+        }
+    }
+    bw.put(lit_code[256], lit_len[256]);
+}
+
+// Appends data[0, size) to out as deflate blocks, none of them final, ending with an empty stored
+// block so the output is byte aligned. Matches may reach back into the dict_size bytes before data
+// (the end of the previous chunk; at most the 32K window is used). level is 0 (stored) to 9
+// (longest hash chains and lazy matching).
+inline void deflate_chunk(const unsigned char* data, size_t size, size_t dict_size, int level, std::vector<unsigned char>& out) {
+    bit_writer bw(out);
+    level = std::max(0, std::min(9, level));
+    if (level == 0) {
+        if (size > 0) deflate_stored(data, size, bw);
+        deflate_sync_flush(bw);
+        return;
+    }
+
+    // zlib's settings per level: stop searching at a match of nice, only look one byte further for
+    // a better match below max_lazy (levels 4 and up), and search a quarter of the chain for that
+    // once the current match is good; the fast levels use max_lazy to skip inserting the inside of
+    // long matches instead
+    static const int max_chain[10] = { 0, 4, 8, 32, 16, 32, 128, 256, 1024, 4096 };
+    static const int nice_length[10] = { 0, 8, 16, 32, 16, 32, 128, 128, 258, 258 };
+    static const int max_lazy[10] = { 0, 4, 5, 6, 4, 16, 16, 32, 128, 258 };
+    static const int good_length[10] = { 0, 4, 4, 4, 4, 8, 8, 8, 32, 32 };
+    const int chain_limit = max_chain[level], nice = nice_length[level];
+    const bool lazy = level >= 4;
+    const int hash_bits = 15;
+    const int window = deflate_tables::window, max_match = deflate_tables::max_match;
+
+    dict_size = std::min<size_t>(dict_size, window);
+    const unsigned char* buf = data - dict_size;
+    const size_t total = dict_size + size;
+    std::vector<int32_t> head(size_t(1) << hash_bits, -1), prev(total, -1);
+    auto hash = [&](size_t p) {
+        uint32_t v = buf[p] | (uint32_t(buf[p + 1]) << 8) | (uint32_t(buf[p + 2]) << 16);
+        return (v * 2654435761u) >> (32 - hash_bits);
+    };
+    auto insert = [&](size_t p) {
+        if (p + 2 >= total) return;
+        uint32_t h = hash(p);
+        prev[p] = head[h];
+        head[h] = static_cast<int32_t>(p);
+    };
+    // longest match for p among the positions already inserted; returns the length (0 if under 3)
+    auto longest_match = [&](size_t p, int& dist, int chain) {
+        int best = 0;
+        if (p + 2 >= total) return 0;
+        const int limit = static_cast<int>(std::min<size_t>(max_match, total - p));
+        for (int32_t c = head[hash(p)]; c >= 0 && p - c <= size_t(window) && chain-- > 0; c = prev[c]) {
+            if (best >= limit) break;
+            if (buf[c + best] != buf[p + best]) continue;
+            int len = 0;
+            while (len < limit && buf[c + len] == buf[p + len]) len++;
+            if (len > best) {
+                best = len;
+                dist = static_cast<int>(p - c);
+                if (len >= nice) break;
+            }
+        }
+        return best >= 3 ? best : 0;
+    };
+
+    for (size_t p = 0; p < dict_size; p++) insert(p);
+
+    const size_t block_tokens = 1 << 15;
+    std::vector<deflate_token> tokens;
+    tokens.reserve(block_tokens + 1);
+    size_t block_start = dict_size;
+    size_t p = dict_size;
+    int len = 0, dist = 0;
+    bool have_match = false;
+    while (p < total) {
+        if (!have_match) len = longest_match(p, dist, chain_limit);
+        have_match = false;
+        insert(p);
+        if (lazy && len >= 3 && len < max_lazy[level] && p + 1 < total) {
+            // a longer match one byte on is worth a literal here
+            int next_dist = 0;
+            int next_len = longest_match(p + 1, next_dist, len >= good_length[level] ? chain_limit / 4 : chain_limit);
+            if (next_len > len) {
+                tokens.push_back({ buf[p], 0 });
+                p++;
+                len = next_len;
+                dist = next_dist;
+                have_match = true;
+                continue;
+            }
+        }
+        if (len >= 3) {
+            tokens.push_back({ static_cast<uint16_t>(len), static_cast<uint16_t>(dist) });
+            if (lazy || len <= max_lazy[level])
+                for (int k = 1; k < len; k++) insert(p + k);
+            p += len;
+        }
+        else {
+            tokens.push_back({ buf[p], 0 });
+            p++;
+        }
+        if (tokens.size() >= block_tokens) {
+            deflate_block(tokens, buf + block_start, p - block_start, bw);
+            tokens.clear();
+            block_start = p;
+        }
+    }
+    if (!tokens.empty()) deflate_block(tokens, buf + block_start, p - block_start, bw);
+    deflate_sync_flush(bw);
+}
+
+#endif
@@ -0,0 +1,290 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "scene.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <csignal>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Hands out the tiles of an image to workers and keeps track of which are done. Each worker has
+// at most one tile at a time. A worker that goes away gives its tile back to the queue; once the
+// queue is empty, a tile that has been out for much longer than tiles usually take is handed to an
+// idle worker as well, and whichever copy finishes first counts. That covers a worker that hangs
+// or is just slow without having to tell the two apart.
+class tile_scheduler {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    tile_scheduler(const pixel_rect& region, int tile_size);
+
+    // the tile worker should render next, or -1 if there's nothing for it right now
+    int assign(int worker, clock::time_point now);
+    // true if this is the first result for tile (later copies are dropped)
+    bool complete(int worker, int tile, clock::time_point now);
+    // worker is gone; a tile it had goes back in the queue unless another copy is out
+    void lose(int worker);
+
+    bool done() const { return finished == static_cast<int>(tiles.size()); }
+
+    std::vector<pixel_rect> tiles;
+    // tiles handed out again after their worker went away or ran over time
+    int requeued = 0, duplicated = 0;
+
+private:
+    struct tile_state {
+        bool done = false;
+        // workers rendering it, and when the first of them got it
+        std::vector<int> workers;
+        clock::time_point sent;
+    };
+
+    bool overdue(const tile_state& t, clock::time_point now) const;
+
+    std::vector<tile_state> state;
+    std::deque<int> pending;
+    // the tile each worker has, -1 for none
+    std::vector<int> current;
+    int finished = 0;
+    // for what counts as overdue
+    double total_seconds = 0;
+    int timed = 0;
+};
+
+tile_scheduler::tile_scheduler(const pixel_rect& region, int tile_size) {
+    for (int y = region.y0; y < region.y1; y += tile_size) {
+        for (int x = region.x0; x < region.x1; x += tile_size) {
+            pixel_rect t;
+            t.x0 = x;
+            t.y0 = y;
+            t.x1 = std::min(region.x1, x + tile_size);
+            t.y1 = std::min(region.y1, y + tile_size);
+            tiles.push_back(t);
+        }
+    }
+    state.resize(tiles.size());
+    for (int i = 0; i < static_cast<int>(tiles.size()); i++) pending.push_back(i);
+}
+
+// four times the average so far, and at least two seconds so the first tiles (and a machine
+// that's busy with other things) don't look hung
+bool tile_scheduler::overdue(const tile_state& t, clock::time_point now) const {
+    double limit = std::max(2.0, timed > 0 ? 4 * total_seconds / timed : 0.0);
+    return std::chrono::duration<double>(now - t.sent).count() > limit;
+}
+
+int tile_scheduler::assign(int worker, clock::time_point now) {
+    if (worker >= static_cast<int>(current.size())) current.resize(worker + 1, -1);
+    if (current[worker] >= 0) return -1;
+
+    int tile = -1;
+    while (!pending.empty() && tile < 0) {
+        int next = pending.front();
+        pending.pop_front();
+        if (!state[next].done) tile = next;
+    }
+    if (tile < 0) {
+        // nothing queued: back up the tile that's been out the longest, if it's overdue
+        clock::time_point oldest = now;
+        for (int i = 0; i < static_cast<int>(state.size()); i++) {
+            const tile_state& t = state[i];
+            if (!t.done && !t.workers.empty() && t.workers.size() < 2 && t.sent <= oldest && overdue(t, now)) {
+                oldest = t.sent;
+                tile = i;
+            }
+        }
+        if (tile < 0) return -1;
+        duplicated++;
+    }
+    else state[tile].sent = now;
+
+    state[tile].workers.push_back(worker);
+    current[worker] = tile;
+    return tile;
+}
+
+bool tile_scheduler::complete(int worker, int tile, clock::time_point now) {
+    if (worker < static_cast<int>(current.size()) && current[worker] == tile) current[worker] = -1;
+    if (tile < 0 || tile >= static_cast<int>(state.size())) return false;
+    tile_state& t = state[tile];
+    t.workers.erase(std::remove(t.workers.begin(), t.workers.end(), worker), t.workers.end());
+    if (t.done) return false;
+    t.done = true;
+    finished++;
+    total_seconds += std::chrono::duration<double>(now - t.sent).count();
+    timed++;
+    return true;
+}
+
+void tile_scheduler::lose(int worker) {
+    if (worker >= static_cast<int>(current.size()) || current[worker] < 0) return;
+    tile_state& t = state[current[worker]];
+    t.workers.erase(std::remove(t.workers.begin(), t.workers.end(), worker), t.workers.end());
+    if (!t.done && t.workers.empty()) {
+        pending.push_front(current[worker]);
+        requeued++;
+    }
+    current[worker] = -1;
+}
+
+#ifndef _WIN32
+
+// "host:port" (host being localhost or an IPv4 address) is TCP, anything else a Unix socket path
+inline bool is_tcp_address(const std::string& address, std::string& host, int& port) {
+    size_t colon = address.find_last_of(':');
+    if (colon == std::string::npos || colon + 1 == address.size()) return false;
+    for (size_t i = colon + 1; i < address.size(); i++)
+        if (address[i] < '0' || address[i] > '9') return false;
+    host = address.substr(0, colon);
+    if (host.empty() || host == "localhost") host = "127.0.0.1";
+    port = atoi(address.c_str() + colon + 1);
+    return true;
+}
+
+// a socket listening on address, -1 (with a message) if it can't; an old Unix socket file is replaced
+inline int listen_on(const std::string& address) {
+    std::string host;
+    int port;
+    int fd = -1;
+    if (is_tcp_address(address, host, port)) {
+        sockaddr_in in = {};
+        in.sin_family = AF_INET;
+        in.sin_port = htons(static_cast<uint16_t>(port));
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int yes = 1;
+        if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if (fd < 0 || inet_pton(AF_INET, host.c_str(), &in.sin_addr) != 1 || bind(fd, reinterpret_cast<sockaddr*>(&in), sizeof(in)) != 0) {
+            if (fd >= 0) close(fd);
+            fd = -1;
+        }
+    }
+    else {
+        sockaddr_un un = {};
+        un.sun_family = AF_UNIX;
+        if (address.size() < sizeof(un.sun_path)) {
+            address.copy(un.sun_path, address.size());
+            struct stat info;
+            if (stat(address.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) unlink(address.c_str());
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd >= 0 && bind(fd, reinterpret_cast<sockaddr*>(&un), sizeof(un)) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
+    if (fd >= 0 && listen(fd, 64) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) std::cerr << "Unable to listen on " << address << "\n";
+    return fd;
+}
+
+inline int connect_to(const std::string& address) {
+    std::string host;
+    int port;
+    int fd;
+    if (is_tcp_address(address, host, port)) {
+        sockaddr_in in = {};
+        in.sin_family = AF_INET;
+        in.sin_port = htons(static_cast<uint16_t>(port));
+        if (inet_pton(AF_INET, host.c_str(), &in.sin_addr) != 1) return -1;
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&in), sizeof(in)) == 0) return fd;
+    }
+    else {
+        sockaddr_un un = {};
+        un.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(un.sun_path)) return -1;
+        address.copy(un.sun_path, address.size());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&un), sizeof(un)) == 0) return fd;
+    }
+    if (fd >= 0) close(fd);
+    return -1;
+}
+
+// Messages on a coordinator or worker connection: a text line whose last field is the size of the
+// binary payload that follows it, often 0. Reads are buffered so a coordinator can poll many
+// connections and take whatever complete messages have arrived.
+class message_channel {
+public:
+    explicit message_channel(int socket_fd) : fd(socket_fd) {}
+    message_channel(const message_channel&) = delete;
+    message_channel& operator=(const message_channel&) = delete;
+    ~message_channel() { if (fd >= 0) close(fd); }
+
+    bool send(const std::string& header, const void* payload = nullptr, size_t size = 0) {
+        std::string line = header + " " + std::to_string(size) + "\n";
+        return write_all(line.data(), line.size()) && (size == 0 || write_all(payload, size));
+    }
+
+    // one read of whatever has arrived (blocks if nothing has); false once the other end is gone
+    bool fill() {
+        char buffer[1 << 16];
+        ssize_t got = read(fd, buffer, sizeof(buffer));
+        if (got <= 0) return false;
+        received.append(buffer, static_cast<size_t>(got));
+        return true;
+    }
+
+    // the next whole message if one has been received; header loses its payload size field
+    bool next(std::string& header, std::string& payload) {
+        size_t newline = received.find('\n');
+        if (newline == std::string::npos) return false;
+        size_t space = received.find_last_of(' ', newline);
+        if (space == std::string::npos) return false;
+        size_t size = static_cast<size_t>(strtoull(received.c_str() + space + 1, nullptr, 10));
+        if (received.size() < newline + 1 + size) return false;
+        header = received.substr(0, space);
+        payload = received.substr(newline + 1, size);
+        received.erase(0, newline + 1 + size);
+        return true;
+    }
+
+    // blocks until a whole message arrives; false if the connection closes first
+    bool receive(std::string& header, std::string& payload) {
+        while (!next(header, payload))
+            if (!fill()) return false;
+        return true;
+    }
+
+    int fd;
+
+private:
+    bool write_all(const void* data, size_t size) {
+        const char* p = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t n = write(fd, p, size);
+            if (n <= 0) return false;
+            p += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    std::string received;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "checkpoint.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Where each pixel's camera ray first hit the scene, kept between runs so a render that only
+// changes materials or lights can shade every pixel again without tracing its camera ray. Only
+// shadow and reflection rays are traced. The file is keyed by a hash of the geometry, the
+// material each primitive uses, the camera and the image size (see scene::gbuffer_key), so
+// anything that would move a first hit makes the cache miss instead of giving a wrong image.
+// Like checkpoints it's raw native-endian binary: a magic, the key and size, then the texels.
+class gbuffer {
+public:
+    struct texel {
+        // index into the scene's object list, or one of the values below
+        int32_t primitive = unknown;
+        int32_t mat_id = 0;
+        double t = 0;
+        // kept rather than recomputed so a re-shaded pixel is bit-identical to a traced one
+        point3 p;
+        vec3 normal;
+    };
+    // the camera ray hit nothing / hasn't been traced (outside an earlier run's crop)
+    static const int32_t miss = -1;
+    static const int32_t unknown = -2;
+
+    // objects is the scene's object list, which texel::primitive indexes
+    gbuffer(const std::vector<shared_ptr<hittable>>& objects, uint64_t key, int width, int height);
+
+    // false, leaving every texel unknown, if path is missing or was made for another scene
+    bool load(const std::string& path);
+    bool save(const std::string& path) const;
+
+    // the first hit of pixel's camera ray, if it's known; safe to call from any thread
+    bool lookup(size_t pixel, bool& hit, hit_record& rec) const;
+    // only one thread may record a given pixel
+    void record(size_t pixel, bool hit, const hit_record& rec);
+
+    bool known(size_t pixel) const { return texels[pixel].primitive != unknown; }
+
+private:
+    const std::vector<shared_ptr<hittable>>& objects;
+    std::unordered_map<const hittable*, int32_t> primitive_ids;
+    uint64_t key;
+    int32_t width, height;
+    std::vector<texel> texels;
+};
+
+static const char gbuffer_magic[8] = { 'R', 'T', 'G', 'B', 'U', 'F', '0', '1' };
+
+gbuffer::gbuffer(const std::vector<shared_ptr<hittable>>& list, uint64_t k, int w, int h)
+    : objects(list), key(k), width(w), height(h), texels(size_t(w) * h) {
+    for (size_t i = 0; i < objects.size(); i++)
+        primitive_ids[objects[i].get()] = static_cast<int32_t>(i);
+}
+
+bool gbuffer::load(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    char magic[sizeof(gbuffer_magic)] = {};
+    in.read(magic, sizeof(magic));
+    uint64_t file_key = 0;
+    int32_t file_width = 0, file_height = 0;
+    read_pod(in, file_key);
+    read_pod(in, file_width);
+    read_pod(in, file_height);
+    if (!in || memcmp(magic, gbuffer_magic, sizeof(magic)) != 0 || file_key != key || file_width != width || file_height != height)
+        return false;
+
+    std::vector<texel> stored;
+    read_array(in, stored, texels.size());
+    if (!in || stored.size() != texels.size()) {
+        std::cerr << "G-buffer " << path << " is truncated or corrupt\n";
+        return false;
+    }
+    // the key covers the primitive count, so this only catches a corrupt file
+    for (const texel& t : stored) {
+        if (t.primitive >= static_cast<int32_t>(objects.size()) || t.primitive < unknown) {
+            std::cerr << "G-buffer " << path << " is truncated or corrupt\n";
+            return false;
+        }
+    }
+    texels.swap(stored);
+    return true;
+}
+
+bool gbuffer::save(const std::string& path) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(gbuffer_magic, sizeof(gbuffer_magic));
+    write_pod(out, key);
+    write_pod(out, width);
+    write_pod(out, height);
+    write_array(out, texels);
+    out.flush();
+    if (!out) {
+        std::cerr << "Unable to write G-buffer " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool gbuffer::lookup(size_t pixel, bool& hit, hit_record& rec) const {
+    const texel& t = texels[pixel];
+    if (t.primitive == unknown) return false;
+    hit = t.primitive != miss;
+    if (hit) {
+        rec.t = t.t;
+        rec.p = t.p;
+        rec.normal = t.normal;
+        rec.mat_id = t.mat_id;
+        rec.object = objects[t.primitive].get();
+    }
+    return true;
+}
+
+void gbuffer::record(size_t pixel, bool hit, const hit_record& rec) {
+    texel& t = texels[pixel];
+    t.primitive = miss;
+    if (!hit) return;
+    auto id = primitive_ids.find(rec.object);
+    // every primitive the accelerators return is one of the scene's objects
+    if (id == primitive_ids.end()) {
+        t.primitive = unknown;
+        return;
+    }
+    t.primitive = id->second;
+    t.mat_id = rec.mat_id;
+    t.t = rec.t;
+    t.p = rec.p;
+    t.normal = rec.normal;
+}
+
+#endif
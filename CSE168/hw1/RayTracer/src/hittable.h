@@ -2,11 +2,18 @@
 #define HITTABLE_H
 
 #include "ray.h"
+#include "aabb.h"
+
+class hittable;
 
 struct hit_record {
     point3 p;
     vec3 normal;
     double t;
+    // index into scene::materials
+    int mat_id;
+    // the primitive that was hit (the transformed wrapper, for instanced objects)
+    const hittable* object;
     // design choice of determining the direction of normals at intersection of geometry time--normals always point "outward"; simply a matter of preference
     bool front_face;
 
@@ -20,6 +27,22 @@ struct hit_record {
 class hittable {
 public:
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+    virtual bool bounding_box(aabb& output_box) const = 0;
+
+    // closest hit for each of count independent rays; hits[i] says whether recs[i] was filled in
+    // accelerators override this to overlap the memory stalls of several rays
+    virtual void hit_batch(const ray* rays, int count, double t_min, double t_max, hit_record* recs, bool* hits) const {
+        for (int i = 0; i < count; i++)
+            hits[i] = hit(rays[i], t_min, t_max, recs[i]);
+    }
+
+    // bounds of the part of the object that lies inside clip, used by spatial splits in the bvh
+    // the default is conservative; primitives that can do better (triangles) override it
+    virtual aabb clipped_box(const aabb& clip) const {
+        aabb box;
+        if (!bounding_box(box)) return clip;
+        return intersection(box, clip);
+    }
 };
 
 #endif
\ No newline at end of file
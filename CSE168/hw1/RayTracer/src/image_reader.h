@@ -0,0 +1,132 @@
+#ifndef IMAGE_READER_H
+#define IMAGE_READER_H
+
+#include "inflate.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// Reads back the images this renderer writes, for compositing a crop over an earlier render: 8-bit
+// RGB or RGBA PNGs that aren't interlaced, and binary (P6) PPMs with a maxval of 255. rgb gets
+// 3 bytes per pixel, top row first, the same layout image_writer takes. Anything else returns false.
+bool read_png(const std::string& filename, int& width, int& height, std::vector<unsigned char>& rgb);
+bool read_ppm(const std::string& filename, int& width, int& height, std::vector<unsigned char>& rgb);
+
+// by signature rather than extension
+inline bool read_image(const std::string& filename, int& width, int& height, std::vector<unsigned char>& rgb) {
+    std::ifstream in(filename, std::ios::binary);
+    char magic[2] = {};
+    in.read(magic, 2);
+    if (!in) return false;
+    if (magic[0] == 'P' && magic[1] == '6') return read_ppm(filename, width, height, rgb);
+    return read_png(filename, width, height, rgb);
+}
+
+// a bad header shouldn't be able to ask for more than this
+static const size_t max_image_pixels = size_t(1) << 28;
+
+inline uint32_t get_u32(const unsigned char* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+bool read_png(const std::string& filename, int& width, int& height, std::vector<unsigned char>& rgb) {
+    std::ifstream in(filename, std::ios::binary);
+    std::vector<unsigned char> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    if (file.size() < 8 || !std::equal(signature, signature + 8, file.begin())) return false;
+
+    // the chunks are trusted to be what they say; the CRCs aren't checked
+    int channels = 0;
+    std::vector<unsigned char> zlib;
+    size_t at = 8;
+    bool ended = false;
+    while (!ended && at + 12 <= file.size()) {
+        size_t size = get_u32(&file[at]);
+        std::string type(file.begin() + at + 4, file.begin() + at + 8);
+        const unsigned char* data = &file[at + 8];
+        if (size > file.size() - at - 12) return false;
+        if (type == "IHDR") {
+            if (size != 13) return false;
+            width = static_cast<int>(get_u32(data));
+            height = static_cast<int>(get_u32(data + 4));
+            // 8 bits, RGB (2) or RGBA (6), deflate, adaptive filtering, not interlaced
+            if (data[8] != 8 || (data[9] != 2 && data[9] != 6) || data[10] != 0 || data[11] != 0 || data[12] != 0) return false;
+            channels = data[9] == 2 ? 3 : 4;
+        }
+        else if (type == "IDAT") zlib.insert(zlib.end(), data, data + size);
+        else if (type == "IEND") ended = true;
+        at += 12 + size;
+    }
+    if (channels == 0 || width <= 0 || height <= 0 || size_t(width) * height > max_image_pixels) return false;
+
+    const size_t stride = size_t(width) * channels, line = stride + 1;
+    std::vector<unsigned char> raw;
+    raw.reserve(line * height);
+    if (!zlib_decompress(zlib.data(), zlib.size(), raw) || raw.size() < line * height) return false;
+
+    // undo the filters in place, each row against the already unfiltered one above it
+    for (int y = 0; y < height; y++) {
+        unsigned char* row = &raw[line * y + 1];
+        const unsigned char* above = y > 0 ? &raw[line * (y - 1) + 1] : nullptr;
+        int filter = row[-1];
+        if (filter > 4) return false;
+        for (size_t i = 0; i < stride; i++) {
+            int a = i >= size_t(channels) ? row[i - channels] : 0, b = above ? above[i] : 0;
+            int c = above && i >= size_t(channels) ? above[i - channels] : 0;
+            int predicted = 0;
+            switch (filter) {
+            case 1: predicted = a; break;
+            case 2: predicted = b; break;
+            case 3: predicted = (a + b) >> 1; break;
+            case 4: {
+                int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+                predicted = (pa <= pb && pa <= pc) ? a : pb <= pc ? b : c;
+                break;
+            }
+            }
+            row[i] = static_cast<unsigned char>(row[i] + predicted);
+        }
+    }
+
+    rgb.resize(size_t(width) * height * 3);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            for (int k = 0; k < 3; k++)
+                rgb[(size_t(y) * width + x) * 3 + k] = raw[line * y + 1 + size_t(x) * channels + k];
+    return true;
+}
+
+bool read_ppm(const std::string& filename, int& width, int& height, std::vector<unsigned char>& rgb) {
+    std::ifstream in(filename, std::ios::binary);
+    std::string magic;
+    in >> magic;
+    if (magic != "P6") return false;
+
+    // width, height and maxval, any of which can have # comments before them
+    int header[3];
+    for (int k = 0; k < 3; k++) {
+        in >> std::ws;
+        while (in.peek() == '#') {
+            std::string comment;
+            std::getline(in, comment);
+            in >> std::ws;
+        }
+        in >> header[k];
+    }
+    // exactly one whitespace byte before the pixels
+    in.get();
+    width = header[0];
+    height = header[1];
+    if (!in || width <= 0 || height <= 0 || size_t(width) * height > max_image_pixels || header[2] != 255) return false;
+
+    rgb.resize(size_t(width) * height * 3);
+    in.read(reinterpret_cast<char*>(rgb.data()), rgb.size());
+    return static_cast<bool>(in);
+}
+
+#endif
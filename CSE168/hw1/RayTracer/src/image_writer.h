@@ -0,0 +1,57 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <cstdio>
+#include <string>
+
+// Something that takes an 8-bit RGB image a band of rows at a time, top row first, so callers can
+// hand over a whole image at once or stream it band by band.
+class image_writer {
+public:
+    virtual ~image_writer() {}
+
+    virtual bool open(const std::string& filename, int width, int height) = 0;
+    // the next rows of the image, 3 bytes per pixel
+    virtual bool write_rows(const unsigned char* rgb, int rows) = 0;
+    // finishes the file; false if any write failed or rows are missing
+    virtual bool close() = 0;
+};
+
+// Binary PPM: a text header and the raw bytes, about as fast as writing a file gets. For debugging
+// and for when the encode time matters more than the file size.
+class ppm_writer : public image_writer {
+public:
+    ~ppm_writer() { if (file) fclose(file); }
+
+    virtual bool open(const std::string& filename, int w, int h) override {
+        file = fopen(filename.c_str(), "wb");
+        if (!file) return false;
+        width = w;
+        height = h;
+        ok = fprintf(file, "P6\n%d %d\n255\n", width, height) > 0;
+        return ok;
+    }
+
+    virtual bool write_rows(const unsigned char* rgb, int rows) override {
+        if (!ok || rows_written + rows > height) return ok = false;
+        size_t n = size_t(width) * 3 * rows;
+        ok = fwrite(rgb, 1, n, file) == n;
+        rows_written += rows;
+        return ok;
+    }
+
+    virtual bool close() override {
+        if (!file) return false;
+        ok = fclose(file) == 0 && ok && rows_written == height;
+        file = nullptr;
+        return ok;
+    }
+
+private:
+    FILE* file = nullptr;
+    int width = 0, height = 0;
+    int rows_written = 0;
+    bool ok = false;
+};
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include "deflate.h"
+
+#include <cstdint>
+#include <vector>
+
+// Decodes deflate (RFC 1951) stored, fixed and dynamic Huffman blocks, in the simple
+// bit-at-a-time style of zlib's puff.c. Only used to read back a previous render, so it goes for
+// short over fast. Any malformed or truncated input makes it return false.
+class inflater {
+public:
+    inflater(const unsigned char* data, size_t size) : in(data), in_size(size) {}
+
+    // appends everything up to the end of the final block to out
+    bool run(std::vector<unsigned char>& out);
+    // bytes of input used, once run has returned
+    size_t consumed() const { return pos; }
+
+private:
+    struct huffman {
+        // number of codes of each length, and the symbols ordered by code
+        uint16_t count[16];
+        uint16_t symbol[288];
+    };
+
+    uint32_t bits(int n);
+    bool build(huffman& h, const uint8_t* lengths, int n);
+    int decode(const huffman& h);
+    bool stored(std::vector<unsigned char>& out);
+    bool codes(const huffman& lengths, const huffman& dists, std::vector<unsigned char>& out);
+    bool fixed(std::vector<unsigned char>& out);
+    bool dynamic(std::vector<unsigned char>& out);
+
+    const unsigned char* in;
+    size_t in_size;
+    size_t pos = 0;
+    uint32_t bit_buffer = 0;
+    int bit_count = 0;
+    bool ok = true;
+};
+
+uint32_t inflater::bits(int n) {
+    uint32_t v = bit_buffer;
+    while (bit_count < n) {
+        if (pos >= in_size) {
+            ok = false;
+            return 0;
+        }
+        v |= uint32_t(in[pos++]) << bit_count;
+        bit_count += 8;
+    }
+    bit_buffer = static_cast<uint32_t>(uint64_t(v) >> n);
+    bit_count -= n;
+    return v & ((1u << n) - 1);
+}
+
+// false if the lengths describe an over-subscribed code; incomplete codes are allowed (a lone
+// distance code is common)
+bool inflater::build(huffman& h, const uint8_t* lengths, int n) {
+    for (int l = 0; l < 16; l++) h.count[l] = 0;
+    for (int s = 0; s < n; s++) h.count[lengths[s]]++;
+    if (h.count[0] == n) return true;
+    int left = 1;
+    for (int l = 1; l < 16; l++) {
+        left = (left << 1) - h.count[l];
+        if (left < 0) return false;
+    }
+    uint16_t offsets[16];
+    offsets[1] = 0;
+    for (int l = 1; l < 15; l++) offsets[l + 1] = offsets[l] + h.count[l];
+    for (int s = 0; s < n; s++)
+        if (lengths[s]) h.symbol[offsets[lengths[s]]++] = static_cast<uint16_t>(s);
+    return true;
+}
+
+int inflater::decode(const huffman& h) {
+    int code = 0, first = 0, index = 0;
+    for (int l = 1; l < 16; l++) {
+        code |= static_cast<int>(bits(1));
+        if (!ok) return -1;
+        int count = h.count[l];
+        if (code - count < first) return h.symbol[index + (code - first)];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+bool inflater::stored(std::vector<unsigned char>& out) {
+    bit_buffer = 0;
+    bit_count = 0;
+    if (pos + 4 > in_size) return false;
+    unsigned len = in[pos] | (in[pos + 1] << 8);
+    unsigned nlen = in[pos + 2] | (in[pos + 3] << 8);
+    pos += 4;
+    if (len != (~nlen & 0xffff) || pos + len > in_size) return false;
+    out.insert(out.end(), in + pos, in + pos + len);
+    pos += len;
+    return true;
+}
+
+bool inflater::codes(const huffman& lengths, const huffman& dists, std::vector<unsigned char>& out) {
+    const deflate_tables& t = deflate_tables::get();
+    while (true) {
+        int symbol = decode(lengths);
+        if (symbol < 0) return false;
+        if (symbol < 256) out.push_back(static_cast<unsigned char>(symbol));
+        else if (symbol == 256) return true;
+        else {
+            symbol -= 257;
+            if (symbol >= 29) return false;
+            int len = t.length_base[symbol] + static_cast<int>(bits(t.length_extra[symbol]));
+            int d = decode(dists);
+            if (d < 0 || d >= 30) return false;
+            size_t dist = t.dist_base[d] + bits(t.dist_extra[d]);
+            if (!ok || dist > out.size()) return false;
+            // byte by byte, since a match may overlap what it's copying
+            size_t from = out.size() - dist;
+            for (int k = 0; k < len; k++) out.push_back(out[from + k]);
+        }
+    }
+}
+
+bool inflater::fixed(std::vector<unsigned char>& out) {
+    static const struct tables {
+        huffman lengths, dists;
+        tables() {
+            uint8_t l[288];
+            for (int s = 0; s < 288; s++) l[s] = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+            uint8_t d[30];
+            for (int s = 0; s < 30; s++) d[s] = 5;
+            inflater unused(nullptr, 0);
+            unused.build(lengths, l, 288);
+            unused.build(dists, d, 30);
+        }
+    } t;
+    return codes(t.lengths, t.dists, out);
+}
+
+bool inflater::dynamic(std::vector<unsigned char>& out) {
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    int nlen = static_cast<int>(bits(5)) + 257, ndist = static_cast<int>(bits(5)) + 1, ncode = static_cast<int>(bits(4)) + 4;
+    if (!ok || nlen > 286 || ndist > 30) return false;
+
+    uint8_t lengths[316] = {};
+    for (int k = 0; k < ncode; k++) lengths[order[k]] = static_cast<uint8_t>(bits(3));
+    huffman code_lengths;
+    if (!ok || !build(code_lengths, lengths, 19)) return false;
+
+    for (int k = 0; k < 19; k++) lengths[k] = 0;
+    for (int k = 0; k < nlen + ndist;) {
+        int symbol = decode(code_lengths);
+        if (symbol < 0) return false;
+        if (symbol < 16) {
+            lengths[k++] = static_cast<uint8_t>(symbol);
+            continue;
+        }
+        uint8_t len = 0;
+        int repeat;
+        if (symbol == 16) {
+            if (k == 0) return false;
+            len = lengths[k - 1];
+            repeat = 3 + static_cast<int>(bits(2));
+        }
+        else if (symbol == 17) repeat = 3 + static_cast<int>(bits(3));
+        else repeat = 11 + static_cast<int>(bits(7));
+        if (!ok || k + repeat > nlen + ndist) return false;
+        while (repeat--) lengths[k++] = len;
+    }
+    if (lengths[256] == 0) return false;
+
+    huffman lencode, distcode;
+    if (!build(lencode, lengths, nlen) || !build(distcode, lengths + nlen, ndist)) return false;
+    return codes(lencode, distcode, out);
+}
+
+bool inflater::run(std::vector<unsigned char>& out) {
+    bool last;
+    do {
+        last = bits(1) != 0;
+        int type = static_cast<int>(bits(2));
+        if (!ok) return false;
+        bool block_ok = type == 0 ? stored(out) : type == 1 ? fixed(out) : type == 2 ? dynamic(out) : false;
+        if (!block_ok || !ok) return false;
+    } while (!last);
+    return true;
+}
+
+// a zlib stream (RFC 1950): header, deflate data, Adler-32 of the result
+inline bool zlib_decompress(const unsigned char* data, size_t size, std::vector<unsigned char>& out) {
+    if (size < 6 || (data[0] & 0x0f) != 8 || (data[0] * 256 + data[1]) % 31 != 0 || (data[1] & 0x20)) return false;
+    inflater inf(data + 2, size - 2);
+    size_t start = out.size();
+    if (!inf.run(out)) return false;
+    size_t end = 2 + inf.consumed();
+    if (end + 4 > size) return false;
+    uint32_t stored = (uint32_t(data[end]) << 24) | (uint32_t(data[end + 1]) << 16) | (uint32_t(data[end + 2]) << 8) | data[end + 3];
+    return stored == adler32_update(1, out.data() + start, out.size() - start);
+}
+
+#endif
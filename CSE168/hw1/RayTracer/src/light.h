@@ -0,0 +1,38 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include "rtweekend.h"
+
+// "point x y z r g b" or "directional x y z r g b"
+struct light {
+    bool directional = false;
+    // position for point lights, direction toward the light for directional ones
+    vec3 position;
+    color col;
+};
+
+// what a shading point sees of a light
+struct light_sample {
+    vec3 to_light;      // unit vector
+    double distance;    // infinity for directional lights
+    color radiance;     // light color after attenuation
+};
+
+// attenuation is the scene's "attenuation const linear quadratic", only applied to point lights
+inline light_sample sample_light(const light& l, const point3& p, const vec3& attenuation) {
+    light_sample s;
+    if (l.directional) {
+        s.to_light = unit_vector(l.position);
+        s.distance = infinity;
+        s.radiance = l.col;
+    }
+    else {
+        vec3 d = l.position - p;
+        s.distance = d.length();
+        s.to_light = d / s.distance;
+        s.radiance = l.col / (attenuation.x() + attenuation.y() * s.distance + attenuation.z() * s.distance * s.distance);
+    }
+    return s;
+}
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef LIGHT_ARRAYS_H
+#define LIGHT_ARRAYS_H
+
+#include "rtweekend.h"
+#include "light.h"
+#include "material.h"
+#include "light_bvh.h"
+
+#include <algorithm>
+#include <vector>
+
+// The scene's lights split by kind into structure-of-arrays groups, so the Blinn-Phong sum for one
+// shading point is a straight loop over each group with no per-light branch on the light type.
+struct light_arrays {
+    struct group {
+        // unit direction toward the light (directional) or position (point)
+        std::vector<double> x, y, z;
+        std::vector<double> r, g, b;
+        // position of each light in scene::lights
+        std::vector<int> index;
+
+        int size() const { return static_cast<int>(index.size()); }
+
+        void add(const vec3& v, const color& c, int i) {
+            x.push_back(v.x()); y.push_back(v.y()); z.push_back(v.z());
+            r.push_back(c.x()); g.push_back(c.y()); b.push_back(c.z());
+            index.push_back(i);
+        }
+    };
+
+    light_arrays() {}
+    // cutoff > 0 turns on bounded-influence culling, see influential()
+    light_arrays(const std::vector<light>& lights, const vec3& attenuation = vec3(1, 0, 0), double cutoff = 0);
+
+    int size() const { return directional.size() + point.size(); }
+
+    bool culling() const { return cutoff > 0; }
+    // The lights that can add at least cutoff to some channel of a point at p with material m, by
+    // scene index in ascending order, which is the order shading sums them in. The Blinn-Phong
+    // factors are at most diffuse + specular, so a light is left out if its attenuated color times
+    // that is under the cutoff everywhere. out is cleared first.
+    void influential(const point3& p, const material& m, std::vector<int>& out) const;
+
+    group directional;
+    group point;
+    // scene light i's results are in slot[i] of light_terms (directional lights first, then point)
+    std::vector<int> slot;
+    // the point lights, only built when culling
+    light_bvh point_tree;
+    double cutoff = 0;
+};
+
+light_arrays::light_arrays(const std::vector<light>& lights, const vec3& attenuation, double c) : cutoff(c) {
+    for (int i = 0; i < static_cast<int>(lights.size()); i++) {
+        if (lights[i].directional) directional.add(unit_vector(lights[i].position), lights[i].col, i);
+        else point.add(lights[i].position, lights[i].col, i);
+    }
+    slot.resize(lights.size());
+    for (int k = 0; k < directional.size(); k++) slot[directional.index[k]] = k;
+    for (int k = 0; k < point.size(); k++) slot[point.index[k]] = directional.size() + k;
+    if (culling()) point_tree = light_bvh(lights, attenuation);
+}
+
+void light_arrays::influential(const point3& p, const material& m, std::vector<int>& out) const {
+    out.clear();
+    color reflectance = m.diffuse + m.specular;
+    double strongest = std::max(reflectance.x(), std::max(reflectance.y(), reflectance.z()));
+    if (strongest <= 0) return;
+    const double threshold = cutoff / strongest;
+    for (int k = 0; k < directional.size(); k++)
+        if (std::max(directional.r[k], std::max(directional.g[k], directional.b[k])) >= threshold) out.push_back(directional.index[k]);
+    point_tree.query(p, threshold, out);
+    std::sort(out.begin(), out.end());
+}
+
+// every light's unshadowed Blinn-Phong term at one shading point, and the shadow ray toward it,
+// in light_arrays slot order. Reused between shading points to avoid allocating.
+struct light_terms {
+    std::vector<double> r, g, b;
+    std::vector<double> dx, dy, dz;
+    std::vector<double> distance;
+    // scratch for the second pass of the kernel
+    std::vector<double> n_dot_l, n_dot_h;
+
+    void resize(int n) {
+        for (auto* v : { &r, &g, &b, &dx, &dy, &dz, &distance, &n_dot_l, &n_dot_h })
+            v->resize(n);
+    }
+
+    // true if the light in this slot contributes anything, i.e. is worth a shadow ray
+    bool contributes(int s) const { return r[s] > 0 || g[s] > 0 || b[s] > 0; }
+};
+
+// Blinn-Phong for one group of lights into out[first, first + lights.size()). Directional is a
+// template parameter so each kind gets its own branch-free loop. The geometry (light vector,
+// attenuation, half vector, the two dot products) runs two lights per SSE2 step, with a scalar loop
+// for the odd one out and for builds without SSE2. pow stays scalar in a pass of its own. Same
+// operations in the same order as sample_light + blinn_phong, so the result is bit for bit the same.
+template <bool Directional>
+void blinn_phong_lights(const light_arrays::group& lights, int first, const material& m, const point3& p,
+    const vec3& normal, const vec3& to_eye, const vec3& attenuation, light_terms& out) {
+    const int n = lights.size();
+    const double px = p.x(), py = p.y(), pz = p.z();
+    const double nx = normal.x(), ny = normal.y(), nz = normal.z();
+    const double ex = to_eye.x(), ey = to_eye.y(), ez = to_eye.z();
+    const double a0 = attenuation.x(), a1 = attenuation.y(), a2 = attenuation.z();
+    const double* lx_in = lights.x.data();
+    const double* ly_in = lights.y.data();
+    const double* lz_in = lights.z.data();
+    const double* cr = lights.r.data();
+    const double* cg = lights.g.data();
+    const double* cb = lights.b.data();
+    double* dx = out.dx.data() + first;
+    double* dy = out.dy.data() + first;
+    double* dz = out.dz.data() + first;
+    double* dist = out.distance.data() + first;
+    double* rr = out.r.data() + first;
+    double* rg = out.g.data() + first;
+    double* rb = out.b.data() + first;
+    double* ndl = out.n_dot_l.data() + first;
+    double* ndh = out.n_dot_h.data() + first;
+
+    int k = 0;
+#ifdef RT_HAVE_SSE2
+    const __m128d zero = _mm_setzero_pd(), one = _mm_set1_pd(1.0);
+    const __m128d vpx = _mm_set1_pd(px), vpy = _mm_set1_pd(py), vpz = _mm_set1_pd(pz);
+    const __m128d vnx = _mm_set1_pd(nx), vny = _mm_set1_pd(ny), vnz = _mm_set1_pd(nz);
+    const __m128d vex = _mm_set1_pd(ex), vey = _mm_set1_pd(ey), vez = _mm_set1_pd(ez);
+    const __m128d va0 = _mm_set1_pd(a0), va1 = _mm_set1_pd(a1), va2 = _mm_set1_pd(a2);
+
+    for (; k + 2 <= n; k += 2) {
+        __m128d lx, ly, lz, d;
+        __m128d r = _mm_loadu_pd(cr + k), g = _mm_loadu_pd(cg + k), b = _mm_loadu_pd(cb + k);
+        if (Directional) {
+            lx = _mm_loadu_pd(lx_in + k); ly = _mm_loadu_pd(ly_in + k); lz = _mm_loadu_pd(lz_in + k);
+            d = _mm_set1_pd(infinity);
+        }
+        else {
+            __m128d vx = _mm_sub_pd(_mm_loadu_pd(lx_in + k), vpx);
+            __m128d vy = _mm_sub_pd(_mm_loadu_pd(ly_in + k), vpy);
+            __m128d vz = _mm_sub_pd(_mm_loadu_pd(lz_in + k), vpz);
+            d = _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(vx, vx), _mm_mul_pd(vy, vy)), _mm_mul_pd(vz, vz)));
+            __m128d inv = _mm_div_pd(one, d);
+            lx = _mm_mul_pd(inv, vx); ly = _mm_mul_pd(inv, vy); lz = _mm_mul_pd(inv, vz);
+            __m128d scale = _mm_div_pd(one, _mm_add_pd(_mm_add_pd(va0, _mm_mul_pd(va1, d)), _mm_mul_pd(_mm_mul_pd(va2, d), d)));
+            r = _mm_mul_pd(scale, r); g = _mm_mul_pd(scale, g); b = _mm_mul_pd(scale, b);
+        }
+        _mm_storeu_pd(dx + k, lx); _mm_storeu_pd(dy + k, ly); _mm_storeu_pd(dz + k, lz);
+        _mm_storeu_pd(dist + k, d);
+        _mm_storeu_pd(rr + k, r); _mm_storeu_pd(rg + k, g); _mm_storeu_pd(rb + k, b);
+
+        __m128d hx = _mm_add_pd(lx, vex), hy = _mm_add_pd(ly, vey), hz = _mm_add_pd(lz, vez);
+        __m128d inv_h = _mm_div_pd(one, _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(hx, hx), _mm_mul_pd(hy, hy)), _mm_mul_pd(hz, hz))));
+        hx = _mm_mul_pd(inv_h, hx); hy = _mm_mul_pd(inv_h, hy); hz = _mm_mul_pd(inv_h, hz);
+        // max(0, x) keeps x when both are zero, like std::max(x, 0.0)
+        _mm_storeu_pd(ndl + k, _mm_max_pd(zero, _mm_add_pd(_mm_add_pd(_mm_mul_pd(vnx, lx), _mm_mul_pd(vny, ly)), _mm_mul_pd(vnz, lz))));
+        _mm_storeu_pd(ndh + k, _mm_max_pd(zero, _mm_add_pd(_mm_add_pd(_mm_mul_pd(vnx, hx), _mm_mul_pd(vny, hy)), _mm_mul_pd(vnz, hz))));
+    }
+#endif
+
+    for (; k < n; k++) {
+        double lx, ly, lz, d, scale;
+        if (Directional) {
+            lx = lx_in[k]; ly = ly_in[k]; lz = lz_in[k];
+            d = infinity;
+            scale = 1;
+        }
+        else {
+            double vx = lx_in[k] - px, vy = ly_in[k] - py, vz = lz_in[k] - pz;
+            d = sqrt(vx * vx + vy * vy + vz * vz);
+            double inv = 1 / d;
+            lx = inv * vx; ly = inv * vy; lz = inv * vz;
+            scale = 1 / (a0 + a1 * d + a2 * d * d);
+        }
+        dx[k] = lx; dy[k] = ly; dz[k] = lz;
+        dist[k] = d;
+        rr[k] = Directional ? cr[k] : scale * cr[k];
+        rg[k] = Directional ? cg[k] : scale * cg[k];
+        rb[k] = Directional ? cb[k] : scale * cb[k];
+
+        double hx = lx + ex, hy = ly + ey, hz = lz + ez;
+        double inv_h = 1 / sqrt(hx * hx + hy * hy + hz * hz);
+        hx = inv_h * hx; hy = inv_h * hy; hz = inv_h * hz;
+        ndl[k] = std::max(nx * lx + ny * ly + nz * lz, 0.0);
+        ndh[k] = std::max(nx * hx + ny * hy + nz * hz, 0.0);
+    }
+
+    const double shininess = m.shininess;
+    const double kd_r = m.diffuse.x(), kd_g = m.diffuse.y(), kd_b = m.diffuse.z();
+    const double ks_r = m.specular.x(), ks_g = m.specular.y(), ks_b = m.specular.z();
+    for (k = 0; k < n; k++) {
+        double spec = pow(ndh[k], shininess);
+        rr[k] = rr[k] * (kd_r * ndl[k] + ks_r * spec);
+        rg[k] = rg[k] * (kd_g * ndl[k] + ks_g * spec);
+        rb[k] = rb[k] * (kd_b * ndl[k] + ks_b * spec);
+    }
+}
+
+// all lights at one shading point; out is resized to lights.size()
+inline void blinn_phong_all(const light_arrays& lights, const material& m, const point3& p,
+    const vec3& normal, const vec3& to_eye, const vec3& attenuation, light_terms& out) {
+    out.resize(lights.size());
+    blinn_phong_lights<true>(lights.directional, 0, m, p, normal, to_eye, attenuation, out);
+    blinn_phong_lights<false>(lights.point, lights.directional.size(), m, p, normal, to_eye, attenuation, out);
+}
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef LIGHT_BVH_H
+#define LIGHT_BVH_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "light.h"
+
+#include <algorithm>
+#include <vector>
+
+// A bvh over the scene's point lights for bounded-influence culling. Each node keeps the box around
+// its lights' positions and the brightest channel of its brightest light. Attenuation only grows
+// with distance, so nothing in a node can be brighter at p than that power attenuated over the
+// distance from p to the box. query() skips every node where that is under the threshold, which
+// costs about log(lights) plus the lights actually returned, instead of a pass over all of them.
+// Which lights come back doesn't depend on how the tree is built: exactly those whose own
+// attenuated color reaches the threshold at p.
+class light_bvh {
+public:
+    light_bvh() {}
+    // directional lights are left out, they have no position to cull by
+    light_bvh(const std::vector<light>& lights, const vec3& attenuation);
+
+    // true if attenuation falls off with distance, so there's anything to cull
+    bool bounded() const { return falls_off; }
+    int size() const { return static_cast<int>(entries.size()); }
+
+    // appends the scene index of every point light whose brightest channel, attenuated over its
+    // distance to p, is at least threshold, in no particular order
+    void query(const point3& p, double threshold, std::vector<int>& out) const;
+
+    static const int max_leaf_size = 4;
+
+private:
+    struct node {
+        aabb box;
+        // brightest channel of any light below this node
+        double power;
+        // leaf: first entry. interior: index of the second child, the first is right after it
+        int offset;
+        // lights in a leaf, 0 for interior nodes
+        int count;
+    };
+
+    struct entry {
+        point3 position;
+        double power;
+        int light;
+    };
+
+    void build(int begin, int end);
+    // the most a light of this power can deliver at distance d
+    double attenuated(double power, double d) const { return power / (a0 + a1 * d + a2 * d * d); }
+
+    std::vector<node> nodes;
+    std::vector<entry> entries;
+    double a0 = 1, a1 = 0, a2 = 0;
+    bool falls_off = false;
+};
+
+light_bvh::light_bvh(const std::vector<light>& lights, const vec3& attenuation)
+    : a0(attenuation.x()), a1(attenuation.y()), a2(attenuation.z()) {
+    // the bound needs attenuation that never shrinks with distance and never divides by zero
+    falls_off = a0 > 0 && a1 >= 0 && a2 >= 0 && (a1 > 0 || a2 > 0);
+    for (int i = 0; i < static_cast<int>(lights.size()); i++) {
+        const light& l = lights[i];
+        if (!l.directional)
+            entries.push_back({ l.position, std::max(l.col.x(), std::max(l.col.y(), l.col.z())), i });
+    }
+    if (entries.empty()) return;
+    nodes.reserve(2 * entries.size() / max_leaf_size + 2);
+    build(0, static_cast<int>(entries.size()));
+}
+
+// median split on the longest axis of the lights' positions; lights are points, so there's no
+// overlap to weigh up as in the geometry bvh's SAH
+void light_bvh::build(int begin, int end) {
+    int index = static_cast<int>(nodes.size());
+    nodes.push_back({ aabb(), 0.0, begin, end - begin });
+    node n = nodes[index];
+    for (int k = begin; k < end; k++) {
+        n.box.expand(entries[k].position);
+        n.power = std::max(n.power, entries[k].power);
+    }
+    if (end - begin > max_leaf_size) {
+        int axis = n.box.longest_axis();
+        int middle = begin + (end - begin) / 2;
+        std::nth_element(entries.begin() + begin, entries.begin() + middle, entries.begin() + end,
+            [axis](const entry& a, const entry& b) { return a.position[axis] < b.position[axis]; });
+        n.count = 0;
+        nodes[index] = n;
+        build(begin, middle);
+        nodes[index].offset = static_cast<int>(nodes.size());
+        build(middle, end);
+        return;
+    }
+    nodes[index] = n;
+}
+
+void light_bvh::query(const point3& p, double threshold, std::vector<int>& out) const {
+    if (nodes.empty()) return;
+    if (!falls_off) {
+        // nothing can be ruled out by distance
+        for (const entry& e : entries) if (e.power >= threshold) out.push_back(e.light);
+        return;
+    }
+
+    int stack[64];
+    int stack_size = 0;
+    int current = 0;
+    while (true) {
+        const node& n = nodes[current];
+        double d2 = 0;
+        for (int a = 0; a < 3; a++) {
+            double gap = std::max(0.0, std::max(n.box.minimum[a] - p[a], p[a] - n.box.maximum[a]));
+            d2 += gap * gap;
+        }
+        if (attenuated(n.power, sqrt(d2)) >= threshold) {
+            if (n.count > 0) {
+                for (int k = n.offset; k < n.offset + n.count; k++) {
+                    const entry& e = entries[k];
+                    if (attenuated(e.power, (e.position - p).length()) >= threshold) out.push_back(e.light);
+                }
+            }
+            else {
+                stack[stack_size++] = n.offset;
+                current = current + 1;
+                continue;
+            }
+        }
+        if (stack_size == 0) break;
+        current = stack[--stack_size];
+    }
+}
+
+#endif
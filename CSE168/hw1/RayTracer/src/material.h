@@ -0,0 +1,31 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+
+// the scene file's material state, captured when each sphere/tri is created
+struct material {
+    color ambient = color(0.2, 0.2, 0.2);
+    color diffuse;
+    color specular;
+    color emission;
+    double shininess = 0;
+
+    // mirror reflections are only traced for materials with some specular
+    bool reflective() const {
+        return specular.x() > 0 || specular.y() > 0 || specular.z() > 0;
+    }
+};
+
+// one light's Blinn-Phong term (same model as light.frag.glsl from CSE167x)
+// normal, to_light and to_eye are unit vectors, radiance already includes attenuation
+inline color blinn_phong(const material& m, const vec3& normal, const vec3& to_light, const vec3& to_eye, const color& radiance) {
+    vec3 half_vec = unit_vector(to_light + to_eye);
+    double n_dot_l = std::max(dot(normal, to_light), 0.0);
+    double n_dot_h = std::max(dot(normal, half_vec), 0.0);
+    return radiance * (m.diffuse * n_dot_l + m.specular * pow(n_dot_h, m.shininess));
+}
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef MEMORY_ACCOUNTING_H
+#define MEMORY_ACCOUNTING_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// Where heap memory goes. Every allocation made through operator new is charged to the tag its
+// thread had at the time (see memory_scope) and credited back to the same tag when it's freed,
+// wherever that happens, so the current and peak bytes of each subsystem are exact rather than
+// estimated. Include this in exactly one translation unit per program: it replaces the global
+// operator new and delete.
+enum class memory_tag : int {
+    other,
+    // the scene file's text and the per-line strings and streams while it's parsed
+    parser,
+    // primitives, vertices, materials and lights
+    geometry,
+    // bvh and compressed bvh, including the build's scratch
+    acceleration,
+    // rendered pixels, per-pixel ids, sample sums and the encoded image
+    framebuffer,
+    // G-buffers and the render server's scene cache
+    cache,
+    // ray queues and other per-render scratch
+    render,
+    count
+};
+
+inline const char* memory_tag_name(memory_tag tag) {
+    static const char* const names[] = { "other", "parser", "geometry", "acceleration", "framebuffer", "cache", "render" };
+    return names[static_cast<int>(tag)];
+}
+
+// zero initialized before any constructor runs, so allocations made during static
+// initialization are counted too
+struct memory_counters {
+    static const int tags = static_cast<int>(memory_tag::count);
+    std::atomic<long long> current[tags];
+    std::atomic<long long> peak[tags];
+    // operator new calls, freed or not
+    std::atomic<long long> allocations[tags];
+    std::atomic<long long> total, total_peak;
+    // bytes; 0 for no limit
+    std::atomic<long long> budget;
+};
+
+memory_counters memory_usage;
+thread_local memory_tag current_memory_tag;
+
+// charges this thread's allocations to tag until it goes out of scope
+class memory_scope {
+public:
+    explicit memory_scope(memory_tag tag) : previous(current_memory_tag) { current_memory_tag = tag; }
+    memory_scope(const memory_scope&) = delete;
+    memory_scope& operator=(const memory_scope&) = delete;
+    ~memory_scope() { current_memory_tag = previous; }
+
+private:
+    memory_tag previous;
+};
+
+inline void raise_peak(std::atomic<long long>& peak, long long value) {
+    long long seen = peak.load(std::memory_order_relaxed);
+    while (value > seen && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+}
+
+inline long long memory_in_use() {
+    return memory_usage.total.load(std::memory_order_relaxed);
+}
+
+// operator new calls so far, all tags; a difference of two is what the code between made
+inline long long allocation_count() {
+    long long count = 0;
+    for (int t = 0; t < memory_counters::tags; t++) count += memory_usage.allocations[t].load(std::memory_order_relaxed);
+    return count;
+}
+
+// one line per tag that was ever used; plain stdio, since it also reports running out of budget
+// from inside operator new, where nothing may allocate
+inline void print_memory_usage(FILE* out) {
+    fprintf(out, "%-14s %12s %12s %12s\n", "memory", "current KB", "peak KB", "allocations");
+    for (int t = 0; t < memory_counters::tags; t++) {
+        long long peak = memory_usage.peak[t].load(std::memory_order_relaxed);
+        if (peak == 0) continue;
+        fprintf(out, "%-14s %12.1f %12.1f %12lld\n", memory_tag_name(static_cast<memory_tag>(t)),
+            memory_usage.current[t].load(std::memory_order_relaxed) / 1024.0, peak / 1024.0,
+            memory_usage.allocations[t].load(std::memory_order_relaxed));
+    }
+    fprintf(out, "%-14s %12.1f %12.1f %12lld\n", "total", memory_usage.total.load(std::memory_order_relaxed) / 1024.0,
+        memory_usage.total_peak.load(std::memory_order_relaxed) / 1024.0, allocation_count());
+    fflush(out);
+}
+
+
+// every block carries its size and tag in front of it; 16 bytes keeps malloc's alignment
+struct memory_block_header {
+    uint64_t size;
+    int32_t tag;
+    int32_t unused;
+};
+
+inline void* tracked_allocate(std::size_t size) {
+    const int tag = static_cast<int>(current_memory_tag);
+    const long long bytes = static_cast<long long>(size);
+    long long total = memory_usage.total.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    long long budget = memory_usage.budget.load(std::memory_order_relaxed);
+    if (budget > 0 && total > budget) {
+        // fail fast: going on would mean swapping, or the allocation after this one failing anywhere
+        fprintf(stderr, "\nOut of memory budget: %lld KB of %s would make %.1f KB, over the %.1f KB budget\n",
+            bytes / 1024, memory_tag_name(static_cast<memory_tag>(tag)), total / 1024.0, budget / 1024.0);
+        // the table shows the heap as it was just before this allocation
+        memory_usage.total.fetch_sub(bytes, std::memory_order_relaxed);
+        print_memory_usage(stderr);
+        std::_Exit(3);
+    }
+    raise_peak(memory_usage.total_peak, total);
+    memory_usage.allocations[tag].fetch_add(1, std::memory_order_relaxed);
+    raise_peak(memory_usage.peak[tag], memory_usage.current[tag].fetch_add(bytes, std::memory_order_relaxed) + bytes);
+
+    memory_block_header* block = static_cast<memory_block_header*>(std::malloc(sizeof(memory_block_header) + size));
+    if (!block) {
+        memory_usage.total.fetch_sub(bytes, std::memory_order_relaxed);
+        memory_usage.current[tag].fetch_sub(bytes, std::memory_order_relaxed);
+        return nullptr;
+    }
+    block->size = size;
+    block->tag = tag;
+    return block + 1;
+}
+
+inline void tracked_free(void* p) {
+    if (!p) return;
+    // the header's address as plain arithmetic; stepping back from a pointer GCC saw come out of
+    // operator new looks to it like an out of bounds read, and the free like a mismatched delete
+    memory_block_header* block = reinterpret_cast<memory_block_header*>(reinterpret_cast<uintptr_t>(p) - sizeof(memory_block_header));
+    const long long bytes = static_cast<long long>(block->size);
+    memory_usage.total.fetch_sub(bytes, std::memory_order_relaxed);
+    memory_usage.current[block->tag].fetch_sub(bytes, std::memory_order_relaxed);
+    std::free(block);
+}
+
+void* operator new(std::size_t size) {
+    void* p = tracked_allocate(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](std::size_t size) {
+    void* p = tracked_allocate(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return tracked_allocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return tracked_allocate(size); }
+void operator delete(void* p) noexcept { tracked_free(p); }
+void operator delete[](void* p) noexcept { tracked_free(p); }
+void operator delete(void* p, std::size_t) noexcept { tracked_free(p); }
+void operator delete[](void* p, std::size_t) noexcept { tracked_free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { tracked_free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { tracked_free(p); }
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+#include "memory_accounting.h"
+
+// Runs body(worker, item) for every item in [0, count) on num_threads workers.
+// Items are handed out one at a time from a shared counter, so uneven rows/tiles balance themselves.
+// worker is in [0, num_threads) and is what per-thread scratch data should be indexed by.
+// Workers charge their allocations to the caller's memory tag.
+inline void parallel_for(int count, int num_threads, const std::function<void(int, int)>& body) {
+    num_threads = std::max(1, std::min(num_threads, count));
+    if (num_threads == 1) {
+        for (int i = 0; i < count; i++) body(0, i);
+        return;
+    }
+
+    std::atomic<int> next(0);
+    const memory_tag tag = current_memory_tag;
+    std::vector<std::thread> workers;
+    for (int w = 0; w < num_threads; w++) {
+        workers.emplace_back([&, w]() {
+            memory_scope memory(tag);
+            for (int i = next++; i < count; i = next++)
+                body(w, i);
+        });
+    }
+    for (auto& t : workers) t.join();
+}
+
+inline int default_thread_count() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? static_cast<int>(n) : 1;
+}
+
+#endif
@@ -0,0 +1,208 @@
+#ifndef PNG_WRITER_H
+#define PNG_WRITER_H
+
+#include "image_writer.h"
+#include "deflate.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Writes an 8-bit RGB PNG, a band of rows at a time if the caller wants (the image never has to
+// be in memory all at once). The pixel data is a single zlib stream cut across IDAT chunks, one per
+// write_rows call. Each band is split into chunks of rows that are filtered, then deflated, on all
+// the threads at once: a chunk can match into the 32K before it and ends on a sync flush, so the
+// pieces join into one valid stream, and the Adler-32 sums are combined rather than recomputed.
+class png_writer : public image_writer {
+public:
+    // level 0 stores the rows unfiltered and uncompressed, 1 is fastest, 9 is smallest
+    png_writer(int compression_level = 6, int num_threads = 1)
+        : level(std::max(0, std::min(9, compression_level))), threads(std::max(1, num_threads)) {}
+    png_writer(const png_writer&) = delete;
+    png_writer& operator=(const png_writer&) = delete;
+    ~png_writer() { if (file) fclose(file); }
+
+    virtual bool open(const std::string& filename, int width, int height) override;
+    virtual bool write_rows(const unsigned char* rgb, int rows) override;
+    virtual bool close() override;
+
+private:
+    void write_chunk(const char* type, const unsigned char* data, size_t size);
+    void filter_row(const unsigned char* row, const unsigned char* above, unsigned char* out);
+
+    static void put_u32(unsigned char* p, uint32_t v) {
+        p[0] = static_cast<unsigned char>(v >> 24);
+        p[1] = static_cast<unsigned char>(v >> 16);
+        p[2] = static_cast<unsigned char>(v >> 8);
+        p[3] = static_cast<unsigned char>(v);
+    }
+
+    int level, threads;
+    FILE* file = nullptr;
+    int width = 0, height = 0;
+    int rows_written = 0;
+    bool ok = false;
+    uint32_t adler = 1;
+    // the last row written, which the first row of the next band is filtered against
+    std::vector<unsigned char> last_row;
+    // the end of the filtered data so far (up to the 32K window) followed by this band's
+    std::vector<unsigned char> filtered;
+};
+
+inline uint32_t crc32_update(uint32_t crc, const unsigned char* data, size_t n) {
+    static const struct table {
+        uint32_t v[256];
+        table() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                v[i] = c;
+            }
+        }
+    } t;
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) crc = t.v[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+void png_writer::write_chunk(const char* type, const unsigned char* data, size_t size) {
+    unsigned char header[8];
+    put_u32(header, static_cast<uint32_t>(size));
+    for (int i = 0; i < 4; i++) header[4 + i] = static_cast<unsigned char>(type[i]);
+    uint32_t crc = crc32_update(crc32_update(0, header + 4, 4), data, size);
+    unsigned char trailer[4];
+    put_u32(trailer, crc);
+
+    ok = ok && fwrite(header, 1, 8, file) == 8;
+    ok = ok && (size == 0 || fwrite(data, 1, size, file) == size);
+    ok = ok && fwrite(trailer, 1, 4, file) == 4;
+}
+
+// One scanline with the filter that leaves the smallest sum of absolute (signed) differences, the
+// usual heuristic for what will deflate best. Level 0 doesn't filter at all.
+void png_writer::filter_row(const unsigned char* row, const unsigned char* above, unsigned char* out) {
+    const int bpp = 3;
+    const size_t n = size_t(width) * bpp;
+    out[0] = 0;
+    if (level == 0) {
+        std::copy(row, row + n, out + 1);
+        return;
+    }
+
+    std::vector<unsigned char> trial(n);
+    long best_cost = -1;
+    for (int f = 0; f < 5; f++) {
+        long cost = 0;
+        for (size_t i = 0; i < n; i++) {
+            int a = i >= bpp ? row[i - bpp] : 0, b = above[i], c = i >= bpp ? above[i - bpp] : 0;
+            int predicted = 0;
+            switch (f) {
+            case 1: predicted = a; break;
+            case 2: predicted = b; break;
+            case 3: predicted = (a + b) >> 1; break;
+            case 4: {
+                // Paeth: whichever of a, b, c is closest to a + b - c
+                int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+                predicted = (pa <= pb && pa <= pc) ? a : pb <= pc ? b : c;
+                break;
+            }
+            }
+            trial[i] = static_cast<unsigned char>(row[i] - predicted);
+            cost += abs(static_cast<signed char>(trial[i]));
+        }
+        if (best_cost < 0 || cost < best_cost) {
+            best_cost = cost;
+            out[0] = static_cast<unsigned char>(f);
+            std::copy(trial.begin(), trial.end(), out + 1);
+        }
+    }
+}
+
+bool png_writer::open(const std::string& filename, int w, int h) {
+    file = fopen(filename.c_str(), "wb");
+    if (!file) return false;
+    width = w;
+    height = h;
+    last_row.assign(size_t(width) * 3, 0);
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    ok = fwrite(signature, 1, 8, file) == 8;
+    unsigned char ihdr[13];
+    put_u32(ihdr, width);
+    put_u32(ihdr + 4, height);
+    // 8 bits per channel, truecolor, deflate, adaptive filtering, not interlaced
+    ihdr[8] = 8; ihdr[9] = 2; ihdr[10] = 0; ihdr[11] = 0; ihdr[12] = 0;
+    write_chunk("IHDR", ihdr, sizeof(ihdr));
+    return ok;
+}
+
+bool png_writer::write_rows(const unsigned char* rgb, int rows) {
+    if (!ok || rows_written + rows > height) return ok = false;
+    if (rows == 0) return ok;
+
+    // chunks of about 256 KB: big enough that splitting costs little compression, small enough to
+    // keep every thread busy on a modest image
+    const size_t stride = size_t(width) * 3, line = stride + 1;
+    const int chunk_rows = static_cast<int>(std::max<size_t>(1, (size_t(1) << 18) / line));
+    const int chunks = (rows + chunk_rows - 1) / chunk_rows;
+    const size_t dict = filtered.size();
+    filtered.resize(dict + line * rows);
+    unsigned char* band = filtered.data() + dict;
+
+    parallel_for(chunks, threads, [&](int, int c) {
+        for (int r = c * chunk_rows; r < std::min(rows, (c + 1) * chunk_rows); r++)
+            filter_row(rgb + stride * r, r > 0 ? rgb + stride * (r - 1) : last_row.data(), band + line * r);
+    });
+
+    std::vector<std::vector<unsigned char>> pieces(chunks);
+    std::vector<uint32_t> sums(chunks);
+    parallel_for(chunks, threads, [&](int, int c) {
+        size_t begin = line * c * chunk_rows, end = std::min(line * rows, line * (c + 1) * chunk_rows);
+        deflate_chunk(band + begin, end - begin, dict + begin, level, pieces[c]);
+        sums[c] = adler32_update(1, band + begin, end - begin);
+    });
+
+    // the first IDAT carries the zlib header; the flag byte only records the level
+    std::vector<unsigned char> idat;
+    if (rows_written == 0) {
+        idat.push_back(0x78);
+        idat.push_back(level <= 1 ? 0x01 : level <= 5 ? 0x5e : level == 6 ? 0x9c : 0xda);
+    }
+    for (int c = 0; c < chunks; c++) {
+        size_t begin = line * c * chunk_rows, end = std::min(line * rows, line * (c + 1) * chunk_rows);
+        adler = adler32_combine(adler, sums[c], end - begin);
+        idat.insert(idat.end(), pieces[c].begin(), pieces[c].end());
+        std::vector<unsigned char>().swap(pieces[c]);
+    }
+    // chunk lengths are limited to 2^31 - 1
+    const size_t max_chunk = size_t(1) << 30;
+    for (size_t at = 0; at < idat.size(); at += max_chunk)
+        write_chunk("IDAT", idat.data() + at, std::min(max_chunk, idat.size() - at));
+
+    std::copy(rgb + stride * (rows - 1), rgb + stride * rows, last_row.begin());
+    size_t keep = std::min<size_t>(filtered.size(), deflate_tables::window);
+    filtered.erase(filtered.begin(), filtered.end() - keep);
+    rows_written += rows;
+    return ok;
+}
+
+bool png_writer::close() {
+    if (!file) return false;
+    ok = ok && rows_written == height;
+    if (ok) {
+        // an empty final stored block, then the Adler-32 of everything before it
+        unsigned char tail[9] = { 1, 0, 0, 0xff, 0xff };
+        put_u32(tail + 5, adler);
+        write_chunk("IDAT", tail, sizeof(tail));
+        write_chunk("IEND", nullptr, 0);
+    }
+    ok = fclose(file) == 0 && ok;
+    file = nullptr;
+    return ok;
+}
+
+#endif
@@ -0,0 +1,397 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include "rtweekend.h"
+#include "scene.h"
+#include "parallel.h"
+#include "sampler.h"
+#include "checkpoint.h"
+#include "trace.h"
+#include "arena.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct progressive_options {
+    // wall-clock limit in seconds, 0 for none
+    double time_budget = 10;
+    // a tile is done once the standard error of the mean luminance of its worst pixel drops below
+    // this (1/512 is half an 8-bit step)
+    double target_noise = 1.0 / 512;
+    // samples every pixel gets before its variance estimate is trusted
+    int min_samples = 4;
+    // seconds between snapshots of the image so far, 0 for none
+    double snapshot_interval = 2;
+    int max_samples = 256;
+    int tile_size = 16;
+    // where in the pixel each sample goes, see sampler.h
+    sampler_kind sampling = sampler_kind::sobol;
+    uint32_t seed = 0;
+    // where to keep the render state, empty for no checkpoints; it's written every
+    // checkpoint_interval seconds (0 for never) and once more when the render stops
+    std::string checkpoint_file;
+    double checkpoint_interval = 0;
+    // start from checkpoint_file if it holds a render of the same scene with the same settings
+    bool resume = false;
+    // identifies the scene in checkpoints
+    uint64_t scene_hash = 0;
+};
+
+struct progressive_stats {
+    int passes = 0;
+    long long samples = 0;
+    int tiles = 0;
+    int converged_tiles = 0;
+    int snapshots = 0;
+    int checkpoints = 0;
+    // samples that came from a checkpoint rather than this run
+    long long resumed_samples = 0;
+    double seconds = 0;
+    const char* stopped_by = "";
+
+    void print(std::ostream& out) const {
+        out << "Progressive:     " << passes << " passes in " << seconds << " s, stopped by " << stopped_by << "\n"
+            << "  samples:       " << samples << "\n"
+            << "  tiles:         " << converged_tiles << " of " << tiles << " below the noise target\n"
+            << "  snapshots:     " << snapshots << "\n";
+        if (checkpoints > 0) out << "  checkpoints:   " << checkpoints << "\n";
+        if (resumed_samples > 0) out << "  resumed:       " << resumed_samples << " samples from the checkpoint\n";
+    }
+};
+
+// Renders in passes, accumulating into a float framebuffer. Every tile starts with min_samples
+// per pixel so it has a variance estimate; after that each pass only revisits tiles still above
+// the noise target, and gives each the samples its error says it needs (at most doubling per pass,
+// so the estimate gets refreshed). Workers check the clock before each tile, so a budget stops
+// the render between tiles. Finished tiles are published to a display buffer under a per-tile
+// lock, which is all a snapshot or checkpoint ever waits on; workers never stop for one.
+// Which samples a tile gets next only depends on that tile's own count and error, so a render
+// resumed from a checkpoint (which only ever holds whole tiles) ends up with the same samples in
+// every pixel as one that ran straight through.
+class progressive_renderer {
+public:
+    // radiance(r, worker) traces one camera ray; snapshot gets a copy of the image so far
+    typedef std::function<color(const ray&, int)> radiance_fn;
+    typedef std::function<void(const std::vector<color>&)> snapshot_fn;
+
+    progressive_renderer(const scene& s, int threads, const progressive_options& o)
+        : sc(s), num_threads(threads), options(o), pixel_sampler(o.sampling, o.seed) {}
+
+    progressive_stats render(const radiance_fn& radiance, const snapshot_fn& snapshot, std::vector<color>& pixels);
+
+private:
+    struct tile {
+        int x0, y0, x1, y1;
+        int samples = 0;
+        double error = infinity;
+        // samples to add in the current pass
+        int pending = 0;
+    };
+
+    void render_tile(tile& t, int worker, const radiance_fn& radiance, const camera& cam);
+    void copy_display(std::vector<color>& out);
+    render_checkpoint checkpoint_settings() const;
+    render_checkpoint make_checkpoint();
+    // false if c was made with different settings
+    bool restore(const render_checkpoint& c);
+
+    const scene& sc;
+    int num_threads;
+    progressive_options options;
+    // sample k of pixel p only depends on (p, k), so the image doesn't depend on which worker
+    // renders which tile
+    sampler pixel_sampler;
+
+    std::vector<tile> tiles;
+    std::unique_ptr<std::mutex[]> tile_locks;
+    // per pixel running sums; luminance sums give the variance
+    std::vector<color> sum;
+    std::vector<double> lum_sum, lum_sq;
+    std::vector<color> display;
+    // per worker, reset for every tile: the tile's copies of the sums
+    std::vector<memory_arena> tile_arenas;
+};
+
+progressive_stats progressive_renderer::render(const radiance_fn& radiance, const snapshot_fn& snapshot, std::vector<color>& pixels) {
+    // the per-pixel sums are the image being refined, the rest is small
+    memory_scope framebufferMemory(memory_tag::framebuffer);
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    auto deadline = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(options.time_budget));
+    bool has_deadline = options.time_budget > 0;
+
+    const int w = sc.width, h = sc.height, ts = options.tile_size;
+    size_t n = size_t(w) * h;
+    sum.assign(n, color(0, 0, 0));
+    lum_sum.assign(n, 0);
+    lum_sq.assign(n, 0);
+    display.assign(n, color(0, 0, 0));
+    // tiles only cover the part of the image being rendered
+    const pixel_rect region = sc.render_region();
+    tiles.clear();
+    for (int y = region.y0; y < region.y1; y += ts)
+        for (int x = region.x0; x < region.x1; x += ts)
+            tiles.push_back({ x, y, std::min(region.x1, x + ts), std::min(region.y1, y + ts) });
+    tile_locks.reset(new std::mutex[tiles.size()]);
+    tile_arenas.assign(std::max(1, num_threads), memory_arena(16 * 1024));
+
+    progressive_stats stats;
+    stats.tiles = static_cast<int>(tiles.size());
+    camera cam = sc.make_camera();
+
+    bool checkpointing = !options.checkpoint_file.empty();
+    if (options.resume && checkpointing) {
+        render_checkpoint saved;
+        if (!saved.load(options.checkpoint_file)) std::cerr << "Starting from scratch\n";
+        else if (!restore(saved)) std::cerr << "Checkpoint " << options.checkpoint_file << " is for a different scene or settings, starting from scratch\n";
+        else {
+            for (const tile& t : tiles)
+                stats.resumed_samples += static_cast<long long>(t.x1 - t.x0) * (t.y1 - t.y0) * t.samples;
+            std::cout << "Resumed from " << options.checkpoint_file << "\n";
+        }
+    }
+
+    // snapshots and checkpoints come from their own threads so the workers never wait for a file
+    // to be written
+    std::atomic<bool> done(false);
+    std::mutex background_mutex;
+    std::condition_variable background_cv;
+    auto every = [&](double seconds, std::function<void()> work) {
+        return std::thread([&, seconds, work]() {
+            memory_scope memory(memory_tag::framebuffer);
+            std::unique_lock<std::mutex> lock(background_mutex);
+            auto interval = std::chrono::duration<double>(seconds);
+            while (!background_cv.wait_for(lock, interval, [&]() { return done.load(); })) {
+                lock.unlock();
+                work();
+                lock.lock();
+            }
+        });
+    };
+    std::thread snapshotter, checkpointer;
+    std::vector<color> image;
+    if (options.snapshot_interval > 0 && snapshot) {
+        snapshotter = every(options.snapshot_interval, [&]() {
+            copy_display(image);
+            snapshot(image);
+            stats.snapshots++;
+        });
+    }
+    if (options.checkpoint_interval > 0 && checkpointing) {
+        checkpointer = every(options.checkpoint_interval, [&]() {
+            if (make_checkpoint().save(options.checkpoint_file)) stats.checkpoints++;
+        });
+    }
+
+    std::atomic<bool> out_of_time(false);
+    std::atomic<long long> samples(0);
+    stats.stopped_by = "max samples";
+    while (true) {
+        std::vector<int> work;
+        for (int i = 0; i < static_cast<int>(tiles.size()); i++) {
+            tile& t = tiles[i];
+            int want;
+            if (t.samples < options.min_samples) want = options.min_samples - t.samples;
+            else if (t.error <= options.target_noise || t.samples >= options.max_samples) want = 0;
+            else {
+                // error falls with sqrt(samples), so this many more should reach the target
+                double needed = t.samples * (t.error / options.target_noise) * (t.error / options.target_noise) - t.samples;
+                want = static_cast<int>(std::min(needed + 1, double(t.samples)));
+            }
+            t.pending = std::max(0, std::min(want, options.max_samples - t.samples));
+            if (t.pending > 0) work.push_back(i);
+        }
+        if (work.empty()) {
+            bool all_converged = std::all_of(tiles.begin(), tiles.end(), [&](const tile& t) { return t.error <= options.target_noise; });
+            if (all_converged) stats.stopped_by = "noise target";
+            break;
+        }
+
+        // noisiest tiles first, so a budget that runs out mid pass has spent it where it mattered
+        std::sort(work.begin(), work.end(), [&](int a, int b) { return tiles[a].error > tiles[b].error; });
+        parallel_for(static_cast<int>(work.size()), num_threads, [&](int worker, int k) {
+            if (out_of_time) return;
+            if (has_deadline && clock::now() >= deadline) {
+                out_of_time = true;
+                return;
+            }
+            tile& t = tiles[work[k]];
+            trace_span span("tile", "render", worker + 1);
+            if (active_trace()) span.args = trace_arg("x", t.x0) + ", " + trace_arg("y", t.y0) + ", " + trace_arg("samples", t.pending);
+            render_tile(t, worker, radiance, cam);
+            samples += static_cast<long long>(t.x1 - t.x0) * (t.y1 - t.y0) * t.pending;
+        });
+        stats.passes++;
+        if (out_of_time) {
+            stats.stopped_by = "time budget";
+            break;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(background_mutex);
+        done = true;
+    }
+    background_cv.notify_all();
+    if (snapshotter.joinable()) snapshotter.join();
+    if (checkpointer.joinable()) checkpointer.join();
+    // a budgeted render can be resumed later with more time
+    if (checkpointing && make_checkpoint().save(options.checkpoint_file)) stats.checkpoints++;
+
+    stats.samples = samples;
+    stats.converged_tiles = static_cast<int>(std::count_if(tiles.begin(), tiles.end(),
+        [&](const tile& t) { return t.error <= options.target_noise; }));
+    stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    copy_display(pixels);
+    return stats;
+}
+
+// adds t.pending samples to every pixel of t, re-estimates its error and publishes it. The sums
+// are built up in copies and only written back under the tile's lock, so a checkpoint never sees a
+// tile halfway through a pass.
+void progressive_renderer::render_tile(tile& t, int worker, const radiance_fn& radiance, const camera& cam) {
+    const int w = sc.width, h = sc.height;
+    const int tw = t.x1 - t.x0;
+    int n = t.samples + t.pending;
+    double error = 0;
+    if (n < 2) n = 2;
+
+    memory_arena& arena = tile_arenas[worker];
+    arena.reset();
+    const size_t tile_pixels = size_t(tw) * (t.y1 - t.y0);
+    color* tile_sum = arena.allocate_array<color>(tile_pixels);
+    double* tile_lum = arena.allocate_array<double>(tile_pixels);
+    double* tile_sq = arena.allocate_array<double>(tile_pixels);
+    for (int y = t.y0; y < t.y1; y++) {
+        size_t row = size_t(y) * w, q = size_t(y - t.y0) * tw;
+        std::copy(sum.begin() + row + t.x0, sum.begin() + row + t.x1, tile_sum + q);
+        std::copy(lum_sum.begin() + row + t.x0, lum_sum.begin() + row + t.x1, tile_lum + q);
+        std::copy(lum_sq.begin() + row + t.x0, lum_sq.begin() + row + t.x1, tile_sq + q);
+    }
+
+    for (int y = t.y0; y < t.y1; y++) {
+        for (int x = t.x0; x < t.x1; x++) {
+            size_t p = size_t(y) * w + x;
+            size_t q = size_t(y - t.y0) * tw + (x - t.x0);
+            for (int k = t.samples; k < n; k++) {
+                // dimensions 0 and 1 are the position in the pixel, centred on its sample position
+                double du, dv;
+                pixel_sampler.get_2d(static_cast<uint32_t>(p), k, 0, du, dv);
+                du -= 0.5;
+                dv -= 0.5;
+                color c = radiance(cam.get_ray((x + du) / (w - 1), (y + dv) / (h - 1)), worker);
+                tile_sum[q] += c;
+                double lum = 0.2126 * clamp(c.x(), 0.0, 1.0) + 0.7152 * clamp(c.y(), 0.0, 1.0) + 0.0722 * clamp(c.z(), 0.0, 1.0);
+                tile_lum[q] += lum;
+                tile_sq[q] += lum * lum;
+            }
+            // standard error of this pixel's mean
+            double mean = tile_lum[q] / n;
+            double variance = std::max(0.0, (tile_sq[q] - n * mean * mean) / (n - 1));
+            error = std::max(error, sqrt(variance / n));
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(tile_locks[&t - tiles.data()]);
+    t.pending = n - t.samples;
+    t.samples = n;
+    t.error = error;
+    for (int y = t.y0; y < t.y1; y++) {
+        for (int x = t.x0; x < t.x1; x++) {
+            size_t p = size_t(y) * w + x;
+            size_t q = size_t(y - t.y0) * tw + (x - t.x0);
+            sum[p] = tile_sum[q];
+            lum_sum[p] = tile_lum[q];
+            lum_sq[p] = tile_sq[q];
+            display[p] = sum[p] / n;
+        }
+    }
+}
+
+render_checkpoint progressive_renderer::checkpoint_settings() const {
+    render_checkpoint c;
+    c.scene_hash = options.scene_hash;
+    c.width = sc.width;
+    c.height = sc.height;
+    c.tile_size = options.tile_size;
+    pixel_rect region = sc.render_region();
+    c.region_x0 = region.x0;
+    c.region_y0 = region.y0;
+    c.region_x1 = region.x1;
+    c.region_y1 = region.y1;
+    c.min_samples = options.min_samples;
+    c.max_samples = options.max_samples;
+    c.target_noise = options.target_noise;
+    c.sampling = static_cast<int32_t>(options.sampling);
+    c.seed = options.seed;
+    return c;
+}
+
+// copies each tile under its lock, so every tile is as some pass left it
+render_checkpoint progressive_renderer::make_checkpoint() {
+    const int w = sc.width;
+    render_checkpoint c = checkpoint_settings();
+    c.tile_samples.resize(tiles.size());
+    c.tile_error.resize(tiles.size());
+    c.sums.resize(sum.size() * 5);
+    for (size_t i = 0; i < tiles.size(); i++) {
+        const tile& t = tiles[i];
+        std::lock_guard<std::mutex> lock(tile_locks[i]);
+        c.tile_samples[i] = t.samples;
+        c.tile_error[i] = t.error;
+        for (int y = t.y0; y < t.y1; y++) {
+            for (int x = t.x0; x < t.x1; x++) {
+                size_t p = size_t(y) * w + x;
+                double* out = &c.sums[p * 5];
+                out[0] = sum[p].x(); out[1] = sum[p].y(); out[2] = sum[p].z();
+                out[3] = lum_sum[p];
+                out[4] = lum_sq[p];
+            }
+        }
+    }
+    return c;
+}
+
+// only called before the workers start
+bool progressive_renderer::restore(const render_checkpoint& c) {
+    if (!c.same_settings(checkpoint_settings())) return false;
+    const int w = sc.width;
+    for (size_t i = 0; i < tiles.size(); i++) {
+        tile& t = tiles[i];
+        t.samples = c.tile_samples[i];
+        t.error = c.tile_error[i];
+        for (int y = t.y0; y < t.y1; y++) {
+            for (int x = t.x0; x < t.x1; x++) {
+                size_t p = size_t(y) * w + x;
+                const double* in = &c.sums[p * 5];
+                sum[p] = color(in[0], in[1], in[2]);
+                lum_sum[p] = in[3];
+                lum_sq[p] = in[4];
+                if (t.samples > 0) display[p] = sum[p] / t.samples;
+            }
+        }
+    }
+    return true;
+}
+
+void progressive_renderer::copy_display(std::vector<color>& out) {
+    const int w = sc.width;
+    out.resize(display.size());
+    for (size_t i = 0; i < tiles.size(); i++) {
+        const tile& t = tiles[i];
+        std::lock_guard<std::mutex> lock(tile_locks[i]);
+        for (int y = t.y0; y < t.y1; y++)
+            std::copy(display.begin() + size_t(y) * w + t.x0, display.begin() + size_t(y) * w + t.x1, out.begin() + size_t(y) * w + t.x0);
+    }
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef RAY_SORT_H
+#define RAY_SORT_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// spreads the low 10 bits of v out to every third bit
+inline uint64_t expand_bits(uint64_t v) {
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x30000ff;
+    v = (v | (v << 8)) & 0x300f00f;
+    v = (v | (v << 4)) & 0x30c30c3;
+    v = (v | (v << 2)) & 0x9249249;
+    return v;
+}
+
+// Sort key for a secondary ray: direction octant in the top 3 bits, then the Morton code of the
+// origin's cell in a 1024^3 grid over the scene bounds. Rays with equal high bits start close
+// together and head the same way, so they tend to walk the same bvh nodes.
+inline uint64_t ray_sort_key(const point3& origin, const vec3& dir, const aabb& bounds) {
+    uint64_t octant = (dir.x() < 0 ? 1 : 0) | (dir.y() < 0 ? 2 : 0) | (dir.z() < 0 ? 4 : 0);
+    uint64_t cell[3];
+    for (int a = 0; a < 3; a++) {
+        double extent = bounds.maximum[a] - bounds.minimum[a];
+        double x = extent > 0 ? (origin[a] - bounds.minimum[a]) / extent : 0;
+        cell[a] = static_cast<uint64_t>(clamp(x, 0.0, 1.0) * 1023.0);
+    }
+    uint64_t morton = (expand_bits(cell[0]) << 2) | (expand_bits(cell[1]) << 1) | expand_bits(cell[2]);
+    return (octant << 30) | morton;
+}
+
+// two keys are in the same coarse bin if they agree on the octant and the top 4 bits per axis
+// (a 16^3 grid); used to report how coherent a ray order is
+inline bool same_coarse_bin(uint64_t a, uint64_t b) {
+    return (a >> 18) == (b >> 18);
+}
+
+// reorders indices by key (stable, so equal keys keep their pixel order)
+inline void sort_by_key(std::vector<int>& indices, const std::vector<uint64_t>& keys) {
+    std::vector<std::pair<uint64_t, int>> order(indices.size());
+    for (size_t i = 0; i < indices.size(); i++) order[i] = { keys[i], indices[i] };
+    std::stable_sort(order.begin(), order.end(),
+        [](const std::pair<uint64_t, int>& a, const std::pair<uint64_t, int>& b) { return a.first < b.first; });
+    for (size_t i = 0; i < indices.size(); i++) indices[i] = order[i].second;
+}
+
+#endif
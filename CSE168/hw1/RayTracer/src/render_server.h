@@ -0,0 +1,195 @@
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include "rtweekend.h"
+#include "scene.h"
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <string>
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// A parsed scene and the acceleration structure built over its objects, everything a render needs
+// that doesn't depend on the camera, image size or render options.
+struct loaded_scene {
+    scene sc;
+    shared_ptr<hittable> world;
+};
+
+// Keeps the most recently used loaded scenes. A scene file counts as unchanged while its mtime and
+// size are; if they change its contents are hashed, and a file that was only touched (or saved with
+// the same bytes) keeps its entry. Not thread safe; the server handles one job at a time.
+class scene_cache {
+public:
+    // load parses the file and builds the world, null if it can't
+    typedef std::function<std::shared_ptr<loaded_scene>(const std::string& path)> load_fn;
+
+    scene_cache(size_t capacity, load_fn loader) : capacity(capacity < 1 ? 1 : capacity), load(loader) {}
+
+    // the scene for path, loaded if it isn't cached or the file changed; hit says which. Null if
+    // the file can't be read or loaded.
+    std::shared_ptr<const loaded_scene> get(const std::string& path, bool& hit);
+
+    size_t size() const { return entries.size(); }
+    long long hits = 0, misses = 0;
+
+private:
+    struct entry {
+        std::string path;
+        long long mtime, size;
+        uint64_t hash;
+        std::shared_ptr<const loaded_scene> value;
+    };
+
+    size_t capacity;
+    load_fn load;
+    // most recently used first
+    std::list<entry> entries;
+};
+
+std::shared_ptr<const loaded_scene> scene_cache::get(const std::string& path, bool& hit) {
+    hit = false;
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return nullptr;
+    long long mtime = static_cast<long long>(info.st_mtime), size = static_cast<long long>(info.st_size);
+
+    auto found = entries.begin();
+    while (found != entries.end() && found->path != path) ++found;
+    uint64_t hash = 0;
+    bool hashed = false;
+    if (found != entries.end()) {
+        bool same = found->mtime == mtime && found->size == size;
+        if (!same && (hashed = hash_file(path, hash)) && hash == found->hash) {
+            found->mtime = mtime;
+            found->size = size;
+            same = true;
+        }
+        if (same) {
+            entries.splice(entries.begin(), entries, found);
+            hits++;
+            hit = true;
+            return entries.front().value;
+        }
+        entries.erase(found);
+    }
+
+    misses++;
+    if (!hashed && !hash_file(path, hash)) return nullptr;
+    std::shared_ptr<const loaded_scene> value = load(path);
+    if (!value) return nullptr;
+    entries.push_front({ path, mtime, size, hash, value });
+    if (entries.size() > capacity) entries.pop_back();
+    return value;
+}
+
+#ifndef _WIN32
+
+// Listens on a Unix domain socket and answers jobs, one line each, from one client at a time (a
+// render already uses every core). handle gets each line and returns the whole reply; a client
+// can send any number of lines before hanging up. Returns when handle sets stop, or on an error.
+// A socket file left behind by an earlier server is replaced.
+inline bool serve_unix_socket(const std::string& path, const std::function<std::string(const std::string& line, bool& stop)>& handle) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path " << path << " is too long\n";
+        return false;
+    }
+    path.copy(address.sun_path, path.size());
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        std::cerr << "Unable to create a socket\n";
+        return false;
+    }
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) unlink(path.c_str());
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 8) != 0) {
+        std::cerr << "Unable to listen on " << path << "\n";
+        close(listener);
+        return false;
+    }
+    // a client that hangs up mid reply shouldn't take the server down
+    signal(SIGPIPE, SIG_IGN);
+    std::cout << "Listening on " << path << std::endl;
+
+    bool stop = false;
+    while (!stop) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) continue;
+        std::string pending;
+        char buffer[4096];
+        ssize_t got;
+        while (!stop && (got = read(client, buffer, sizeof(buffer))) > 0) {
+            pending.append(buffer, static_cast<size_t>(got));
+            size_t newline;
+            while (!stop && (newline = pending.find('\n')) != std::string::npos) {
+                std::string line = pending.substr(0, newline);
+                pending.erase(0, newline + 1);
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (line.empty()) continue;
+                std::string reply = handle(line, stop);
+                for (size_t sent = 0; sent < reply.size();) {
+                    ssize_t n = write(client, reply.data() + sent, reply.size() - sent);
+                    if (n <= 0) break;
+                    sent += static_cast<size_t>(n);
+                }
+            }
+        }
+        close(client);
+    }
+    close(listener);
+    unlink(path.c_str());
+    return true;
+}
+
+// Sends one job line to a server and copies the reply to out: the header line, then for an
+// "image N ..." reply the N bytes after it. False if the server can't be reached or hangs up early.
+inline bool submit_unix_socket(const std::string& path, const std::string& line, std::ostream& header, std::ostream& out) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    path.copy(address.sun_path, path.size());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return false;
+    }
+
+    std::string job = line + "\n";
+    bool ok = write(fd, job.data(), job.size()) == static_cast<ssize_t>(job.size());
+    std::string received;
+    char buffer[1 << 16];
+    ssize_t got;
+    size_t header_end = std::string::npos;
+    long long body = -1;
+    while (ok && (got = read(fd, buffer, sizeof(buffer))) > 0) {
+        received.append(buffer, static_cast<size_t>(got));
+        if (header_end == std::string::npos && (header_end = received.find('\n')) != std::string::npos) {
+            body = received.compare(0, 6, "image ") == 0 ? atoll(received.c_str() + 6) : 0;
+        }
+        if (header_end != std::string::npos && received.size() >= header_end + 1 + static_cast<size_t>(body)) break;
+    }
+    close(fd);
+    if (!ok || header_end == std::string::npos || received.size() < header_end + 1 + static_cast<size_t>(body)) return false;
+    header << received.substr(0, header_end + 1);
+    out.write(received.data() + header_end + 1, body);
+    return static_cast<bool>(out);
+}
+
+#endif
+
+#endif
@@ -5,6 +5,17 @@
 #include <limits>
 #include <memory>
 
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
+
+// SSE2 is always there on x64 (and on x86 with /arch:SSE2); the kernels that use it have plain
+// loops to fall back on otherwise
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RT_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
 
 // Usings
 
@@ -16,6 +27,8 @@ using std::sqrt;
 
 const double infinity = std::numeric_limits<double>::infinity();
 const double pi = 3.1415926535897932385;
+// secondary rays start this far off the surface along the normal so they don't hit it again
+const double ray_epsilon = 1e-4;
 
 // Utility Functions
 
@@ -23,6 +36,21 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+inline double clamp(double x, double min, double max) {
+    if (x < min) return min;
+    if (x > max) return max;
+    return x;
+}
+
+// hint the cache to start loading p; traversal calls this on the node it will visit next
+inline void prefetch(const void* p) {
+#if defined(_MSC_VER)
+    _mm_prefetch(static_cast<const char*>(p), _MM_HINT_T0);
+#else
+    __builtin_prefetch(p);
+#endif
+}
+
 // Common Headers
 
 #include "ray.h"
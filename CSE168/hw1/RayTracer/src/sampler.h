@@ -0,0 +1,180 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "rtweekend.h"
+
+#include <cstdint>
+
+// Every sample value is a pure function of (pixel, sample index, dimension, seed). There is no
+// generator state to share, lock or hand between threads, so any worker can draw any sample of any
+// pixel in any order and get the same bits: images come out identical for every thread count and
+// tile order. Dimensions are numbered by the caller (0-1 for the position in the pixel, the next
+// ones for whatever is sampled after that).
+
+// splitmix64's finalizer; every input bit flips about half the output bits
+inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// Chris Wellons' lowbias32
+inline uint32_t hash32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t v) {
+    return seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+// top 53 bits as a double in [0, 1)
+inline double u64_to_unit(uint64_t x) {
+    return (x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+inline double u32_to_unit(uint32_t x) {
+    return x * (1.0 / 4294967296.0);
+}
+
+// Counter-based RNG: the coordinates are the counter and the "random" number is their hash. The
+// inner hash spreads (seed, dimension) over all 64 bits before (pixel, index) is folded in, so
+// neighbouring pixels, samples and dimensions, which differ in only a few bits, come out unrelated.
+inline double counter_random(uint32_t pixel, uint32_t index, uint32_t dim, uint32_t seed = 0) {
+    uint64_t key = (uint64_t(pixel) << 32) | index;
+    uint64_t stream = mix64(((uint64_t(seed) << 32) | dim) + 0x9e3779b97f4a7c15ULL);
+    return u64_to_unit(mix64(key ^ stream));
+}
+
+// Direction numbers for the first four Sobol dimensions (Joe and Kuo's new-joe-kuo-6.21201; the
+// first is the van der Corput sequence). Sobol point i in dimension d is the xor of the numbers
+// for the set bits of i.
+static const uint32_t sobol_directions[4][32] = {
+    { 0x80000000, 0x40000000, 0x20000000, 0x10000000, 0x08000000, 0x04000000, 0x02000000, 0x01000000,
+      0x00800000, 0x00400000, 0x00200000, 0x00100000, 0x00080000, 0x00040000, 0x00020000, 0x00010000,
+      0x00008000, 0x00004000, 0x00002000, 0x00001000, 0x00000800, 0x00000400, 0x00000200, 0x00000100,
+      0x00000080, 0x00000040, 0x00000020, 0x00000010, 0x00000008, 0x00000004, 0x00000002, 0x00000001 },
+    { 0x80000000, 0xc0000000, 0xa0000000, 0xf0000000, 0x88000000, 0xcc000000, 0xaa000000, 0xff000000,
+      0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000, 0x88880000, 0xcccc0000, 0xaaaa0000, 0xffff0000,
+      0x80008000, 0xc000c000, 0xa000a000, 0xf000f000, 0x88008800, 0xcc00cc00, 0xaa00aa00, 0xff00ff00,
+      0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0, 0x88888888, 0xcccccccc, 0xaaaaaaaa, 0xffffffff },
+    { 0x80000000, 0xc0000000, 0x60000000, 0x90000000, 0xe8000000, 0x5c000000, 0x8e000000, 0xc5000000,
+      0x68800000, 0x9cc00000, 0xee600000, 0x55900000, 0x80680000, 0xc09c0000, 0x60ee0000, 0x90550000,
+      0xe8808000, 0x5cc0c000, 0x8e606000, 0xc5909000, 0x6868e800, 0x9c9c5c00, 0xeeee8e00, 0x5555c500,
+      0x8000e880, 0xc0005cc0, 0x60008e60, 0x9000c590, 0xe8006868, 0x5c009c9c, 0x8e00eeee, 0xc5005555 },
+    { 0x80000000, 0xc0000000, 0x20000000, 0x50000000, 0xf8000000, 0x74000000, 0xa2000000, 0x93000000,
+      0xd8800000, 0x25400000, 0x59e00000, 0xe6d00000, 0x78080000, 0xb40c0000, 0x82020000, 0xc3050000,
+      0x208f8000, 0x51474000, 0xfbea2000, 0x75d93000, 0xa0858800, 0x914e5400, 0xdbe79e00, 0x25db6d00,
+      0x58800080, 0xe54000c0, 0x79e00020, 0xb6d00050, 0x800800f8, 0xc00c0074, 0x200200a2, 0x50050093 },
+};
+
+// The xor over set bits done a byte at a time: table[d][b][v] is the xor of the direction numbers
+// for the set bits of byte value v in byte b of the index. Scrambled indices use all 32 bits, so
+// this is four lookups instead of a loop over up to 32 bits. 16 KB, built on first use.
+struct sobol_tables {
+    uint32_t table[4][4][256];
+
+    sobol_tables() {
+        for (int d = 0; d < 4; d++)
+            for (int b = 0; b < 4; b++)
+                for (int v = 0; v < 256; v++) {
+                    uint32_t x = 0;
+                    for (int bit = 0; bit < 8; bit++)
+                        if (v & (1 << bit)) x ^= sobol_directions[d][8 * b + bit];
+                    table[d][b][v] = x;
+                }
+    }
+
+    static const sobol_tables& get() {
+        static const sobol_tables tables;
+        return tables;
+    }
+};
+
+inline uint32_t sobol_sample(uint32_t index, int dim) {
+    const auto& t = sobol_tables::get().table[dim];
+    return t[0][index & 0xff] ^ t[1][(index >> 8) & 0xff] ^ t[2][(index >> 16) & 0xff] ^ t[3][index >> 24];
+}
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Hash in which each bit only depends on the bits below it (Laine and Karras, with Burley's
+// constants from "Practical Hash-based Owen Scrambling"). Applied to the reversed bits it becomes a
+// nested uniform (Owen) scramble: each bit of the value is flipped depending on the bits above it.
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return x;
+}
+
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+enum class sampler_kind { sobol, random };
+
+// Per pixel sample streams. sobol is Burley's shuffled, Owen-scrambled Sobol: dimensions come in
+// groups of four, each group a 4D Sobol sequence whose point order and values are scrambled with
+// seeds hashed from (seed, pixel, group). Every power-of-two prefix of a pixel's samples stays well
+// stratified, and pixels and groups are decorrelated from each other. random is the counter-based
+// RNG, for comparison and for anything that wants independent samples.
+class sampler {
+public:
+    sampler(sampler_kind k = sampler_kind::sobol, uint32_t s = 0) : kind(k), seed(s) {}
+
+    // dimension dim of sample index in pixel, in [0, 1)
+    double get_1d(uint32_t pixel, uint32_t index, uint32_t dim) const;
+    // dimensions dim and dim + 1; keep dim even so both come from the same Sobol group
+    void get_2d(uint32_t pixel, uint32_t index, uint32_t dim, double& u, double& v) const;
+
+public:
+    sampler_kind kind;
+    uint32_t seed;
+
+private:
+    uint32_t group_seed(uint32_t pixel, uint32_t group) const {
+        return hash32(hash_combine(hash_combine(seed, pixel), group));
+    }
+
+    double scrambled_sobol(uint32_t shuffled, uint32_t gseed, int d) const {
+        return u32_to_unit(nested_uniform_scramble(sobol_sample(shuffled, d), hash_combine(gseed, d)));
+    }
+};
+
+double sampler::get_1d(uint32_t pixel, uint32_t index, uint32_t dim) const {
+    if (kind == sampler_kind::random) return counter_random(pixel, index, dim, seed);
+
+    uint32_t gseed = group_seed(pixel, dim / 4);
+    return scrambled_sobol(nested_uniform_scramble(index, gseed), gseed, dim % 4);
+}
+
+void sampler::get_2d(uint32_t pixel, uint32_t index, uint32_t dim, double& u, double& v) const {
+    if (kind == sampler_kind::random || dim % 4 == 3) {
+        u = get_1d(pixel, index, dim);
+        v = get_1d(pixel, index, dim + 1);
+        return;
+    }
+    // both dimensions share the group's shuffled index
+    uint32_t gseed = group_seed(pixel, dim / 4);
+    uint32_t shuffled = nested_uniform_scramble(index, gseed);
+    u = scrambled_sobol(shuffled, gseed, dim % 4);
+    v = scrambled_sobol(shuffled, gseed, dim % 4 + 1);
+}
+
+#endif
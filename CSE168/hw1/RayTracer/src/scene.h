@@ -0,0 +1,132 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "light.h"
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// a rectangle of pixels, x1 and y1 exclusive
+struct pixel_rect {
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+    bool empty() const { return x1 <= x0 || y1 <= y0; }
+    bool contains(int x, int y) const { return x >= x0 && x < x1 && y >= y0 && y < y1; }
+};
+
+static const uint64_t fnv1a_basis = 14695981039346656037ULL;
+
+// 64-bit FNV-1a, continuing from hash (fnv1a_basis to start)
+inline uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// fnv1a of a whole file, false if it can't be read. Checkpoints, distributed workers and the render
+// server all identify scene files by this
+inline bool hash_file(const std::string& path, uint64_t& hash) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    hash = fnv1a_basis;
+    char buffer[1 << 16];
+    while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0)
+        hash = fnv1a(hash, buffer, static_cast<size_t>(in.gcount()));
+    return in.eof();
+}
+
+// everything ReadFile pulls out of a .test file
+class scene {
+public:
+    camera make_camera() const {
+        return camera(lookfrom, lookat, up, fovy, double(width) / height);
+    }
+
+    // the crop clamped to the image, in the renderers' rows (j = 0 at the bottom); the whole
+    // image if there's no crop or nothing of it is left after clamping
+    pixel_rect render_region() const {
+        pixel_rect r;
+        r.x0 = std::max(0, crop.x0);
+        r.x1 = std::min(width, crop.x1);
+        r.y0 = height - std::min(height, crop.y1);
+        r.y1 = height - std::max(0, crop.y0);
+        if (crop.empty() || r.empty()) {
+            r.x0 = r.y0 = 0;
+            r.x1 = width;
+            r.y1 = height;
+        }
+        return r;
+    }
+
+    // a primitive for objects, allocated from the scene's arena rather than on its own
+    template <class T, class... Args>
+    shared_ptr<T> make(Args&&... args) {
+        return std::allocate_shared<T>(arena_allocator<T>(storage), std::forward<Args>(args)...);
+    }
+
+    bool cropped() const {
+        pixel_rect r = render_region();
+        return r.width() != width || r.height() != height;
+    }
+
+    // ReadFile feeds this everything that decides where a primitive is and which material it uses
+    template <class T>
+    void hash_geometry(const T& value) { geometry_hash = fnv1a(geometry_hash, &value, sizeof(T)); }
+
+    // same for any two scenes whose camera rays all hit the same things, see gbuffer.h
+    uint64_t gbuffer_key() const {
+        uint64_t key = geometry_hash;
+        key = fnv1a(key, &lookfrom, sizeof(lookfrom));
+        key = fnv1a(key, &lookat, sizeof(lookat));
+        key = fnv1a(key, &up, sizeof(up));
+        key = fnv1a(key, &fovy, sizeof(fovy));
+        key = fnv1a(key, &width, sizeof(width));
+        return fnv1a(key, &height, sizeof(height));
+    }
+
+public:
+    // image
+    int width = 640;
+    int height = 480;
+    std::string output = "test.png";
+    // only render these pixels, y counting down from the top as in an image viewer; empty for
+    // the whole image
+    pixel_rect crop;
+    int maxdepth = 5;
+
+    // camera
+    point3 lookfrom = point3(0, 0, 1);
+    point3 lookat = point3(0, 0, 0);
+    vec3 up = vec3(0, 1, 0);
+    double fovy = 90;
+
+    // lights; attenuation is const, linear, quadratic and only affects point lights
+    std::vector<light> lights;
+    vec3 attenuation = vec3(1, 0, 0);
+
+    // every distinct material state that geometry was created with, hit_record::mat_id indexes this
+    std::vector<material> materials;
+
+    // geometry, in world space. The primitives live in storage, which copies of the scene share and
+    // every primitive keeps alive, so it's freed in one go when the last of them goes.
+    std::shared_ptr<memory_arena> storage = std::make_shared<memory_arena>();
+    uint64_t geometry_hash = fnv1a_basis;
+    std::vector<point3> vertices;
+    hittable_list objects;
+};
+
+#endif
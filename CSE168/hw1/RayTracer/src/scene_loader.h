@@ -0,0 +1,349 @@
+#ifndef SCENE_LOADER_H
+#define SCENE_LOADER_H
+
+#include "rtweekend.h"
+#include "sphere.h"
+#include "triangle.h"
+#include "transform.h"
+#include "scene.h"
+#include "trace.h"
+#include "memory_accounting.h"
+#include "scene_tokenizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stack>
+#include <string>
+
+using std::string;
+using std::stringstream;
+using std::ifstream;
+using std::stack;
+using std::cerr;
+
+// Taken from CS167X hw2
+// Function to read the input data values
+// Use is optional, but should be very helpful in parsing.  
+bool readvals(stringstream& s, const int numvals, float* values)
+{
+    for (int i = 0; i < numvals; i++) {
+        s >> values[i];
+        if (s.fail()) {
+            std::cout << "Failed reading value " << i << " will skip\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Spheres stay spheres under translate/rotate/uniform scale, so those get baked into center and radius.
+// Anything else (non-uniform scale) needs the ray moved into object space.
+shared_ptr<hittable> MakeSphere(scene& sc, const point3& center, double radius, int mat_id, const mat4& m) {
+	vec3 cx = m.transform_vector(vec3(1, 0, 0));
+	vec3 cy = m.transform_vector(vec3(0, 1, 0));
+	vec3 cz = m.transform_vector(vec3(0, 0, 1));
+	double s2 = cx.length_squared();
+	const double eps = 1e-9 * s2;
+	bool similarity = fabs(cy.length_squared() - s2) < eps && fabs(cz.length_squared() - s2) < eps
+		&& fabs(dot(cx, cy)) < eps && fabs(dot(cy, cz)) < eps && fabs(dot(cz, cx)) < eps;
+
+	if (similarity)
+		return sc.make<sphere>(m.transform_point(center), radius * sqrt(s2), mat_id);
+	return sc.make<transformed>(sc.make<sphere>(center, radius, mat_id), m);
+}
+
+// Materials only change between objects, so consecutive objects share an entry. A new entry starts
+// whenever a material command came since the last object (changed), whatever its values: the index
+// goes into the G-buffer key, so it has to follow the file's commands and not the values, or
+// editing one value could merge or split entries and renumber every object after it.
+int MaterialIndex(scene& sc, const material& m, bool& changed) {
+	if (sc.materials.empty() || changed)
+		sc.materials.push_back(m);
+	changed = false;
+	return static_cast<int>(sc.materials.size()) - 1;
+}
+
+// What ReadFile saw that the scene itself doesn't keep, for the scene statistics tool
+struct scene_file_stats {
+	long long lines = 0;
+	long long commands = 0;
+	long long unknown_commands = 0;
+	long long transform_commands = 0;
+	// deepest pushTransform nesting, 0 if there's none
+	int max_transform_depth = 0;
+	// tri commands dropped for a vertex index out of range
+	long long bad_triangles = 0;
+};
+
+// The commands ReadFile knows, as ids in SceneCommands()
+enum class scene_command {
+	size, crop, output, maxdepth, camera,
+	light, point, directional, attenuation,
+	ambient, emission, diffuse, shininess, specular,
+	push_transform, pop_transform, translate, scale, rotate,
+	sphere, tri, maxverts, vertex
+};
+
+const scene_file::command_table& SceneCommands() {
+	auto id = [](scene_command c) { return static_cast<int>(c); };
+	static const scene_file::command_table table{
+		{ "size", id(scene_command::size) }, { "crop", id(scene_command::crop) }, { "output", id(scene_command::output) },
+		{ "maxdepth", id(scene_command::maxdepth) }, { "camera", id(scene_command::camera) },
+		{ "light", id(scene_command::light) }, { "point", id(scene_command::point) },
+		{ "directional", id(scene_command::directional) }, { "attenuation", id(scene_command::attenuation) },
+		{ "ambient", id(scene_command::ambient) }, { "emission", id(scene_command::emission) },
+		{ "diffuse", id(scene_command::diffuse) }, { "shininess", id(scene_command::shininess) },
+		{ "specular", id(scene_command::specular) },
+		{ "pushTransform", id(scene_command::push_transform) }, { "popTransform", id(scene_command::pop_transform) },
+		{ "translate", id(scene_command::translate) }, { "scale", id(scene_command::scale) }, { "rotate", id(scene_command::rotate) },
+		{ "sphere", id(scene_command::sphere) }, { "tri", id(scene_command::tri) },
+		{ "maxverts", id(scene_command::maxverts) }, { "vertex", id(scene_command::vertex) },
+	};
+	return table;
+}
+
+// fileStats, if given, gets the counts above
+bool ReadFile(const char* filename, scene& sc, scene_file_stats* fileStats = nullptr) {
+	// the file's text is parser scratch, what the commands add is geometry
+	memory_scope parserMemory(memory_tag::parser);
+	scene_file_stats counts;
+	// the whole file is read before any of it is parsed, so a trace shows the two apart; after
+	// that lines and tokens are pointers into it, nothing is copied
+	trace_span reading("read file", "load");
+	reading.args = trace_arg("file", filename);
+	string text;
+	if (!scene_file::read_text_file(filename, text)) {
+		cerr << "Unable to Open Input Data File " << filename << "\n";
+		return false;
+	}
+	reading.end();
+	trace_span parsing("parse", "load");
+	// traced renders: time spent on transform stack commands, summed into one span at the end
+	const bool tracing = active_trace() != nullptr;
+	const trace_log::clock::time_point parseStart = tracing ? trace_log::clock::now() : trace_log::clock::time_point();
+	trace_log::clock::duration transformTime(0);
+
+	// I need to implement a matrix stack to store transforms.  
+	// This is done using standard STL Templates 
+	stack <mat4> transfstack;
+	transfstack.push(mat4());  // identity
+
+	// material state, applies to all geometry that follows
+	material currentMaterial;
+	// a material command since the last object, see MaterialIndex
+	bool materialChanged = true;
+
+	std::cout << "Reading file " << filename << std::endl;
+
+	scene_file::parse_counts lines = scene_file::parse_commands(text, SceneCommands(),
+		[&](int id, const scene_file::token& cmd, scene_file::line_tokenizer& args, const scene_file::token& line) {
+		memory_scope geometryMemory(memory_tag::geometry);
+		const trace_log::clock::time_point commandStart = tracing ? trace_log::clock::now() : trace_log::clock::time_point();
+
+		std::cout << line << '\n';
+
+		if (id == scene_file::command_table::unknown) {
+			cerr << "Unknown Command: " << cmd << "Skipping" << std::endl;
+			counts.unknown_commands++;
+			return;
+		}
+
+		float v[10]; // Position and color for light, colors for others
+		// Up to 10 params for cameras.  
+		switch (static_cast<scene_command>(id)) {
+		// Image size
+		case scene_command::size:
+			// width, height
+			if (args.read_floats(2, v)) {
+				sc.width = static_cast<int>(v[0]);
+				sc.height = static_cast<int>(v[1]);
+			}
+			break;
+		// Only render part of the image
+		case scene_command::crop:
+			// x0, y0, x1, y1 in pixels from the top left, x1 and y1 exclusive
+			if (args.read_floats(4, v)) {
+				sc.crop.x0 = static_cast<int>(v[0]);
+				sc.crop.y0 = static_cast<int>(v[1]);
+				sc.crop.x1 = static_cast<int>(v[2]);
+				sc.crop.y1 = static_cast<int>(v[3]);
+			}
+			break;
+		// Image file output
+		case scene_command::output: {
+			// "name.png"
+			scene_file::token name;
+			if (args.next(name)) sc.output.assign(name.begin, name.end);
+			break;
+		}
+		case scene_command::maxdepth:
+			if (args.read_floats(1, v)) {
+				sc.maxdepth = static_cast<int>(v[0]);
+			}
+			break;
+		// Camera
+		case scene_command::camera:
+			// lookFrom x, y, z; lookAt x, y, z; R, G, B, A
+			if (args.read_floats(10, v)) {
+				sc.lookfrom = vec3(v[0], v[1], v[2]);
+				sc.lookat = vec3(v[3], v[4], v[5]); // center of image
+				sc.up = unit_vector(vec3(v[6], v[7], v[8]));
+
+				sc.fovy = v[9];
+			}
+			break;
+		// Lights
+		case scene_command::light:
+			break;
+		case scene_command::point:
+		case scene_command::directional:
+			// x, y, z, r, g, b
+			if (args.read_floats(6, v)) {
+				light l;
+				l.directional = static_cast<scene_command>(id) == scene_command::directional;
+				l.position = vec3(v[0], v[1], v[2]);
+				l.col = color(v[3], v[4], v[5]);
+				sc.lights.push_back(l);
+			}
+			break;
+		case scene_command::attenuation:
+			// const, linear, quadratic
+			if (args.read_floats(3, v)) {
+				sc.attenuation = vec3(v[0], v[1], v[2]);
+			}
+			break;
+		// Materials
+		case scene_command::ambient:
+			if (args.read_floats(3, v)) {
+				currentMaterial.ambient = color(v[0], v[1], v[2]);
+				materialChanged = true;
+			}
+			break;
+		case scene_command::emission:
+			if (args.read_floats(3, v)) {
+				currentMaterial.emission = color(v[0], v[1], v[2]);
+				materialChanged = true;
+			}
+			break;
+		case scene_command::diffuse:
+			if (args.read_floats(3, v)) {
+				currentMaterial.diffuse = color(v[0], v[1], v[2]);
+				materialChanged = true;
+			}
+			break;
+		case scene_command::shininess:
+			if (args.read_floats(1, v)) {
+				currentMaterial.shininess = v[0];
+				materialChanged = true;
+			}
+			break;
+		case scene_command::specular:
+			if (args.read_floats(3, v)) {
+				currentMaterial.specular = color(v[0], v[1], v[2]);
+				materialChanged = true;
+			}
+			break;
+		// Matrix access
+		case scene_command::push_transform:
+			transfstack.push(transfstack.top());
+			counts.max_transform_depth = std::max(counts.max_transform_depth, static_cast<int>(transfstack.size()) - 1);
+			break;
+		case scene_command::pop_transform:
+			if (transfstack.size() <= 1) {
+				cerr << "Stack has no elements.  Cannot Pop\n";
+			}
+			else {
+				transfstack.pop();
+			}
+			break;
+		// Transformation matrices
+		// like OpenGL, commands right-multiply the top of the stack
+		case scene_command::translate:
+			if (args.read_floats(3, v)) {
+				transfstack.top() = transfstack.top() * translation(v[0], v[1], v[2]);
+			}
+			break;
+		case scene_command::scale:
+			if (args.read_floats(3, v)) {
+				transfstack.top() = transfstack.top() * scaling(v[0], v[1], v[2]);
+			}
+			break;
+		case scene_command::rotate:
+			if (args.read_floats(4, v)) {
+				transfstack.top() = transfstack.top() * rotation(vec3(v[0], v[1], v[2]), v[3]);
+			}
+			break;
+		// Geometry
+		case scene_command::sphere:
+			// x, y, z, radius
+			if (args.read_floats(4, v)) {
+				point3 center(v[0], v[1], v[2]);
+				int mat = MaterialIndex(sc, currentMaterial, materialChanged);
+				sc.objects.add(MakeSphere(sc, center, v[3], mat, transfstack.top()));
+				sc.hash_geometry(center);
+				sc.hash_geometry(v[3]);
+				sc.hash_geometry(transfstack.top());
+				sc.hash_geometry(mat);
+			}
+			break;
+		case scene_command::tri:
+			// indices into the vertex list, vertices are moved into world space here
+			if (args.read_floats(3, v)) {
+				int n = static_cast<int>(sc.vertices.size());
+				int a = static_cast<int>(v[0]), b = static_cast<int>(v[1]), c = static_cast<int>(v[2]);
+				if (a < 0 || b < 0 || c < 0 || a >= n || b >= n || c >= n) {
+					cerr << "Vertex index out of range: " << line << "\n";
+					counts.bad_triangles++;
+				}
+				else {
+					const mat4& m = transfstack.top();
+					point3 corners[3] = { m.transform_point(sc.vertices[a]), m.transform_point(sc.vertices[b]), m.transform_point(sc.vertices[c]) };
+					int mat = MaterialIndex(sc, currentMaterial, materialChanged);
+					sc.objects.add(sc.make<triangle>(corners[0], corners[1], corners[2], mat));
+					sc.hash_geometry(corners);
+					sc.hash_geometry(mat);
+				}
+			}
+			break;
+		case scene_command::maxverts:
+			if (args.read_floats(1, v)) {
+				sc.vertices.reserve(static_cast<int>(v[0]));
+			}
+			break;
+		case scene_command::vertex:
+			if (args.read_floats(3, v)) {
+				sc.vertices.push_back(point3(v[0], v[1], v[2]));
+			}
+			break;
+		}
+
+		switch (static_cast<scene_command>(id)) {
+		case scene_command::push_transform:
+		case scene_command::pop_transform:
+		case scene_command::translate:
+		case scene_command::scale:
+		case scene_command::rotate:
+			counts.transform_commands++;
+			if (tracing) transformTime += trace_log::clock::now() - commandStart;
+			break;
+		default:
+			break;
+		}
+	});
+	counts.lines = lines.lines;
+	counts.commands = lines.commands;
+
+	if (tracing) {
+		// not one stretch of time, so it's drawn from the start of parsing for as long as all of it took
+		active_trace()->span("transform stack", "load", trace_lane(), parseStart, parseStart + transformTime,
+			trace_arg("commands", counts.transform_commands) + ", \"summed\": true");
+	}
+	parsing.args = trace_arg("primitives", static_cast<long long>(sc.objects.objects.size()));
+	if (fileStats) *fileStats = counts;
+	return true;
+}
+
+#endif
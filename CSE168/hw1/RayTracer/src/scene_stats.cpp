@@ -0,0 +1,240 @@
+// SceneStats: loads a scene file and reports what's in it, the memory each part takes and how good
+// a BVH it gets, without rendering anything, so pathological inputs can be spotted before they go
+// to the render queue.
+//
+//     SceneStats scene.test [--accel bvh|sbvh] [--leaf N]
+
+#include <iostream>
+#include "rtweekend.h"
+#include "sphere.h"
+#include "triangle.h"
+#include "transform.h"
+#include "bvh.h"
+#include "compressed_bvh.h"
+#include "scene.h"
+#include "scene_loader.h"
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+
+using namespace std;
+
+// bvh and compressed_bvh traversal keep this many nodes on their stacks; compressed_bvh takes a
+// bigger one from the heap when it has to
+const int traversal_stack_size = 64;
+
+struct primitive_counts {
+	long long spheres = 0;
+	// non-uniformly scaled, tested through a transformed wrapper
+	long long transformedSpheres = 0;
+	long long triangles = 0;
+	// zero area or collinear corners: never hit, but still cost a test
+	long long degenerateTriangles = 0;
+	long long other = 0;
+};
+
+// what a scene::make object costs in the scene's arena: the object and the shared_ptr control
+// block next to it, which holds the counts and a copy of the arena allocator
+template <typename T>
+size_t SharedSize() {
+	return sizeof(T) + 2 * sizeof(void*) + sizeof(arena_allocator<T>);
+}
+
+primitive_counts CountPrimitives(const scene& sc) {
+	primitive_counts counts;
+	for (const auto& object : sc.objects.objects) {
+		if (dynamic_cast<const sphere*>(object.get())) counts.spheres++;
+		else if (dynamic_cast<const transformed*>(object.get())) counts.transformedSpheres++;
+		else if (const triangle* t = dynamic_cast<const triangle*>(object.get())) {
+			counts.triangles++;
+			vec3 e1 = t->v1 - t->v0, e2 = t->v2 - t->v0;
+			if (cross(e1, e2).length() <= 1e-12 * e1.length() * e2.length()) counts.degenerateTriangles++;
+		}
+		else counts.other++;
+	}
+	return counts;
+}
+
+void PrintMemoryRow(const char* name, size_t bytes, const string& note = "") {
+	char line[160];
+	snprintf(line, sizeof(line), "  %-22s %12.1f KB  %s\n", name, bytes / 1024.0, note.c_str());
+	cout << line;
+}
+
+// one line of a histogram, with a bar scaled to the biggest bucket
+void PrintHistogramRow(const string& label, long long count, long long biggest) {
+	char line[160];
+	int bar = biggest > 0 ? static_cast<int>(40.0 * count / biggest + 0.5) : 0;
+	snprintf(line, sizeof(line), "  %-8s %10lld  %s\n", label.c_str(), count, string(bar, '#').c_str());
+	cout << line;
+}
+
+struct tree_shape {
+	std::map<int, long long> leafSizes;
+	std::map<int, long long> leafDepths;
+	// interior nodes whose children's boxes overlap
+	long long overlapping = 0, interior = 0;
+	// sum over interior nodes of overlap area / root area: how many nodes a random ray through the
+	// scene has to search both children of because it's in space they share
+	double weightedOverlap = 0;
+	// worst overlap / smaller child's area of any interior node
+	double worstOverlap = 0;
+	// leaves bigger than the build's max leaf size, made when every centroid is in the same spot
+	long long oversizedLeaves = 0;
+};
+
+tree_shape MeasureTree(const bvh& tree, int maxLeafSize) {
+	tree_shape shape;
+	if (tree.nodes.empty()) return shape;
+	const double rootArea = tree.nodes[0].box.surface_area();
+
+	// the flattened layout keeps a node's first child right after it, the second at offset
+	std::vector<std::pair<int, int>> pending(1, std::make_pair(0, 0));
+	while (!pending.empty()) {
+		int index = pending.back().first, depth = pending.back().second;
+		pending.pop_back();
+		const bvh_node& node = tree.nodes[index];
+		if (node.count > 0) {
+			shape.leafSizes[node.count]++;
+			shape.leafDepths[depth]++;
+			if (node.count > maxLeafSize) shape.oversizedLeaves++;
+			continue;
+		}
+
+		const aabb& left = tree.nodes[index + 1].box;
+		const aabb& right = tree.nodes[node.offset].box;
+		double overlap = intersection(left, right).surface_area();
+		shape.interior++;
+		if (overlap > 0) {
+			shape.overlapping++;
+			if (rootArea > 0) shape.weightedOverlap += overlap / rootArea;
+			double smaller = min(left.surface_area(), right.surface_area());
+			if (smaller > 0) shape.worstOverlap = max(shape.worstOverlap, overlap / smaller);
+		}
+		pending.push_back(std::make_pair(index + 1, depth + 1));
+		pending.push_back(std::make_pair(node.offset, depth + 1));
+	}
+	return shape;
+}
+
+int main(int argc, char* argv[]) {
+	string filename;
+	string accel = "bvh";
+	bvh_build_options options;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--accel" && i + 1 < argc) accel = argv[++i];
+		else if (arg == "--leaf" && i + 1 < argc) options.max_leaf_size = max(1, atoi(argv[++i]));
+		else filename = arg;
+	}
+	if (filename.empty()) {
+		cerr << "Usage: SceneStats scene.test [--accel bvh|sbvh] [--leaf N]\n";
+		return 1;
+	}
+	options.spatial_splits = accel == "sbvh";
+
+	// ReadFile echoes every line, which isn't what this is for
+	scene sc;
+	scene_file_stats file;
+	std::streambuf* console = cout.rdbuf(nullptr);
+	bool loaded = ReadFile(filename.c_str(), sc, &file);
+	cout.rdbuf(console);
+	cout.clear();
+	if (!loaded) return 1;
+
+	primitive_counts prims = CountPrimitives(sc);
+	long long pointLights = 0;
+	for (const light& l : sc.lights) pointLights += !l.directional;
+
+	cout << filename << "\n\n"
+		<< "Scene file\n"
+		<< "  lines:                " << file.lines << " (" << file.commands << " commands, " << file.unknown_commands << " unknown)\n"
+		<< "  transform commands:   " << file.transform_commands << ", stack up to " << file.max_transform_depth << " deep\n"
+		<< "  image:                " << sc.width << "x" << sc.height << ", maxdepth " << sc.maxdepth << "\n\n"
+		<< "Primitives\n"
+		<< "  spheres:              " << prims.spheres << "\n"
+		<< "  transformed spheres:  " << prims.transformedSpheres << " (non-uniform scale, rays moved to object space)\n"
+		<< "  triangles:            " << prims.triangles << " (" << prims.degenerateTriangles << " degenerate, "
+		<< file.bad_triangles << " dropped for bad vertex indices)\n";
+	if (prims.other > 0) cout << "  other:                " << prims.other << "\n";
+	cout << "  vertices:             " << sc.vertices.size() << "\n"
+		<< "  materials:            " << sc.materials.size() << "\n"
+		<< "  lights:               " << sc.lights.size() << " (" << pointLights << " point, " << sc.lights.size() - pointLights << " directional)\n\n";
+
+	auto start = std::chrono::steady_clock::now();
+	memory_scope accelerationMemory(memory_tag::acceleration);
+	bvh tree(sc.objects, options);
+	compressed_bvh small(tree);
+	double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	// triangles keep their world space corners, the vertex list is only needed while parsing
+	cout << "Memory\n";
+	PrintMemoryRow("vertex list", sc.vertices.capacity() * sizeof(point3), "parse time only, triangles store their corners");
+	PrintMemoryRow("triangles", prims.triangles * SharedSize<triangle>(), "no index buffer");
+	PrintMemoryRow("spheres", prims.spheres * SharedSize<sphere>() + prims.transformedSpheres * (SharedSize<transformed>() + SharedSize<sphere>()));
+	PrintMemoryRow("object list", sc.objects.objects.capacity() * sizeof(shared_ptr<hittable>));
+	PrintMemoryRow("scene arena", sc.storage->capacity(), "holds the triangles and spheres");
+	PrintMemoryRow("materials", sc.materials.capacity() * sizeof(material));
+	PrintMemoryRow("lights", sc.lights.capacity() * sizeof(light));
+	PrintMemoryRow("bvh nodes", tree.nodes.size() * sizeof(bvh_node), to_string(tree.nodes.size()) + " nodes of " + to_string(sizeof(bvh_node)) + " bytes");
+	PrintMemoryRow("bvh references", tree.prim_refs.size() * sizeof(int) + tree.objects.capacity() * sizeof(shared_ptr<hittable>));
+	PrintMemoryRow("bvh sphere packets", tree.packets.size() * sizeof(sphere_packet));
+	PrintMemoryRow("compressed bvh", small.memory_bytes(), "instead of the bvh with --compress");
+	// what was actually allocated, by tag, with both bvhs built
+	cout << "\nMeasured heap\n";
+	print_memory_usage(stdout);
+	cout << "\n";
+
+	cout << accel << " (both builds " << buildMs << " ms)\n";
+	tree.stats.print(cout);
+
+	tree_shape shape = MeasureTree(tree, options.max_leaf_size);
+	long long biggest = 0;
+	for (const auto& bucket : shape.leafSizes) biggest = max(biggest, bucket.second);
+	cout << "\nLeaf sizes (primitives: leaves)\n";
+	for (const auto& bucket : shape.leafSizes) PrintHistogramRow(to_string(bucket.first), bucket.second, biggest);
+
+	biggest = 0;
+	double meanDepth = 0;
+	for (const auto& bucket : shape.leafDepths) {
+		biggest = max(biggest, bucket.second);
+		meanDepth += double(bucket.first) * bucket.second;
+	}
+	if (tree.stats.leaves > 0) meanDepth /= tree.stats.leaves;
+	cout << "\nLeaf depths (depth: leaves), mean " << meanDepth << "\n";
+	for (const auto& bucket : shape.leafDepths) PrintHistogramRow(to_string(bucket.first), bucket.second, biggest);
+
+	cout << "\nChild overlap\n"
+		<< "  overlapping nodes:    " << shape.overlapping << " of " << shape.interior << " interior ("
+		<< (shape.interior ? 100.0 * shape.overlapping / shape.interior : 0) << "%)\n"
+		<< "  area weighted:        " << shape.weightedOverlap << " (" << (tree.stats.sah_cost > 0 ? 100 * shape.weightedOverlap / tree.stats.sah_cost : 0)
+		<< "% of the SAH cost)\n"
+		<< "  worst:                " << 100 * shape.worstOverlap << "% of the smaller child\n";
+
+	// anything that makes a scene slow or wrong to render
+	std::vector<string> warnings;
+	if (tree.stats.max_depth >= traversal_stack_size)
+		warnings.push_back("bvh is " + to_string(tree.stats.max_depth) + " deep, more than the traversal stack of " + to_string(traversal_stack_size) + " holds");
+	if (small.max_depth > traversal_stack_size)
+		warnings.push_back("compressed bvh is " + to_string(small.max_depth) + " deep after splitting big leaves, more than the traversal stack of " + to_string(traversal_stack_size) + " holds, so --compress traversal uses a slower per-thread one");
+	if (shape.oversizedLeaves > 0)
+		warnings.push_back(to_string(shape.oversizedLeaves) + " leaves over " + to_string(options.max_leaf_size) + " primitives (primitives with coincident centroids can't be split)");
+	if (prims.degenerateTriangles > 0)
+		warnings.push_back(to_string(prims.degenerateTriangles) + " degenerate triangles");
+	if (file.bad_triangles > 0 || file.unknown_commands > 0)
+		warnings.push_back(to_string(file.bad_triangles) + " bad triangles and " + to_string(file.unknown_commands) + " unknown commands were skipped");
+	// meshes usually come in around 10-15%
+	if (shape.weightedOverlap > 0.3 * tree.stats.sah_cost)
+		warnings.push_back("children overlap for " + to_string(static_cast<int>(100 * shape.weightedOverlap / tree.stats.sah_cost)) + "% of the SAH cost; try --accel sbvh");
+	if (prims.transformedSpheres > 0 && prims.transformedSpheres * 2 > prims.spheres)
+		warnings.push_back("most spheres are non-uniformly scaled, so they don't go in sphere packets");
+	if (sc.lights.empty())
+		warnings.push_back("no lights, only ambient and emission will show");
+
+	cout << "\n" << (warnings.empty() ? "No problems found\n" : "Warnings\n");
+	for (const string& w : warnings) cout << "  " << w << "\n";
+	return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef SHADOW_CACHE_H
+#define SHADOW_CACHE_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+
+#include <vector>
+
+// Remembers, per light, the primitive that last blocked a shadow ray toward it. Neighbouring
+// shading points are usually shadowed by the same thing, so trying that one primitive first skips
+// the full traversal most of the time. Any hit in range means the light is blocked, so the answer
+// is the same as without the cache. Not thread safe: keep one per worker.
+class shadow_cache {
+public:
+    shadow_cache() {}
+    shadow_cache(int num_lights, bool on = true) : occluders(num_lights, nullptr), enabled(on) {}
+
+    // true if anything in world blocks r in (0, t_max)
+    bool occluded(const hittable& world, int light, const ray& r, double t_max);
+
+public:
+    std::vector<const hittable*> occluders;
+    bool enabled = true;
+    long long tests = 0;
+    long long blocked = 0;
+    // blocked rays that the cached occluder answered
+    long long hits = 0;
+};
+
+bool shadow_cache::occluded(const hittable& world, int light, const ray& r, double t_max) {
+    hit_record rec;
+    tests++;
+
+    const hittable* last = enabled ? occluders[light] : nullptr;
+    if (last && last->hit(r, 0, t_max, rec)) {
+        blocked++;
+        hits++;
+        return true;
+    }
+
+    bool is_blocked = world.hit(r, 0, t_max, rec);
+    if (enabled) occluders[light] = is_blocked ? rec.object : nullptr;
+    if (is_blocked) blocked++;
+    return is_blocked;
+}
+
+#endif
@@ -7,14 +7,19 @@
 class sphere : public hittable {
 public:
     sphere() {}
-    sphere(point3 cen, double r) : center(cen), radius(r) {};
+    sphere(point3 cen, double r, int m = 0) : center(cen), radius(r), mat_id(m) {};
 
     virtual bool hit(
         const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
+
+    // fills rec for a hit at t along r, for callers that solved for t themselves
+    void set_hit_record(const ray& r, double t, hit_record& rec) const;
 
 public:
     point3 center;
     double radius;
+    int mat_id;
 };
 
 bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
@@ -35,11 +40,23 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
             return false;
     }
 
-    rec.t = root;
+    set_hit_record(r, root, rec);
+    return true;
+}
+
+void sphere::set_hit_record(const ray& r, double t, hit_record& rec) const {
+    rec.t = t;
     rec.p = r.at(rec.t);
     vec3 outward_normal = (rec.p - center) / radius;
     rec.set_face_normal(r, outward_normal);
+    rec.mat_id = mat_id;
+    rec.object = this;
+}
 
+bool sphere::bounding_box(aabb& output_box) const {
+    output_box = aabb(
+        center - vec3(radius, radius, radius),
+        center + vec3(radius, radius, radius));
     return true;
 }
 
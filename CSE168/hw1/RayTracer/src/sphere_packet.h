@@ -0,0 +1,123 @@
+#ifndef SPHERE_PACKET_H
+#define SPHERE_PACKET_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// Up to four spheres in structure-of-arrays form so one ray can be tested against all of them at
+// once. Built by the bvh for leaves that only hold spheres; unused lanes repeat the last sphere, which
+// can only tie with it and a tie keeps the same primitive.
+struct sphere_packet {
+    static const int width = 4;
+
+    double cx[width], cy[width], cz[width];
+    double r2[width];
+    // index into the bvh's object list, per lane
+    int prim[width];
+
+    // closest root in [t_min, t_max] of any lane; returns the lane or -1
+    // same arithmetic as sphere::hit, so it picks the same t
+    int hit(const ray& r, double t_min, double t_max, double& t_hit) const;
+};
+
+int sphere_packet::hit(const ray& r, double t_min, double t_max, double& t_hit) const {
+    point3 o = r.origin();
+    vec3 d = r.direction();
+    double a = d.length_squared();
+    // the packets themselves sit in a std::vector, which only promises malloc alignment, so their
+    // lanes are read with unaligned loads; this local array can be aligned
+    alignas(32) double t[width];
+    // bit k set if lane k has a root in range
+    int mask = 0;
+
+#if defined(__AVX__)
+    __m256d ox = _mm256_set1_pd(o.x()), oy = _mm256_set1_pd(o.y()), oz = _mm256_set1_pd(o.z());
+    __m256d dx = _mm256_set1_pd(d.x()), dy = _mm256_set1_pd(d.y()), dz = _mm256_set1_pd(d.z());
+    __m256d va = _mm256_set1_pd(a);
+    __m256d vmin = _mm256_set1_pd(t_min), vmax = _mm256_set1_pd(t_max);
+
+    __m256d ocx = _mm256_sub_pd(ox, _mm256_loadu_pd(cx));
+    __m256d ocy = _mm256_sub_pd(oy, _mm256_loadu_pd(cy));
+    __m256d ocz = _mm256_sub_pd(oz, _mm256_loadu_pd(cz));
+    __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)), _mm256_mul_pd(ocz, dz));
+    __m256d oc2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz));
+    __m256d c = _mm256_sub_pd(oc2, _mm256_loadu_pd(r2));
+    __m256d disc = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(va, c));
+
+    __m256d valid = _mm256_cmp_pd(disc, _mm256_setzero_pd(), _CMP_GE_OQ);
+    __m256d sqrtd = _mm256_sqrt_pd(_mm256_max_pd(disc, _mm256_setzero_pd()));
+    __m256d neg_b = _mm256_sub_pd(_mm256_setzero_pd(), half_b);
+    __m256d t0 = _mm256_div_pd(_mm256_sub_pd(neg_b, sqrtd), va);
+    __m256d t1 = _mm256_div_pd(_mm256_add_pd(neg_b, sqrtd), va);
+
+    // nearer root if it's in range, else the farther one
+    __m256d t0_ok = _mm256_and_pd(_mm256_cmp_pd(t0, vmin, _CMP_GE_OQ), _mm256_cmp_pd(t0, vmax, _CMP_LE_OQ));
+    __m256d root = _mm256_blendv_pd(t1, t0, t0_ok);
+    __m256d root_ok = _mm256_and_pd(_mm256_cmp_pd(root, vmin, _CMP_GE_OQ), _mm256_cmp_pd(root, vmax, _CMP_LE_OQ));
+    valid = _mm256_and_pd(valid, root_ok);
+    _mm256_store_pd(t, root);
+    mask = _mm256_movemask_pd(valid);
+#elif defined(RT_HAVE_SSE2)
+    // two lanes of doubles per register, so the packet takes two passes
+    __m128d ox = _mm_set1_pd(o.x()), oy = _mm_set1_pd(o.y()), oz = _mm_set1_pd(o.z());
+    __m128d dx = _mm_set1_pd(d.x()), dy = _mm_set1_pd(d.y()), dz = _mm_set1_pd(d.z());
+    __m128d va = _mm_set1_pd(a);
+    __m128d vmin = _mm_set1_pd(t_min), vmax = _mm_set1_pd(t_max);
+
+    for (int k = 0; k < width; k += 2) {
+        __m128d ocx = _mm_sub_pd(ox, _mm_loadu_pd(cx + k));
+        __m128d ocy = _mm_sub_pd(oy, _mm_loadu_pd(cy + k));
+        __m128d ocz = _mm_sub_pd(oz, _mm_loadu_pd(cz + k));
+        __m128d half_b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, dx), _mm_mul_pd(ocy, dy)), _mm_mul_pd(ocz, dz));
+        __m128d oc2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, ocx), _mm_mul_pd(ocy, ocy)), _mm_mul_pd(ocz, ocz));
+        __m128d c = _mm_sub_pd(oc2, _mm_loadu_pd(r2 + k));
+        __m128d disc = _mm_sub_pd(_mm_mul_pd(half_b, half_b), _mm_mul_pd(va, c));
+
+        __m128d valid = _mm_cmpge_pd(disc, _mm_setzero_pd());
+        __m128d sqrtd = _mm_sqrt_pd(_mm_max_pd(disc, _mm_setzero_pd()));
+        __m128d neg_b = _mm_sub_pd(_mm_setzero_pd(), half_b);
+        __m128d t0 = _mm_div_pd(_mm_sub_pd(neg_b, sqrtd), va);
+        __m128d t1 = _mm_div_pd(_mm_add_pd(neg_b, sqrtd), va);
+
+        // nearer root if it's in range, else the farther one (SSE2 has no blend, so and/andnot/or)
+        __m128d t0_ok = _mm_and_pd(_mm_cmpge_pd(t0, vmin), _mm_cmple_pd(t0, vmax));
+        __m128d root = _mm_or_pd(_mm_and_pd(t0_ok, t0), _mm_andnot_pd(t0_ok, t1));
+        __m128d root_ok = _mm_and_pd(_mm_cmpge_pd(root, vmin), _mm_cmple_pd(root, vmax));
+        valid = _mm_and_pd(valid, root_ok);
+        _mm_store_pd(t + k, root);
+        mask |= _mm_movemask_pd(valid) << k;
+    }
+#else
+    for (int k = 0; k < width; k++) {
+        double ocx = o.x() - cx[k], ocy = o.y() - cy[k], ocz = o.z() - cz[k];
+        double half_b = ocx * d.x() + ocy * d.y() + ocz * d.z();
+        double c = (ocx * ocx + ocy * ocy + ocz * ocz) - r2[k];
+        double disc = half_b * half_b - a * c;
+        double sqrtd = sqrt(disc > 0 ? disc : 0);
+        double t0 = (-half_b - sqrtd) / a;
+        double t1 = (-half_b + sqrtd) / a;
+        double root = (t0 >= t_min && t0 <= t_max) ? t0 : t1;
+        bool valid = disc >= 0 && root >= t_min && root <= t_max;
+        t[k] = root;
+        if (valid) mask |= 1 << k;
+    }
+#endif
+
+    // masked min over the lanes; <= so a later lane wins a tie, like testing them one by one
+    int best = -1;
+    double closest = t_max;
+    for (int k = 0; k < width; k++) {
+        if ((mask & (1 << k)) && t[k] <= closest) {
+            closest = t[k];
+            best = k;
+        }
+    }
+    t_hit = closest;
+    return best;
+}
+
+#endif
@@ -0,0 +1,132 @@
+// RayTracerTests: checks for behavior that a rendered image alone wouldn't show. Prints each
+// check and exits with the number that failed.
+//
+//     RayTracerTests
+
+#include <iostream>
+#include "rtweekend.h"
+#include "scene.h"
+#include "scene_loader.h"
+#include "bvh.h"
+#include "compressed_bvh.h"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+
+using namespace std;
+
+int failures = 0;
+
+void Check(bool ok, const string& what) {
+	cout << (ok ? "ok    " : "FAIL  ") << what << "\n";
+	failures += !ok;
+}
+
+// Loads text as a scene file, through a file since that's all ReadFile takes
+bool LoadScene(const string& text, scene& sc) {
+	const char* path = "raytracer_tests.test";
+	{
+		ofstream out(path, ios::binary);
+		out << text;
+	}
+	// ReadFile echoes every line
+	std::streambuf* console = cout.rdbuf(nullptr);
+	bool loaded = ReadFile(path, sc);
+	cout.rdbuf(console);
+	cout.clear();
+	std::remove(path);
+	return loaded;
+}
+
+// the same text with the first "from" replaced by "to"
+string Edit(string text, const string& from, const string& to) {
+	size_t at = text.find(from);
+	if (at != string::npos) text.replace(at, from.size(), to);
+	return text;
+}
+
+// Three spheres and a triangle. The first two spheres share a material entry, and the third's
+// diffuse command sets the same values again, so an index based on value equality would merge
+// its entry with theirs.
+const string gbufferScene =
+	"size 64 48\n"
+	"camera 0 0 5 0 0 0 0 1 0 45\n"
+	"diffuse 1 1 1\n"
+	"sphere -1 0 0 0.5\n"
+	"sphere 1 0 0 0.5\n"
+	"diffuse 1 1 1\n"
+	"sphere 0 1 0 0.5\n"
+	"diffuse 0.5 0.5 0.5\n"
+	"maxverts 3\n"
+	"vertex -1 -1 0\n"
+	"vertex 1 -1 0\n"
+	"vertex 0 -2 0\n"
+	"tri 0 1 2\n";
+
+// the G-buffer cache has to survive material edits and miss on geometry edits, see gbuffer.h
+void TestGBufferKey() {
+	scene original, recolored, moved, extraCommand;
+	bool loaded = LoadScene(gbufferScene, original)
+		&& LoadScene(Edit(gbufferScene, "diffuse 1 1 1", "diffuse 0.9 0.9 0.9"), recolored)
+		&& LoadScene(Edit(gbufferScene, "sphere 1 0 0 0.5", "sphere 1.5 0 0 0.5"), moved)
+		&& LoadScene(Edit(gbufferScene, "sphere 1 0 0 0.5", "specular 0 0 0\nsphere 1 0 0 0.5"), extraCommand);
+	Check(loaded, "G-buffer scenes load");
+	if (!loaded) return;
+
+	Check(recolored.gbuffer_key() == original.gbuffer_key(), "editing a shared material keeps the G-buffer key");
+	Check(recolored.materials.size() == original.materials.size(), "editing a shared material keeps the material entries");
+	Check(recolored.materials.size() == 3 && recolored.materials[0].diffuse.x() == 0.9f && recolored.materials[1].diffuse.x() == 1,
+		"the edited values are in the edited entry only");
+	Check(moved.gbuffer_key() != original.gbuffer_key(), "moving a sphere changes the G-buffer key");
+	Check(extraCommand.gbuffer_key() != original.gbuffer_key(), "a material command between two objects changes the G-buffer key");
+}
+
+// A bvh at its 60 level depth cap whose bottom leaf still holds 1792 primitives, built by hand
+// since the builder only makes one from pathological input. Every box is the same, so a ray
+// visits both children everywhere and pushes an entry at every level. The compressed copy splits
+// that leaf into 8 more levels of 7 primitive leaves, past the 64 entry stack hit starts with.
+void TestCompressedDepth() {
+	const int chainDepth = 60, bigLeaf = 7 << 8;
+	aabb box(point3(-2, -2, -2), point3(2, 2, 2));
+	bvh tree;
+	for (int k = 0; k < chainDepth; k++) {
+		// interior node, its first child a one sphere leaf, its second the rest of the chain
+		int index = static_cast<int>(tree.nodes.size());
+		tree.nodes.push_back({ box, index + 2, 0, 2, -1 });
+		tree.nodes.push_back({ box, static_cast<int>(tree.prim_refs.size()), 1, 0, -1 });
+		tree.prim_refs.push_back(static_cast<int>(tree.objects.size()));
+		tree.objects.push_back(make_shared<sphere>(point3(0, 0, 0), 1));
+	}
+	tree.nodes.push_back({ box, static_cast<int>(tree.prim_refs.size()), bigLeaf, 0, -1 });
+	for (int i = 0; i < bigLeaf; i++) {
+		tree.prim_refs.push_back(static_cast<int>(tree.objects.size()));
+		// the last primitive of the deepest leaf is the nearest hit
+		tree.objects.push_back(make_shared<sphere>(point3(0, 0, 0), i == bigLeaf - 1 ? 2 : 1));
+	}
+
+	compressed_bvh small(tree);
+	Check(small.max_depth == chainDepth + 8, "compressed bvh depth counts the levels split leaves add");
+
+	ray r(point3(0, 0, 5), vec3(0, 0, -1));
+	hit_record full, compressed;
+	bool fullHit = tree.hit(r, 0.001, infinity, full);
+	bool compressedHit = small.hit(r, 0.001, infinity, compressed);
+	Check(fullHit && compressedHit && compressed.t == full.t && compressed.object == full.object,
+		"compressed bvh deeper than 64 levels finds the bvh's hit");
+
+	// the deeper stack is kept per thread, so only the first ray on a thread allocates it
+	long long before = allocation_count();
+	small.hit(r, 0.001, infinity, compressed);
+	bool allocated = allocation_count() != before;
+	Check(!allocated, "compressed bvh deeper than 64 levels traces without allocating");
+}
+
+int main() {
+	TestGBufferKey();
+	TestCompressedDepth();
+	cout << (failures ? to_string(failures) + " failed\n" : "all passed\n");
+	return failures;
+}
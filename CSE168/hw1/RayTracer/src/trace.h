@@ -0,0 +1,162 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A timeline of a render in the Chrome trace event format, for chrome://tracing or
+// ui.perfetto.dev. Each span is a complete ("X") event on a lane: lane 0 is the main thread, lane
+// w + 1 is parallel_for worker w. parallel_for starts new threads every call, so lanes follow the
+// worker index rather than the OS thread; that keeps one lane per worker across all the phases.
+class trace_log {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    trace_log() : start(clock::now()) {}
+
+    // args, if given, is the inside of a JSON object, e.g. "\"rows\": 4"; safe to call from any thread
+    void span(const std::string& name, const char* category, int lane, clock::time_point begin, clock::time_point end,
+        const std::string& args = "");
+    bool save(const std::string& path) const;
+
+    size_t size() const { return events.size(); }
+
+private:
+    struct event {
+        std::string name;
+        const char* category;
+        int lane;
+        double begin_us, duration_us;
+        std::string args;
+    };
+
+    clock::time_point start;
+    mutable std::mutex lock;
+    std::vector<event> events;
+    int lanes = 1;
+};
+
+void trace_log::span(const std::string& name, const char* category, int lane, clock::time_point begin, clock::time_point end,
+    const std::string& args) {
+    event e{ name, category, lane,
+        std::chrono::duration<double, std::micro>(begin - start).count(),
+        std::chrono::duration<double, std::micro>(end - begin).count(), args };
+    std::lock_guard<std::mutex> guard(lock);
+    events.push_back(std::move(e));
+    if (lane + 1 > lanes) lanes = lane + 1;
+}
+
+// the characters JSON strings can't hold as they are; names are paths and scene commands
+inline std::string json_escape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            out += code;
+        }
+        else out += c;
+    }
+    return out;
+}
+
+bool trace_log::save(const std::string& path) const {
+    std::ofstream out(path, std::ios::trunc);
+    std::lock_guard<std::mutex> guard(lock);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    // lane names, so the viewer says which is the main thread
+    for (int lane = 0; lane < lanes; lane++) {
+        out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << lane << ", \"args\": {\"name\": \""
+            << (lane == 0 ? std::string("main") : "worker " + std::to_string(lane - 1)) << "\"}},\n";
+    }
+    char times[64];
+    for (size_t i = 0; i < events.size(); i++) {
+        const event& e = events[i];
+        snprintf(times, sizeof(times), "\"ts\": %.3f, \"dur\": %.3f", e.begin_us, e.duration_us);
+        out << "{\"name\": \"" << json_escape(e.name) << "\", \"cat\": \"" << e.category << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+            << e.lane << ", " << times;
+        if (!e.args.empty()) out << ", \"args\": {" << e.args << "}";
+        out << (i + 1 < events.size() ? "},\n" : "}\n");
+    }
+    out << "]}\n";
+    out.flush();
+    if (!out) {
+        std::cerr << "Unable to write trace " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+// one "key": value pair for span args
+inline std::string trace_arg(const char* key, const std::string& value) {
+    return "\"" + std::string(key) + "\": \"" + json_escape(value) + "\"";
+}
+
+inline std::string trace_arg(const char* key, long long value) {
+    return "\"" + std::string(key) + "\": " + std::to_string(value);
+}
+
+// the trace being recorded, null unless --trace was given; spans cost nothing but this check then
+inline trace_log*& active_trace() {
+    static trace_log* trace = nullptr;
+    return trace;
+}
+
+// the lane spans go on when they don't say: 0, or what a worker doing main-thread work (loading a
+// batch scene, say) has set for its thread
+inline int& trace_lane() {
+    static thread_local int lane = 0;
+    return lane;
+}
+
+// sets trace_lane() for the calling thread until it goes out of scope
+class trace_lane_scope {
+public:
+    explicit trace_lane_scope(int lane) : previous(trace_lane()) { trace_lane() = lane; }
+    trace_lane_scope(const trace_lane_scope&) = delete;
+    trace_lane_scope& operator=(const trace_lane_scope&) = delete;
+    ~trace_lane_scope() { trace_lane() = previous; }
+
+private:
+    int previous;
+};
+
+// Records the time from construction to destruction (or end()) as a span, if a trace is being
+// recorded. Spans with the same name get the same color in the viewer, so which row or file a span
+// is goes in args rather than the name.
+class trace_span {
+public:
+    trace_span(const char* name, const char* category) : trace_span(name, category, trace_lane()) {}
+    trace_span(const char* name, const char* category, int lane)
+        : label(name), category(category), lane(lane), begin(active_trace() ? trace_log::clock::now() : trace_log::clock::time_point()) {}
+    trace_span(const trace_span&) = delete;
+    trace_span& operator=(const trace_span&) = delete;
+    ~trace_span() { end(); }
+
+    void end() {
+        if (ended || !active_trace()) return;
+        ended = true;
+        active_trace()->span(label, category, lane, begin, trace_log::clock::now(), args);
+    }
+
+    // shown in the viewer when the span is selected, the inside of a JSON object
+    std::string args;
+
+private:
+    const char* label;
+    const char* category;
+    int lane;
+    trace_log::clock::time_point begin;
+    bool ended = false;
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+
+// 4x4 matrix for the scene file's transform stack
+// column vectors like OpenGL/glm, so transforms are applied right to left: p' = M * p
+class mat4 {
+public:
+    mat4() : m{ {1,0,0,0}, {0,1,0,0}, {0,0,1,0}, {0,0,0,1} } {}
+
+    point3 transform_point(const point3& p) const {
+        return point3(
+            m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+            m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+            m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+    }
+
+    vec3 transform_vector(const vec3& v) const {
+        return vec3(
+            m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+            m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+            m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+    }
+
+    // normals go through the inverse transpose; call this on the inverse matrix
+    vec3 transform_normal(const vec3& n) const {
+        return vec3(
+            m[0][0] * n.x() + m[1][0] * n.y() + m[2][0] * n.z(),
+            m[0][1] * n.x() + m[1][1] * n.y() + m[2][1] * n.z(),
+            m[0][2] * n.x() + m[1][2] * n.y() + m[2][2] * n.z());
+    }
+
+    // the scene file only builds affine matrices, so invert the 3x3 part and the translation separately
+    mat4 inverse() const {
+        mat4 r;
+        double det =
+            m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+            m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+            m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        double inv_det = 1.0 / det;
+
+        r.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv_det;
+        r.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+        r.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+        r.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inv_det;
+        r.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+        r.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+        r.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv_det;
+        r.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+        r.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+
+        for (int i = 0; i < 3; i++)
+            r.m[i][3] = -(r.m[i][0] * m[0][3] + r.m[i][1] * m[1][3] + r.m[i][2] * m[2][3]);
+
+        return r;
+    }
+
+public:
+    double m[4][4];
+};
+
+inline mat4 operator*(const mat4& a, const mat4& b) {
+    mat4 r;
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+    return r;
+}
+
+inline mat4 translation(double tx, double ty, double tz) {
+    mat4 r;
+    r.m[0][3] = tx;
+    r.m[1][3] = ty;
+    r.m[2][3] = tz;
+    return r;
+}
+
+inline mat4 scaling(double sx, double sy, double sz) {
+    mat4 r;
+    r.m[0][0] = sx;
+    r.m[1][1] = sy;
+    r.m[2][2] = sz;
+    return r;
+}
+
+// Rodrigues' rotation formula, angle in degrees (same as Transform::rotate from CSE167x)
+inline mat4 rotation(const vec3& axis, double degrees) {
+    vec3 a = unit_vector(axis);
+    double theta = degrees_to_radians(degrees);
+    double c = cos(theta);
+    double s = sin(theta);
+    double x = a.x(), y = a.y(), z = a.z();
+
+    mat4 r;
+    r.m[0][0] = c + (1 - c) * x * x;     r.m[0][1] = (1 - c) * x * y - s * z; r.m[0][2] = (1 - c) * x * z + s * y;
+    r.m[1][0] = (1 - c) * x * y + s * z; r.m[1][1] = c + (1 - c) * y * y;     r.m[1][2] = (1 - c) * y * z - s * x;
+    r.m[2][0] = (1 - c) * x * z - s * y; r.m[2][1] = (1 - c) * y * z + s * x; r.m[2][2] = c + (1 - c) * z * z;
+    return r;
+}
+
+// an object placed in the world by a transform
+// rays are moved into object space for the hit test and the hit is moved back out
+class transformed : public hittable {
+public:
+    transformed(shared_ptr<hittable> p, const mat4& m)
+        : ptr(p), object_to_world(m), world_to_object(m.inverse()) {}
+
+    virtual bool hit(
+        const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
+
+public:
+    shared_ptr<hittable> ptr;
+    mat4 object_to_world;
+    mat4 world_to_object;
+};
+
+bool transformed::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    // the direction is not renormalized, so t means the same thing in both spaces
+    ray object_ray(world_to_object.transform_point(r.origin()), world_to_object.transform_vector(r.direction()));
+
+    if (!ptr->hit(object_ray, t_min, t_max, rec))
+        return false;
+
+    rec.p = r.at(rec.t);
+    // rec.normal was flipped against the object-space ray; flip it back before transforming
+    vec3 outward_normal = rec.front_face ? rec.normal : -rec.normal;
+    rec.set_face_normal(r, unit_vector(world_to_object.transform_normal(outward_normal)));
+    rec.object = this;
+
+    return true;
+}
+
+bool transformed::bounding_box(aabb& output_box) const {
+    aabb box;
+    if (!ptr->bounding_box(box)) return false;
+
+    // bound the eight transformed corners
+    output_box = aabb();
+    for (int i = 0; i < 8; i++) {
+        point3 corner(
+            (i & 1) ? box.maximum.x() : box.minimum.x(),
+            (i & 2) ? box.maximum.y() : box.minimum.y(),
+            (i & 4) ? box.maximum.z() : box.minimum.z());
+        output_box.expand(object_to_world.transform_point(corner));
+    }
+    return true;
+}
+
+#endif
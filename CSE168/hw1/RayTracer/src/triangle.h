@@ -0,0 +1,106 @@
+#ifndef TRIANGLE_H
+#define TRIANGLE_H
+
+#include "hittable.h"
+#include "vec3.h"
+
+// triangle with its vertices already in world space (the parser applies the transform stack to them)
+class triangle : public hittable {
+public:
+    triangle() {}
+    triangle(point3 a, point3 b, point3 c, int m = 0) : v0(a), v1(b), v2(c), mat_id(m) {
+        normal = unit_vector(cross(v1 - v0, v2 - v0));
+    }
+
+    virtual bool hit(
+        const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
+    virtual aabb clipped_box(const aabb& clip) const override;
+
+public:
+    point3 v0, v1, v2;
+    vec3 normal;
+    int mat_id;
+};
+
+// Moller-Trumbore: solves A + tb = (1-u-v)v0 + u*v1 + v*v2 for t, u, v with Cramer's rule
+bool triangle::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    vec3 e1 = v1 - v0;
+    vec3 e2 = v2 - v0;
+    vec3 pvec = cross(r.direction(), e2);
+    auto det = dot(e1, pvec);
+    // ray is parallel to the triangle's plane
+    if (fabs(det) < 1e-12) return false;
+    auto inv_det = 1.0 / det;
+
+    vec3 tvec = r.origin() - v0;
+    auto u = dot(tvec, pvec) * inv_det;
+    if (u < 0 || u > 1) return false;
+
+    vec3 qvec = cross(tvec, e1);
+    auto v = dot(r.direction(), qvec) * inv_det;
+    if (v < 0 || u + v > 1) return false;
+
+    auto t = dot(e2, qvec) * inv_det;
+    if (t < t_min || t_max < t) return false;
+
+    rec.t = t;
+    rec.p = r.at(t);
+    rec.set_face_normal(r, normal);
+    rec.mat_id = mat_id;
+    rec.object = this;
+
+    return true;
+}
+
+bool triangle::bounding_box(aabb& output_box) const {
+    output_box = aabb();
+    output_box.expand(v0);
+    output_box.expand(v1);
+    output_box.expand(v2);
+    return true;
+}
+
+// clips the triangle against the six planes of the box (Sutherland-Hodgman) and bounds what is left
+// much tighter than box-intersect-box for long thin triangles crossing a split plane diagonally
+aabb triangle::clipped_box(const aabb& clip) const {
+    // a triangle clipped by 6 planes has at most 9 vertices
+    point3 poly[16] = { v0, v1, v2 };
+    point3 next[16];
+    int n = 3;
+
+    for (int axis = 0; axis < 3 && n > 0; axis++) {
+        for (int side = 0; side < 2 && n > 0; side++) {
+            double plane = side == 0 ? clip.minimum[axis] : clip.maximum[axis];
+            // most planes don't cut the triangle at all (the bvh only narrows one axis at a time)
+            bool all_in = true;
+            for (int i = 0; i < n && all_in; i++)
+                all_in = side == 0 ? poly[i][axis] >= plane : poly[i][axis] <= plane;
+            if (all_in) continue;
+
+            int m = 0;
+            for (int i = 0; i < n; i++) {
+                const point3& a = poly[i];
+                const point3& b = poly[(i + 1) % n];
+                bool a_in = side == 0 ? a[axis] >= plane : a[axis] <= plane;
+                bool b_in = side == 0 ? b[axis] >= plane : b[axis] <= plane;
+                if (a_in) next[m++] = a;
+                if (a_in != b_in) {
+                    double s = (plane - a[axis]) / (b[axis] - a[axis]);
+                    point3 p = a + s * (b - a);
+                    // pin to the plane exactly so round-off can't leak outside the clip box
+                    p[axis] = plane;
+                    next[m++] = p;
+                }
+            }
+            n = m;
+            for (int i = 0; i < n; i++) poly[i] = next[i];
+        }
+    }
+
+    aabb box;
+    for (int i = 0; i < n; i++) box.expand(poly[i]);
+    return intersection(box, clip);
+}
+
+#endif
@@ -104,4 +104,9 @@ inline vec3 unit_vector(vec3 v) {
     return v / v.length();
 }
 
+// mirror v about the plane with unit normal n
+inline vec3 reflect(const vec3& v, const vec3& n) {
+    return v - 2 * dot(v, n) * n;
+}
+
 #endif
\ No newline at end of file
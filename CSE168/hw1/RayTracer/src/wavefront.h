@@ -0,0 +1,459 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "scene.h"
+#include "parallel.h"
+#include "ray_sort.h"
+#include "shadow_cache.h"
+#include "light_arrays.h"
+#include "trace.h"
+#include "arena.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// Structure-of-arrays queue of rays waiting for the next stage
+struct ray_queue {
+    std::vector<double> ox, oy, oz;
+    std::vector<double> dx, dy, dz;
+    // shadow rays stop at the light
+    std::vector<double> t_max;
+    // camera/reflection rays: product of speculars along the path
+    // shadow rays: the light's Blinn-Phong contribution if it turns out to be visible
+    std::vector<double> wr, wg, wb;
+    std::vector<int> pixel;
+
+    int size() const { return static_cast<int>(pixel.size()); }
+
+    void resize(int n) {
+        for (auto* v : { &ox, &oy, &oz, &dx, &dy, &dz, &t_max, &wr, &wg, &wb })
+            v->resize(n);
+        pixel.resize(n);
+    }
+
+    void clear() {
+        for (auto* v : { &ox, &oy, &oz, &dx, &dy, &dz, &t_max, &wr, &wg, &wb })
+            v->clear();
+        pixel.clear();
+    }
+
+    void push(const ray& r, double tmax, const color& weight, int pix) {
+        ox.push_back(r.orig.x()); oy.push_back(r.orig.y()); oz.push_back(r.orig.z());
+        dx.push_back(r.dir.x()); dy.push_back(r.dir.y()); dz.push_back(r.dir.z());
+        t_max.push_back(tmax);
+        wr.push_back(weight.x()); wg.push_back(weight.y()); wb.push_back(weight.z());
+        pixel.push_back(pix);
+    }
+
+    void set(int i, const ray& r, double tmax, const color& weight, int pix) {
+        ox[i] = r.orig.x(); oy[i] = r.orig.y(); oz[i] = r.orig.z();
+        dx[i] = r.dir.x(); dy[i] = r.dir.y(); dz[i] = r.dir.z();
+        t_max[i] = tmax;
+        wr[i] = weight.x(); wg[i] = weight.y(); wb[i] = weight.z();
+        pixel[i] = pix;
+    }
+
+    ray get(int i) const { return ray(point3(ox[i], oy[i], oz[i]), vec3(dx[i], dy[i], dz[i])); }
+    color weight(int i) const { return color(wr[i], wg[i], wb[i]); }
+};
+
+// closest-hit results for a ray_queue, same indexing
+struct hit_queue {
+    std::vector<char> hit;
+    std::vector<double> t;
+    std::vector<double> px, py, pz;
+    std::vector<double> nx, ny, nz;
+    std::vector<int> mat_id;
+
+    void resize(int n) {
+        hit.resize(n);
+        for (auto* v : { &t, &px, &py, &pz, &nx, &ny, &nz })
+            v->resize(n);
+        mat_id.resize(n);
+    }
+};
+
+struct wavefront_stats {
+    double generate_ms = 0;
+    double closest_hit_ms = 0;
+    double shade_ms = 0;
+    double shadow_ms = 0;
+    double accumulate_ms = 0;
+    double sort_ms = 0;
+    long long camera_rays = 0;
+    long long reflection_rays = 0;
+    long long shadow_rays = 0;
+    long long shadow_blocked = 0;
+    long long shadow_cache_hits = 0;
+    // consecutive secondary rays (in trace order) that share an octant and a coarse cell
+    long long secondary_pairs = 0;
+    long long coherent_pairs = 0;
+
+    void print(std::ostream& out) const {
+        out << "Wavefront stages:\n"
+            << "  generate:       " << generate_ms << " ms (" << camera_rays << " camera rays)\n"
+            << "  closest hit:    " << closest_hit_ms << " ms (" << camera_rays + reflection_rays << " rays, " << reflection_rays << " reflections)\n"
+            << "  shade:          " << shade_ms << " ms\n"
+            << "  shadow rays:    " << shadow_ms << " ms (" << shadow_rays << " rays, " << shadow_blocked << " blocked, "
+            << shadow_cache_hits << " of those by the cached occluder)\n"
+            << "  accumulate:     " << accumulate_ms << " ms\n"
+            << "  sort:           " << sort_ms << " ms\n"
+            << "  coherence:      " << (secondary_pairs ? 100.0 * coherent_pairs / secondary_pairs : 0)
+            << "% of consecutive secondary rays share an octant and 1/16 scene cell\n";
+    }
+};
+
+// Renders the same image as the recursive ray_color, but breadth first: every stage runs over a
+// whole queue of rays before the next one starts. Pixels are processed in waves of wave_size so
+// the queues stay a fixed size regardless of the image.
+class wavefront_renderer {
+public:
+    // interleave: closest hits go through hittable::hit_batch instead of one hit() per ray
+    wavefront_renderer(const scene& s, const hittable& w, int threads, bool interleave = false)
+        : sc(s), world(w), num_threads(threads), batched(interleave) {}
+
+    // fills pixels (width * height, row j = 0 at the bottom) and returns per-stage timings; only
+    // region is traced, the rest stays black
+    wavefront_stats render(std::vector<color>& pixels);
+
+public:
+    // bin reflection and shadow rays by ray_sort_key before tracing them
+    bool sort_rays = false;
+    // > 0: only shade the lights light_arrays::influential keeps, as the recursive renderer does
+    double light_cutoff = 0;
+    // test each light's last occluder first, see shadow_cache.h
+    bool shadow_caching = true;
+    // the pixels to trace, empty for the scene's render_region
+    pixel_rect region;
+
+    static const int wave_size = 1 << 16;
+    // rays per work item handed to a worker within a stage
+    static const int block_size = 1024;
+    // every path in a wave can queue a shadow ray per light, so scenes with more than 16 lights get
+    // waves of fewer pixels to keep the shadow queue under this many rays
+    static const int max_wave_shadows = 1 << 20;
+
+    static int wave_pixels(int num_lights) {
+        return std::max(1, std::min(wave_size, max_wave_shadows / std::max(1, num_lights)));
+    }
+
+private:
+    void generate(int first_pixel, int count);
+    void closest_hit();
+    void shade(int depth);
+    void trace_shadows();
+    void accumulate(std::vector<color>& pixels);
+
+    template <typename F>
+    void run_stage(const char* name, int count, double& ms, const F& body);
+    void order_rays(const ray_queue& q, std::vector<int>& indices);
+
+    const scene& sc;
+    const hittable& world;
+    int num_threads;
+    bool batched;
+    wavefront_stats stats;
+
+    ray_queue paths;
+    ray_queue next_paths;
+    hit_queue hits;
+    // shadow rays for the lights that contribute, path by path and in light order within a path:
+    // path i's are [shadow_first[i], shadow_first[i + 1])
+    ray_queue shadows;
+    std::vector<int> shadow_light;
+    std::vector<int> shadow_first;
+    std::vector<char> visible;
+    // what shade queues for each block of paths, gathered into shadows after the stage
+    struct shadow_block {
+        ray_queue rays;
+        std::vector<int> light;
+    };
+    std::vector<shadow_block> shadow_blocks;
+    // shadow rays grouped by light, in the order they get traced, where each light's group starts
+    // and where its next ray goes while they're being grouped
+    std::vector<int> shadow_order;
+    std::vector<int> light_start, light_next;
+    // per worker, the lights a shading point keeps when culling
+    std::vector<std::vector<int>> nearby_lights;
+    // one per worker, kept across waves and bounces
+    std::vector<shadow_cache> shadow_caches;
+    light_arrays light_soa;
+    std::vector<light_terms> terms;
+    ray_queue scratch;
+    // per worker, reset for every block: closest hit's ray and hit lists
+    std::vector<memory_arena> block_arenas;
+    // reflection paths still going, one light's shadow slots, and their sort keys; members so
+    // their capacity carries over from bounce to bounce and wave to wave
+    std::vector<int> live, batch;
+    std::vector<uint64_t> keys;
+    aabb bounds;
+    // per path: local shading (ambient + emission), and whether it spawned a reflection
+    std::vector<double> lr, lg, lb;
+    std::vector<char> reflects;
+};
+
+// splits [0, count) into blocks and runs body(worker, first, last) on the worker pool, timing the
+// stage; name is what the stage and its blocks are called in a trace
+template <typename F>
+void wavefront_renderer::run_stage(const char* name, int count, double& ms, const F& body) {
+    auto start = std::chrono::steady_clock::now();
+    trace_span stage(name, "render");
+    if (active_trace()) stage.args = trace_arg("rays", count);
+    int blocks = (count + block_size - 1) / block_size;
+    parallel_for(blocks, num_threads, [&](int w, int b) {
+        trace_span block(name, "render", w + 1);
+        body(w, b * block_size, std::min(count, (b + 1) * block_size));
+    });
+    ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+wavefront_stats wavefront_renderer::render(std::vector<color>& pixels) {
+    memory_scope renderMemory(memory_tag::render);
+    stats = wavefront_stats();
+    if (region.empty()) region = sc.render_region();
+    int total = region.width() * region.height();
+    pixels.assign(size_t(sc.width) * sc.height, color(0, 0, 0));
+    world.bounding_box(bounds);
+    shadow_caches.assign(std::max(1, num_threads), shadow_cache(static_cast<int>(sc.lights.size()), shadow_caching));
+    light_soa = light_arrays(sc.lights, sc.attenuation, light_cutoff);
+    terms.assign(std::max(1, num_threads), light_terms());
+    nearby_lights.assign(std::max(1, num_threads), std::vector<int>());
+    block_arenas.assign(std::max(1, num_threads), memory_arena(16 * 1024));
+
+    const int wave = wave_pixels(static_cast<int>(sc.lights.size()));
+    for (int first = 0; first < total; first += wave) {
+        generate(first, std::min(wave, total - first));
+
+        for (int depth = 1; paths.size() > 0; depth++) {
+            closest_hit();
+            shade(depth);
+            trace_shadows();
+            accumulate(pixels);
+            std::swap(paths, next_paths);
+        }
+    }
+
+    for (const auto& c : shadow_caches) {
+        stats.shadow_blocked += c.blocked;
+        stats.shadow_cache_hits += c.hits;
+    }
+    return stats;
+}
+
+// camera rays for pixels [first_pixel, first_pixel + count) of the region, one per pixel at the
+// pixel corner; paths carry the pixel's index in the whole image
+void wavefront_renderer::generate(int first_pixel, int count) {
+    camera cam = sc.make_camera();
+    paths.resize(count);
+    run_stage("generate", count, stats.generate_ms, [&](int, int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            int i = region.x0 + (first_pixel + k) % region.width();
+            int j = region.y0 + (first_pixel + k) / region.width();
+            ray r = cam.get_ray(double(i) / (sc.width - 1), double(j) / (sc.height - 1));
+            paths.set(k, r, infinity, color(1, 1, 1), j * sc.width + i);
+        }
+    });
+    stats.camera_rays += count;
+}
+
+void wavefront_renderer::closest_hit() {
+    int n = paths.size();
+    hits.resize(n);
+    run_stage("closest hit", n, stats.closest_hit_ms, [&](int worker, int begin, int end) {
+        int count = end - begin;
+        memory_arena& arena = block_arenas[worker];
+        arena.reset();
+        ray* rays = arena.allocate_array<ray>(count);
+        hit_record* recs = arena.allocate_array<hit_record>(count);
+        bool* hit = arena.allocate_array<bool>(count);
+        for (int k = 0; k < count; k++) rays[k] = paths.get(begin + k);
+
+        if (batched) {
+            world.hit_batch(rays, count, 0, infinity, recs, hit);
+        }
+        else {
+            for (int k = 0; k < count; k++)
+                hit[k] = world.hit(rays[k], 0, infinity, recs[k]);
+        }
+
+        for (int k = 0; k < count; k++) {
+            int i = begin + k;
+            hits.hit[i] = hit[k];
+            if (!hit[k]) continue;
+            const hit_record& rec = recs[k];
+            hits.t[i] = rec.t;
+            hits.px[i] = rec.p.x(); hits.py[i] = rec.p.y(); hits.pz[i] = rec.p.z();
+            hits.nx[i] = rec.normal.x(); hits.ny[i] = rec.normal.y(); hits.nz[i] = rec.normal.z();
+            hits.mat_id[i] = rec.mat_id;
+        }
+    });
+}
+
+// local shading for every hit; each light that adds anything queues a shadow ray in its block's
+// shadow_block, and reflective hits write a reflection ray into slot path of next_paths. Per-block
+// output keeps the stage free of shared counters; it's gathered into one compact queue afterwards.
+void wavefront_renderer::shade(int depth) {
+    int n = paths.size();
+    int num_lights = static_cast<int>(sc.lights.size());
+    shadow_blocks.resize((n + block_size - 1) / block_size);
+    shadow_first.assign(n + 1, 0);
+    next_paths.resize(n);
+    reflects.assign(n, 0);
+    lr.assign(n, 0); lg.assign(n, 0); lb.assign(n, 0);
+
+    run_stage("shade", n, stats.shade_ms, [&](int worker, int begin, int end) {
+        light_terms& t = terms[worker];
+        std::vector<int>& nearby = nearby_lights[worker];
+        shadow_block& out = shadow_blocks[begin / block_size];
+        out.rays.clear();
+        out.light.clear();
+        for (int i = begin; i < end; i++) {
+            if (!hits.hit[i]) continue;
+
+            const material& m = sc.materials[hits.mat_id[i]];
+            color weight = paths.weight(i);
+            color local = weight * (m.ambient + m.emission);
+            lr[i] = local.x(); lg[i] = local.y(); lb[i] = local.z();
+
+            point3 p(hits.px[i], hits.py[i], hits.pz[i]);
+            vec3 normal(hits.nx[i], hits.ny[i], hits.nz[i]);
+            vec3 dir(paths.dx[i], paths.dy[i], paths.dz[i]);
+            vec3 to_eye = -unit_vector(dir);
+            point3 origin = p + ray_epsilon * normal;
+
+            int queued = out.rays.size();
+            if (light_soa.culling()) {
+                // same terms as the recursive renderer's culled loop, light by light
+                light_soa.influential(p, m, nearby);
+                for (int l : nearby) {
+                    light_sample ls = sample_light(sc.lights[l], p, sc.attenuation);
+                    color c = blinn_phong(m, normal, ls.to_light, to_eye, ls.radiance);
+                    if (!(c.x() > 0 || c.y() > 0 || c.z() > 0)) continue;
+                    out.rays.push(ray(origin, ls.to_light), ls.distance, weight * c, paths.pixel[i]);
+                    out.light.push_back(l);
+                }
+            }
+            else {
+                blinn_phong_all(light_soa, m, p, normal, to_eye, sc.attenuation, t);
+                for (int l = 0; l < num_lights; l++) {
+                    int s = light_soa.slot[l];
+                    if (!t.contributes(s)) continue;
+                    color c(t.r[s], t.g[s], t.b[s]);
+                    out.rays.push(ray(origin, vec3(t.dx[s], t.dy[s], t.dz[s])), t.distance[s], weight * c, paths.pixel[i]);
+                    out.light.push_back(l);
+                }
+            }
+            shadow_first[i + 1] = out.rays.size() - queued;
+
+            if (depth < sc.maxdepth && m.reflective()) {
+                next_paths.set(i, ray(origin, reflect(unit_vector(dir), normal)), infinity, weight * m.specular, paths.pixel[i]);
+                reflects[i] = 1;
+            }
+        }
+    });
+
+    // gather the blocks' shadow rays into one queue, blocks (and so paths) in order
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) shadow_first[i + 1] += shadow_first[i];
+    int queued = shadow_first[n];
+    shadows.resize(queued);
+    shadow_light.resize(queued);
+    visible.assign(queued, 0);
+    for (int b = 0; b < static_cast<int>(shadow_blocks.size()); b++) {
+        const shadow_block& block = shadow_blocks[b];
+        int offset = shadow_first[b * block_size];
+        for (int k = 0; k < block.rays.size(); k++) {
+            shadows.set(offset + k, block.rays.get(k), block.rays.t_max[k], block.rays.weight(k), block.rays.pixel[k]);
+            shadow_light[offset + k] = block.light[k];
+        }
+    }
+    stats.shade_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // compact the reflection rays so the next bounce only sees live paths (sorted if asked to)
+    start = std::chrono::steady_clock::now();
+    live.clear();
+    for (int i = 0; i < n; i++)
+        if (reflects[i]) live.push_back(i);
+    stats.shade_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    order_rays(next_paths, live);
+
+    start = std::chrono::steady_clock::now();
+    scratch.resize(static_cast<int>(live.size()));
+    for (int k = 0; k < static_cast<int>(live.size()); k++)
+        scratch.set(k, next_paths.get(live[k]), infinity, next_paths.weight(live[k]), next_paths.pixel[live[k]]);
+    std::swap(next_paths, scratch);
+    stats.reflection_rays += live.size();
+    stats.shade_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // shadow rays are traced one light at a time, so a worker's block mostly tests the same light
+    // and its shadow cache entry stays warm; sorting (if on) happens within each light's batch
+    start = std::chrono::steady_clock::now();
+    light_start.assign(num_lights + 1, 0);
+    for (int s = 0; s < queued; s++) light_start[shadow_light[s] + 1]++;
+    for (int l = 0; l < num_lights; l++) light_start[l + 1] += light_start[l];
+    shadow_order.resize(queued);
+    light_next.assign(light_start.begin(), light_start.end() - 1);
+    for (int s = 0; s < queued; s++) shadow_order[light_next[shadow_light[s]]++] = s;
+    stats.shade_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    for (int l = 0; l < num_lights; l++) {
+        batch.assign(shadow_order.begin() + light_start[l], shadow_order.begin() + light_start[l + 1]);
+        order_rays(shadows, batch);
+        std::copy(batch.begin(), batch.end(), shadow_order.begin() + light_start[l]);
+    }
+}
+
+// sorts indices into q by ray_sort_key when sort_rays is on, and tallies the coherence of the
+// resulting order either way
+void wavefront_renderer::order_rays(const ray_queue& q, std::vector<int>& indices) {
+    int n = static_cast<int>(indices.size());
+    keys.resize(n);
+    auto key_of = [&](int i) {
+        return ray_sort_key(point3(q.ox[i], q.oy[i], q.oz[i]), vec3(q.dx[i], q.dy[i], q.dz[i]), bounds);
+    };
+
+    if (sort_rays) {
+        auto start = std::chrono::steady_clock::now();
+        for (int k = 0; k < n; k++) keys[k] = key_of(indices[k]);
+        sort_by_key(indices, keys);
+        stats.sort_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    for (int k = 1; k < n; k++) {
+        stats.secondary_pairs++;
+        stats.coherent_pairs += same_coarse_bin(key_of(indices[k - 1]), key_of(indices[k]));
+    }
+}
+
+void wavefront_renderer::trace_shadows() {
+    int n = static_cast<int>(shadow_order.size());
+    run_stage("shadow rays", n, stats.shadow_ms, [&](int worker, int begin, int end) {
+        shadow_cache& cache = shadow_caches[worker];
+        for (int k = begin; k < end; k++) {
+            int i = shadow_order[k];
+            visible[i] = !cache.occluded(world, shadow_light[i], shadows.get(i), shadows.t_max[i]);
+        }
+    });
+    stats.shadow_rays += n;
+}
+
+// adds this bounce's local shading and visible lights into the pixels, in the same order the
+// recursive renderer sums them so both produce the same image
+void wavefront_renderer::accumulate(std::vector<color>& pixels) {
+    auto start = std::chrono::steady_clock::now();
+    int n = paths.size();
+    for (int i = 0; i < n; i++) {
+        if (!hits.hit[i]) continue;
+        color sum(lr[i], lg[i], lb[i]);
+        for (int s = shadow_first[i]; s < shadow_first[i + 1]; s++)
+            if (visible[s]) sum += shadows.weight(s);
+        pixels[paths.pixel[i]] += sum;
+    }
+    stats.accumulate_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+#endif
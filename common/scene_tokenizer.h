@@ -0,0 +1,205 @@
+#ifndef SCENE_TOKENIZER_H
+#define SCENE_TOKENIZER_H
+
+// The scene file reader shared by the CSE167x hw2 viewer (readfile.cpp) and the CSE168 ray tracer
+// (scene_loader.h). Both used to read every line into a string and a stringstream and then compare
+// the command against each name in a long if/else chain. Here the whole file is read into one
+// buffer, lines and tokens are pointers into it, numbers are converted straight from the buffer,
+// and the command is found with one hash and one compare in a perfect hash table, so parsing a
+// file makes no allocations past the buffer itself. Each program keeps its own command set and
+// what the commands do; this only does the splitting and the lookup.
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace scene_file {
+
+// Characters from the file's text, not null terminated
+struct token {
+    const char* begin = nullptr;
+    const char* end = nullptr;
+
+    size_t size() const { return static_cast<size_t>(end - begin); }
+    bool empty() const { return begin == end; }
+    std::string str() const { return std::string(begin, end); }
+};
+
+inline std::ostream& operator<<(std::ostream& out, const token& t) {
+    return out.write(t.begin, static_cast<std::streamsize>(t.size()));
+}
+
+// the characters `stream >> value` skips
+inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// The tokens of one line, taken one at a time
+class line_tokenizer {
+public:
+    line_tokenizer(const char* begin, const char* end) : next_char(begin), line_end(end) {}
+
+    // false once the line has no more tokens
+    bool next(token& t) {
+        while (next_char < line_end && is_space(*next_char)) next_char++;
+        if (next_char == line_end) return false;
+        t.begin = next_char;
+        while (next_char < line_end && !is_space(*next_char)) next_char++;
+        t.end = next_char;
+        return true;
+    }
+
+    // The next count tokens as numbers. Stops at the first one that's missing or isn't a number,
+    // says which it was and returns false, like the readvals() both parsers started from.
+    bool read_floats(int count, float* values);
+
+private:
+    const char* next_char;
+    const char* line_end;
+};
+
+inline bool line_tokenizer::read_floats(int count, float* values) {
+    for (int i = 0; i < count; i++) {
+        token t;
+        bool ok = next(t);
+        if (ok) {
+            // strtof stops at the whitespace or end of text after the token, so it never reads
+            // past the line; the whole token has to be the number
+            char* stop = nullptr;
+            values[i] = std::strtof(t.begin, &stop);
+            ok = stop == t.end;
+        }
+        if (!ok) {
+            std::cout << "Failed reading value " << i << " will skip\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Command names to the ids a parser switches on. The table is sized and seeded when it's made so
+// that no two names land in the same slot, so a lookup hashes the token once and compares it with
+// at most one name.
+class command_table {
+public:
+    struct command {
+        const char* name;
+        int id;
+    };
+    static const int unknown = -1;
+
+    command_table(std::initializer_list<command> commands);
+
+    // the id of the command named t, unknown if there's none
+    int find(const token& t) const {
+        const slot& s = slots[hash(t.begin, t.size(), seed) & mask];
+        if (s.name && s.length == t.size() && std::memcmp(s.name, t.begin, s.length) == 0) return s.id;
+        return unknown;
+    }
+
+private:
+    struct slot {
+        const char* name = nullptr;
+        size_t length = 0;
+        int id = unknown;
+    };
+
+    // FNV-1a with the seed mixed into the starting value
+    static uint32_t hash(const char* s, size_t n, uint32_t seed) {
+        uint32_t h = 2166136261u ^ (seed * 16777619u);
+        for (size_t i = 0; i < n; i++) h = (h ^ static_cast<unsigned char>(s[i])) * 16777619u;
+        return h ^ (h >> 15);
+    }
+
+    std::vector<slot> slots;
+    uint32_t seed = 0;
+    uint32_t mask = 0;
+};
+
+inline command_table::command_table(std::initializer_list<command> commands) {
+    // at least twice as many slots as names, a few hundred seeds at each size before doubling it;
+    // with the couple dozen commands a scene file has this takes microseconds
+    size_t size = 1;
+    while (size < 2 * commands.size()) size *= 2;
+    for (;; size *= 2) {
+        for (uint32_t s = 0; s < 256; s++) {
+            slots.assign(size, slot());
+            bool collided = false;
+            for (const command& c : commands) {
+                size_t n = std::strlen(c.name);
+                slot& target = slots[hash(c.name, n, s) & (size - 1)];
+                if (target.name) {
+                    collided = true;
+                    break;
+                }
+                target.name = c.name;
+                target.length = n;
+                target.id = c.id;
+            }
+            if (!collided) {
+                seed = s;
+                mask = static_cast<uint32_t>(size - 1);
+                return;
+            }
+        }
+    }
+}
+
+// Reads the whole file into text; false if it can't be opened
+inline bool read_text_file(const char* filename, std::string& text) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) return false;
+    file.seekg(0, std::ios::end);
+    std::streamoff size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    text.resize(size > 0 ? static_cast<size_t>(size) : 0);
+    if (!text.empty()) file.read(&text[0], size);
+    text.resize(static_cast<size_t>(file.gcount()));
+    return true;
+}
+
+// How many lines the text had, and how many of them held a command
+struct parse_counts {
+    long long lines = 0;
+    long long commands = 0;
+};
+
+// Calls handle(id, command, args, line) for every line of text in order, except blank lines and
+// comments (a # as the line's first character). id is the command's id in commands or
+// command_table::unknown, command is its name, args gives the tokens after it and line is the
+// whole line without its line break.
+template <class Handler>
+parse_counts parse_commands(const std::string& text, const command_table& commands, Handler&& handle) {
+    parse_counts counts;
+    const char* next_line = text.data();
+    const char* text_end = next_line + text.size();
+    while (next_line < text_end) {
+        const char* begin = next_line;
+        const char* end = static_cast<const char*>(std::memchr(begin, '\n', text_end - begin));
+        next_line = end ? end + 1 : text_end;
+        if (!end) end = text_end;
+        // files written on Windows
+        if (end > begin && end[-1] == '\r') end--;
+        counts.lines++;
+
+        if (begin == end || *begin == '#') continue;
+        line_tokenizer args(begin, end);
+        token command;
+        if (!args.next(command)) continue;
+        counts.commands++;
+        token line;
+        line.begin = begin;
+        line.end = end;
+        handle(commands.find(command), command, args, line);
+    }
+    return counts;
+}
+
+}
+
+#endif